@@ -19,35 +19,68 @@ static const char *TAG = "golioth_tensorflow";
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "app_metrics.h"
+#include "detection_upload.h"
+#include "download_service.h"
 #include "model_handler.h"
+#include "model_regression.h"
 #include <sys/stat.h>
 #include "unistd.h"
 
 /* TFlite micro_speech */
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 
+#include "esp_attr.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
+#include "../tf_micro_speech/deferred_log.h"
 #include "../tf_micro_speech/main_functions.h"
-
-/* Component Queue */
-#define QUEUE_LENGTH CONFIG_GOLIOTH_OTA_MAX_NUM_COMPONENTS
-#define QUEUE_ITEM_SIZE sizeof(struct golioth_ota_component *)
-static StaticQueue_t xStaticQueue;
-static uint8_t ucQueueStorageArea[QUEUE_LENGTH * QUEUE_ITEM_SIZE];
-static QueueHandle_t xQueue;
+#include "../tf_micro_speech/ringbuf_bench.h"
 
 #define SD_MOUNT_POINT "/sdcard"
 #define MODEL_PACKAGE_NAME "model"
 #define STORED_MODEL_PATH SD_MOUNT_POINT "/use_this_model_path.txt"
+#define BAD_MODELS_PATH SD_MOUNT_POINT "/bad_models.txt"
+/* Verified models handed over by the download service */
+#define READY_QUEUE_LENGTH CONFIG_GOLIOTH_OTA_MAX_NUM_COMPONENTS
+#define READY_QUEUE_ITEM_SIZE sizeof(char *)
+static StaticQueue_t ready_queue_buffer;
+static uint8_t ready_queue_storage[READY_QUEUE_LENGTH * READY_QUEUE_ITEM_SIZE];
+static QueueHandle_t ready_queue;
+
 static char *selected_model_path = NULL;
 static bool new_model_available = false;
+static struct tf_model_ctx *model_context = NULL;
+
+/* Downloaded model under shadow evaluation, not yet selected */
+static char *candidate_model_path = NULL;
+static bool new_candidate_available = false;
+static struct tf_model_ctx *candidate_context = NULL;
+/* Corpus results of the candidate, stored as the baseline if it is promoted */
+static struct tf_corpus_report candidate_corpus;
+static bool candidate_corpus_valid = false;
+
+/* Kept over the reboot that loads a promoted candidate: how long inference had been stopped
+ * before the restart. Valid when the magic is set. */
+#define MODEL_SWITCH_MAGIC 0x4d535754
+static RTC_NOINIT_ATTR uint32_t model_switch_magic;
+static RTC_NOINIT_ATTR uint32_t model_switch_stopped_ms;
+/* This boot loads a just promoted candidate */
+static bool model_switched = false;
 
 static SemaphoreHandle_t _connected_sem = NULL;
 
+#define NETWORK_TASK_STACK_SIZE 4096
+#define NETWORK_TASK_PRIORITY 5
+#define METRICS_PUBLISH_PERIOD_MS 60000
+#define RUNTIME_METRICS_PERIOD_MS 10000
+
 static void on_client_event(struct golioth_client *client,
                             enum golioth_client_event event,
                             void *arg)
@@ -98,28 +131,12 @@ static void on_manifest(struct golioth_client *client,
         else
         {
             GLTH_LOGI(TAG, "Queueing for download: %s", man.components[i].package);
-
-            struct golioth_ota_component *stored_component =
-                (struct golioth_ota_component *) malloc(sizeof(struct golioth_ota_component));
-
-            if (!stored_component)
-            {
-                GLTH_LOGE(TAG, "Unable to allocate memory to store component");
-                continue;
-            }
-
-            memcpy(stored_component, &man.components[i], sizeof(struct golioth_ota_component));
-
-            err = xQueueSendToBackFromISR(xQueue, &stored_component, NULL);
-            if (err != pdPASS)
-            {
-                GLTH_LOGE(TAG, "Failed to enqueue component: %d", err);
-            }
+            download_service_enqueue(&man.components[i]);
         }
     }
 }
 
-static char *format_model_path(char *path, size_t len)
+static char *format_model_path(const char *path, size_t len)
 {
     char *model_path = (char *) calloc(len + 1, sizeof(char));
     if (!model_path)
@@ -133,37 +150,6 @@ static char *format_model_path(char *path, size_t len)
     return model_path;
 }
 
-static enum golioth_status write_artifact_block(const struct golioth_ota_component *component,
-                                                uint32_t block_idx,
-                                                uint8_t *block_buffer,
-                                                size_t block_size,
-                                                bool is_last,
-                                                void *arg)
-{
-
-    if (!arg)
-    {
-        GLTH_LOGE(TAG, "arg is NULL but should be a file stream");
-        return GOLIOTH_ERR_INVALID_FORMAT;
-    }
-    FILE *f = (FILE *) arg;
-
-    fwrite(block_buffer, block_size, 1, f);
-
-    if (is_last)
-    {
-        GLTH_LOGI(TAG, "Block download complete!");
-    }
-
-    return GOLIOTH_OK;
-}
-
-static void init_package_queue(void)
-{
-    xQueue = xQueueCreateStatic(QUEUE_LENGTH, QUEUE_ITEM_SIZE, ucQueueStorageArea, &xStaticQueue);
-    assert(xQueue);
-}
-
 static char *sdcard_get_selected_model_path(void)
 {
     /* Check if file exists */
@@ -244,95 +230,293 @@ static esp_err_t sdcard_store_selected_model_path(char *path)
     return err;
 }
 
-static void download_packages_in_queue(struct golioth_client *client)
+static bool sdcard_model_is_bad(const char *path)
 {
-    char *new_path = NULL;
-
-    while (uxQueueMessagesWaiting(xQueue))
+    FILE *f = fopen(BAD_MODELS_PATH, "r");
+    if (!f)
     {
-        struct golioth_ota_component *component = NULL;
-        FILE *f = NULL;
+        return false;
+    }
 
-        if (xQueueReceive(xQueue, &component, 0) == pdFALSE || !component)
+    bool found = false;
+    char line[128];
+    while (fgets(line, sizeof(line), f))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (strcmp(line, path) == 0)
         {
-            GLTH_LOGE(TAG, "Failed to receive from queue");
-            continue;
+            found = true;
+            break;
         }
+    }
 
-        /* Store components with name_version format: "componentname_1.2.3" */
-        size_t path_len = sizeof(SD_MOUNT_POINT) + strlen("_") + strlen(component->package)
-            + strlen("_xxx.xxx.xxx") + strlen("\0");
+    fclose(f);
+    return found;
+}
+
+static esp_err_t sdcard_mark_model_bad(const char *path)
+{
+    FILE *f = fopen(BAD_MODELS_PATH, "a");
+    if (!f)
+    {
+        ESP_LOGE(TAG, "Unable to open %s", BAD_MODELS_PATH);
+        return ESP_FAIL;
+    }
+
+    fprintf(f, "%s\n", path);
+
+    esp_err_t err = ferror(f);
+    if (err)
+    {
+        ESP_LOGE(TAG, "Error writing %s: %d", BAD_MODELS_PATH, err);
+    }
+
+    fclose(f);
+    return err;
+}
+
+static bool should_download_component(const struct golioth_ota_component *component,
+                                      const char *path)
+{
+    if (sdcard_model_is_bad(path))
+    {
+        GLTH_LOGW(TAG, "Skipping model that failed evaluation: %s", path);
+        return false;
+    }
+
+    return true;
+}
+
+/* Runs on the download task: hand the verified model over to the inference loop */
+static void on_model_ready(const struct golioth_ota_component *component, const char *path)
+{
+    char *model_path = format_model_path(path, strlen(path));
+    if (!model_path)
+    {
+        return;
+    }
+
+    if (xQueueSendToBack(ready_queue, &model_path, portMAX_DELAY) != pdPASS)
+    {
+        GLTH_LOGE(TAG, "Failed to hand over model: %s", model_path);
+        free(model_path);
+    }
+}
 
-        char path[path_len];
-        snprintf(path,
-                 sizeof(path),
-                 "%s/%s_%s",
-                 SD_MOUNT_POINT,
-                 component->package,
-                 component->version);
+static void handle_ready_models(void)
+{
+    char *new_path = NULL;
 
+    while (xQueueReceive(ready_queue, &new_path, 0) == pdTRUE)
+    {
         /* Server has told us this is the most recent release, use it as the selected model */
-        if (strncmp(component->package, MODEL_PACKAGE_NAME, strlen(MODEL_PACKAGE_NAME)) == 0)
+        if ((selected_model_path && strcmp(selected_model_path, new_path) == 0)
+            || (candidate_model_path && strcmp(candidate_model_path, new_path) == 0))
         {
+            ESP_LOGI(TAG, "Received model matches stored model");
             free(new_path);
-            new_path = format_model_path(path, strlen(path));
+            continue;
         }
 
-        /* Check if file exists */
-        struct stat st;
-        if (stat(path, &st) == 0)
-        {
-            GLTH_LOGI(TAG, "Package already exists on SD card: %s", path);
-            goto package_cleanup;
-        }
-        else
+        if (model_context)
         {
-            GLTH_LOGI(TAG, "Opening file for writing: %s", path);
-            f = fopen(path, "a");
-            if (!f)
-            {
-                GLTH_LOGE(TAG, "Error opening file");
-                goto package_cleanup;
-            }
+            /* A model is running: evaluate the new one next to it before selecting it */
+            free(candidate_model_path);
+            candidate_model_path = new_path;
+            new_candidate_available = true;
+            continue;
         }
 
-        golioth_ota_download_component(client, component, write_artifact_block, (void *) f);
+        free(selected_model_path);
+        selected_model_path = new_path;
+        sdcard_store_selected_model_path(selected_model_path);
+        new_model_available = true;
+    }
+}
+
+static void reject_model_candidate(void)
+{
+    GLTH_LOGW(TAG, "Rejecting candidate model: %s", candidate_model_path);
+    sdcard_mark_model_bad(candidate_model_path);
+    free(candidate_model_path);
+    candidate_model_path = NULL;
+}
+
+/* Gives up on the candidate for this boot only; it is evaluated again after the next reboot */
+static void defer_model_candidate(void)
+{
+    GLTH_LOGW(TAG, "Not enough memory to evaluate candidate model: %s", candidate_model_path);
+    free(candidate_model_path);
+    candidate_model_path = NULL;
+}
+
+/* Selects the candidate and reboots into it.
+ * The candidate's interpreter must already be stopped. */
+static void promote_model_candidate(void)
+{
+    /* The active model runs in this task, so it stops here */
+    int64_t stopped_us = esp_timer_get_time();
+
+    if (candidate_corpus_valid)
+    {
+        model_regression_store_baseline(&candidate_corpus);
+    }
+
+    if (!candidate_context->verified)
+    {
+        model_store_meta(candidate_context, candidate_model_path);
+    }
+    model_free(candidate_context);
+    candidate_context = NULL;
+
+    free(selected_model_path);
+    selected_model_path = candidate_model_path;
+    candidate_model_path = NULL;
+    sdcard_store_selected_model_path(selected_model_path);
+
+    /* The easiest way to load a new model is to reboot the processor */
+    ESP_LOGW(TAG, "Rebooting to load new TensorFlow model.");
+    model_switch_stopped_ms = (esp_timer_get_time() - stopped_us) / 1000;
+    model_switch_magic = MODEL_SWITCH_MAGIC;
+    esp_restart();
+}
+
+/* Holds the candidate to the regression corpus baseline */
+static enum model_regression_gate gate_model_candidate(void)
+{
+    candidate_corpus_valid = false;
+#if CONFIG_MODEL_REGRESSION_GATE
+    enum model_regression_gate gate = model_regression_gate(candidate_context, &candidate_corpus);
+    candidate_corpus_valid = (gate == MODEL_REGRESSION_GATE_PASS);
+    return gate;
+#else
+    return MODEL_REGRESSION_GATE_NOT_RUN;
+#endif
+}
+
+/* Plays the corpus through the running model once per firmware build: records the baseline if
+ * there is none yet, otherwise reports when a firmware change moved the results away from it */
+static void check_regression_baseline(void)
+{
+#if CONFIG_MODEL_REGRESSION_GATE
+    esp_err_t err = model_regression_check_firmware(model_context);
+    if (err == ESP_ERR_INVALID_STATE)
+    {
+        GLTH_LOGE(TAG, "This firmware regressed the running model on the corpus");
+    }
+    else if (err && (err != ESP_ERR_NOT_FOUND))
+    {
+        ESP_LOGW(TAG, "Unable to check the firmware against the regression corpus");
+    }
+    app_metrics_set("firmware_regressed", err == ESP_ERR_INVALID_STATE);
+#endif
+}
 
-    package_cleanup:
-        fclose(f);
-        free(component);
+static void start_model_candidate(void)
+{
+    if (candidate_context)
+    {
+        /* A newer release replaces the candidate under evaluation */
+        tf_micro_speech_stop_shadow();
+        model_free(candidate_context);
+        candidate_context = NULL;
     }
 
-    if (new_path)
+    candidate_context = model_init_from_file(candidate_model_path);
+    if (!candidate_context)
     {
-        if (selected_model_path)
+        reject_model_candidate();
+        return;
+    }
+
+    enum model_regression_gate gate = gate_model_candidate();
+    if ((gate == MODEL_REGRESSION_GATE_DEFER) || (gate == MODEL_REGRESSION_GATE_REJECT))
+    {
+        model_free(candidate_context);
+        candidate_context = NULL;
+        if (gate == MODEL_REGRESSION_GATE_DEFER)
         {
-            if (strcmp(selected_model_path, new_path) == 0)
-            {
-                ESP_LOGI(TAG, "Received model matches stored model");
-                return;
-            }
+            /* Like a full arena at the start of the shadow, this says nothing about the model */
+            defer_model_candidate();
         }
+        else
+        {
+            GLTH_LOGW(TAG, "Candidate regressed on the corpus");
+            reject_model_candidate();
+        }
+        return;
+    }
 
-        free(selected_model_path);
-        selected_model_path = new_path;
-        sdcard_store_selected_model_path(selected_model_path);
-        new_model_available = true;
+    const struct tf_shadow_config config = {
+        .duty_cycle = CONFIG_MODEL_SHADOW_DUTY_CYCLE,
+        .min_compared = CONFIG_MODEL_SHADOW_MIN_DETECTIONS,
+        .max_latency_pct = CONFIG_MODEL_SHADOW_MAX_LATENCY_PCT,
+        .min_agreement_pct = CONFIG_MODEL_SHADOW_MIN_AGREEMENT_PCT,
+        .max_duration_s = CONFIG_MODEL_SHADOW_MAX_MINUTES * 60,
+    };
+
+    enum tf_shadow_start start = tf_micro_speech_start_shadow(candidate_context, &config);
+    if (start != TF_SHADOW_START_OK)
+    {
+        model_free(candidate_context);
+        candidate_context = NULL;
+    }
+    switch (start)
+    {
+        case TF_SHADOW_START_OK:
+            GLTH_LOGI(TAG, "Evaluating candidate model: %s", candidate_model_path);
+            break;
+        case TF_SHADOW_START_NO_MEMORY:
+            /* A full arena says nothing about the model, so it isn't marked bad */
+            defer_model_candidate();
+            break;
+        case TF_SHADOW_START_STRIDE_MISMATCH:
+            /* It can't be compared on the running spectrogram, so it is never evaluated */
+            GLTH_LOGW(TAG, "Candidate uses a different feature stride and can't be evaluated");
+            reject_model_candidate();
+            break;
+        case TF_SHADOW_START_ERROR:
+            ESP_LOGE(TAG, "Unable to run candidate model");
+            reject_model_candidate();
+            break;
     }
 }
 
-void app_main(void)
+static void check_model_candidate(void)
 {
-    GLTH_LOGI(TAG, "Start Golioth TensorFlow model update example");
+    struct tf_shadow_report report;
+    enum tf_shadow_verdict verdict = tf_micro_speech_shadow_verdict(&report);
+    if ((verdict != TF_SHADOW_PROMOTE) && (verdict != TF_SHADOW_REJECT))
+    {
+        return;
+    }
 
-    init_package_queue();
-    bsp_sdcard_mount();
+    GLTH_LOGI(TAG,
+              "Candidate agreed on %" PRIu32 "/%" PRIu32 " detections, %" PRId32
+              " us vs %" PRId32 " us per invoke, arena %zu bytes",
+              report.agreed,
+              report.compared,
+              report.candidate_avg_us,
+              report.active_avg_us,
+              report.arena_used);
 
-    /* Golioth connection */
-    /* Get credentials from NVS and enable shell */
-    nvs_init();
-    shell_start();
+    tf_micro_speech_stop_shadow();
+
+    if (verdict == TF_SHADOW_REJECT)
+    {
+        model_free(candidate_context);
+        candidate_context = NULL;
+        reject_model_candidate();
+        return;
+    }
 
+    promote_model_candidate();
+}
+
+/* Brings up WiFi and Golioth in the background so that keyword spotting does not wait for the
+ * network. Once connected, it periodically publishes the application metrics. */
+static void network_task(void *arg)
+{
     if (!nvs_credentials_are_set())
     {
         GLTH_LOGW(TAG,
@@ -349,23 +533,9 @@ void app_main(void)
     wifi_init(nvs_read_wifi_ssid(), nvs_read_wifi_password());
     wifi_wait_for_connected();
 
-    /* Load stored model path before connecting to Golioth */
-    struct tf_model_ctx *model_context = NULL;
-    selected_model_path = sdcard_get_selected_model_path();
-
-    if (!selected_model_path)
-    {
-        ESP_LOGI(TAG, "Awaiting version information from server before loading a TensorFlow model");
-    }
-    else
-    {
-        new_model_available = true;
-    }
-
     /* Connect to Golioth */
     const struct golioth_client_config *config = golioth_sample_credentials_get();
     struct golioth_client *client = golioth_client_create(config);
-    _connected_sem = xSemaphoreCreateBinary();
     golioth_client_register_event_callback(client, on_client_event, NULL);
 
     /* Listen for OTA manifest */
@@ -377,38 +547,236 @@ void app_main(void)
 
     GLTH_LOGW(TAG, "Waiting for connection to Golioth...");
     xSemaphoreTake(_connected_sem, portMAX_DELAY);
+    download_service_start(client);
+    detection_upload_start(client);
+
+    while (true)
+    {
+        app_metrics_publish(client);
+        vTaskDelay(METRICS_PUBLISH_PERIOD_MS / portTICK_PERIOD_MS);
+    }
+}
+
+static void handle_results(void)
+{
+    struct tf_result result;
+    while (tf_micro_speech_pop_result(&result))
+    {
+        /* Looked up now: models are only freed by this task */
+        const char *label = tf_micro_speech_label(result.model, result.top[0].label);
+
+        /* Not a GLTH_LOG: detections reach the cloud in batches, not as one log message each */
+        ESP_LOGI(TAG,
+                 "Detected %7s, score: %.2f (model %d, %" PRId32 " ms)",
+                 label,
+                 result.top[0].score,
+                 result.model,
+                 result.timestamp_ms);
+        app_metrics_add("detections", 1);
+        detection_upload_add(&result, label);
+    }
+
+    detection_upload_poll();
+}
+
+static void sample_runtime_metrics(void)
+{
+    static TickType_t last_sample;
+
+    TickType_t now = xTaskGetTickCount();
+    if (now - last_sample < pdMS_TO_TICKS(RUNTIME_METRICS_PERIOD_MS))
+    {
+        return;
+    }
+
+    last_sample = now;
+    app_metrics_sample_cpu_idle();
+    app_metrics_set("logs_dropped", deferred_log_dropped());
+    app_metrics_set("logs_suppressed", deferred_log_suppressed());
+
+    struct tf_cadence_report cadence;
+    tf_micro_speech_get_cadence(&cadence);
+    app_metrics_set("inference_cadence", cadence.strides);
+    app_metrics_set("inference_cadence_increases", cadence.increases);
+    app_metrics_set("inference_cadence_decreases", cadence.decreases);
+    app_metrics_set("inference_load_pct", cadence.load_pct);
+    app_metrics_set("capture_backlog_ms", cadence.backlog_ms);
+
+    struct tf_cascade_report cascade;
+    tf_micro_speech_get_cascade(&cascade);
+    if (cascade.running)
+    {
+        app_metrics_set("cascade_gate_openings", cascade.openings);
+        app_metrics_set("cascade_avoided_pct", cascade.avoided_pct);
+    }
+}
+
+#if CONFIG_MODEL_CASCADE
+/* Loads the first stage of the cascade once a keyword model is running. Without it the keyword
+ * model scores every window. */
+static void load_cascade_gate(void)
+{
+    static char gate_path[] = CONFIG_MODEL_CASCADE_GATE_PATH;
+    static bool attempted = false;
+    if (attempted)
+    {
+        return;
+    }
+    attempted = true;
+
+    struct tf_model_ctx *gate_context = model_init_from_file(gate_path);
+    if (!gate_context)
+    {
+        GLTH_LOGW(TAG, "No cascade gate model, scoring every window");
+        return;
+    }
+    if (tf_micro_speech_set_gate(gate_context, CONFIG_MODEL_CASCADE_HOLD_MS) != 0)
+    {
+        GLTH_LOGE(TAG, "Unable to use %s as the cascade gate", gate_path);
+        model_free(gate_context);
+        return;
+    }
+    if (!gate_context->verified)
+    {
+        model_store_meta(gate_context, gate_path);
+    }
+}
+#endif
+
+static void record_boot_metrics(void)
+{
+    static bool recorded = false;
+    if (recorded)
+    {
+        return;
+    }
+
+    int64_t first_inference_us = tf_micro_speech_first_inference_us();
+    if (first_inference_us < 0)
+    {
+        return;
+    }
+
+    recorded = true;
+    GLTH_LOGI(TAG, "Boot to first inference: %" PRId64 " ms", first_inference_us / 1000);
+    app_metrics_set("boot_to_first_inference_ms", first_inference_us / 1000);
+
+    /* After a promotion: from the old model's last inference to the new model's first, less
+     * the bootloader time before the timer starts */
+    if (model_switched)
+    {
+        int64_t downtime_ms = model_switch_stopped_ms + first_inference_us / 1000;
+        GLTH_LOGI(TAG, "Model switch downtime: %" PRId64 " ms", downtime_ms);
+        app_metrics_set("model_switch_downtime_ms", downtime_ms);
+    }
+}
+
+void app_main(void)
+{
+    GLTH_LOGI(TAG, "Start Golioth TensorFlow model update example");
+
+    model_switched = (model_switch_magic == MODEL_SWITCH_MAGIC)
+                     && (esp_reset_reason() == ESP_RST_SW);
+    model_switch_magic = 0;
+
+    ready_queue = xQueueCreateStatic(READY_QUEUE_LENGTH,
+                                     READY_QUEUE_ITEM_SIZE,
+                                     ready_queue_storage,
+                                     &ready_queue_buffer);
+    assert(ready_queue);
+    app_metrics_init();
+    bsp_sdcard_mount();
+    /* After mounting: reads the components stored on a previous boot */
+    download_service_init(SD_MOUNT_POINT, should_download_component, on_model_ready);
+
+#if CONFIG_RINGBUF_BENCHMARK
+    /* Before capture starts, so the ring is measured without other load */
+    rb_benchmark_run();
+#endif
+
+    /* Start filling the capture ring while the model loads */
+    if (tf_micro_speech_start_audio() != 0)
+    {
+        ESP_LOGE(TAG, "Unable to start audio capture");
+    }
+
+    /* Load the cached model before the network is up */
+    selected_model_path = sdcard_get_selected_model_path();
+
+    if (!selected_model_path)
+    {
+        ESP_LOGI(TAG, "Awaiting version information from server before loading a TensorFlow model");
+    }
+    else
+    {
+        new_model_available = true;
+    }
+
+    /* Golioth connection */
+    /* Get credentials from NVS and enable shell */
+    nvs_init();
+    shell_start();
+
+    _connected_sem = xSemaphoreCreateBinary();
+    xTaskCreate(network_task,
+                "network",
+                NETWORK_TASK_STACK_SIZE,
+                NULL,
+                NETWORK_TASK_PRIORITY,
+                NULL);
 
     while (true)
     {
-        download_packages_in_queue(client);
+        handle_ready_models();
 
         if (new_model_available)
         {
-            if (model_context)
-            {
-                /* TensorFlow was previously initialized. The easiest way to load a new model is to
-                 * reboot the processor */
-                ESP_LOGW(TAG, "Rebooting to load new TensorFlow model.");
-                esp_restart();
-            }
-            else
+            new_model_available = false;
+            model_context = model_init_from_file(selected_model_path);
+            if (model_context != NULL)
             {
-                new_model_available = false;
-                model_context = model_init_from_file(selected_model_path);
-                if (model_context != NULL)
-                {
-                    ESP_LOGI(TAG, "Model loaded from SD card.");
+                ESP_LOGI(TAG, "Model loaded from SD card.");
 
-                    /* Initialize TensorFlow */
-                    tf_micro_speech_init(model_context);
+                /* Initialize TensorFlow */
+                if (tf_micro_speech_add_model(model_context) == 0)
+                {
+                    if (!model_context->verified)
+                    {
+                        /* Later boots skip the checks that just passed */
+                        model_store_meta(model_context, selected_model_path);
+                    }
+                    check_regression_baseline();
+#if CONFIG_MODEL_CASCADE
+                    load_cascade_gate();
+#endif
                 }
             }
         }
 
+        if (new_candidate_available)
+        {
+            new_candidate_available = false;
+            start_model_candidate();
+        }
+
+        if (candidate_context)
+        {
+            check_model_candidate();
+        }
+
         /* Run TensorFlow micro_speech recognition */
         if (model_context)
         {
-            tf_micro_speech_run_inference(model_context);
+            tf_micro_speech_run_inference();
+            handle_results();
+            record_boot_metrics();
         }
+        else
+        {
+            /* Nothing to run until a model is downloaded */
+            vTaskDelay(100 / portTICK_PERIOD_MS);
+        }
+
+        sample_runtime_metrics();
     }
 }
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+static const char *TAG = "app_metrics";
+
+#include "app_metrics.h"
+
+#include <golioth/client.h>
+#include <golioth/stream.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#define METRICS_JSON_MAX_LEN 1024
+
+struct app_metric {
+    const char *name;
+    int64_t value;
+};
+
+static struct app_metric metrics[APP_METRICS_MAX_ENTRIES];
+static size_t metric_count;
+static SemaphoreHandle_t metrics_lock;
+static StaticSemaphore_t metrics_lock_buffer;
+
+void app_metrics_init(void)
+{
+    metrics_lock = xSemaphoreCreateMutexStatic(&metrics_lock_buffer);
+    assert(metrics_lock);
+}
+
+/* Must be called with metrics_lock held */
+static struct app_metric *find_or_add(const char *name)
+{
+    for (size_t i = 0; i < metric_count; i++)
+    {
+        if (strcmp(metrics[i].name, name) == 0)
+        {
+            return &metrics[i];
+        }
+    }
+
+    if (metric_count == APP_METRICS_MAX_ENTRIES)
+    {
+        return NULL;
+    }
+
+    struct app_metric *metric = &metrics[metric_count++];
+    metric->name = name;
+    metric->value = 0;
+    return metric;
+}
+
+void app_metrics_set(const char *name, int64_t value)
+{
+    xSemaphoreTake(metrics_lock, portMAX_DELAY);
+    struct app_metric *metric = find_or_add(name);
+    if (metric)
+    {
+        metric->value = value;
+    }
+    xSemaphoreGive(metrics_lock);
+
+    if (!metric)
+    {
+        GLTH_LOGW(TAG, "No room for metric %s", name);
+    }
+}
+
+void app_metrics_add(const char *name, int64_t delta)
+{
+    xSemaphoreTake(metrics_lock, portMAX_DELAY);
+    struct app_metric *metric = find_or_add(name);
+    if (metric)
+    {
+        metric->value += delta;
+    }
+    xSemaphoreGive(metrics_lock);
+
+    if (!metric)
+    {
+        GLTH_LOGW(TAG, "No room for metric %s", name);
+    }
+}
+
+void app_metrics_sample_cpu_idle(void)
+{
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    /* Run time counters are in microseconds when clocked from esp_timer */
+    static const char *names[] = {"cpu0_idle_pct", "cpu1_idle_pct"};
+    static uint32_t last_idle[portNUM_PROCESSORS];
+    static int64_t last_us;
+
+    int64_t now_us = esp_timer_get_time();
+    int64_t elapsed_us = now_us - last_us;
+    last_us = now_us;
+
+    for (int core = 0; core < portNUM_PROCESSORS && core < 2; core++)
+    {
+        uint32_t idle = ulTaskGetRunTimeCounter(xTaskGetIdleTaskHandleForCore(core));
+        uint32_t idle_us = idle - last_idle[core];
+        last_idle[core] = idle;
+
+        if (elapsed_us > 0)
+        {
+            app_metrics_set(names[core], (int64_t) idle_us * 100 / elapsed_us);
+        }
+    }
+#endif
+}
+
+void app_metrics_publish(struct golioth_client *client)
+{
+    /* Off the stack of the network task, the only caller */
+    static char json[METRICS_JSON_MAX_LEN];
+    size_t len = 0;
+
+    json[len++] = '{';
+
+    xSemaphoreTake(metrics_lock, portMAX_DELAY);
+    for (size_t i = 0; i < metric_count; i++)
+    {
+        int written = snprintf(json + len,
+                               sizeof(json) - len,
+                               "%s\"%s\":%" PRId64,
+                               (i == 0) ? "" : ",",
+                               metrics[i].name,
+                               metrics[i].value);
+        if ((written < 0) || ((size_t) written >= sizeof(json) - len - 1))
+        {
+            GLTH_LOGW(TAG, "Metrics truncated after %zu entries", i);
+            break;
+        }
+        len += written;
+    }
+    xSemaphoreGive(metrics_lock);
+
+    if (len == 1)
+    {
+        return;
+    }
+
+    json[len++] = '}';
+
+    enum golioth_status status = golioth_stream_set_async(client,
+                                                          APP_METRICS_STREAM_PATH,
+                                                          GOLIOTH_CONTENT_TYPE_JSON,
+                                                          (const uint8_t *) json,
+                                                          len,
+                                                          NULL,
+                                                          NULL);
+    if (status != GOLIOTH_OK)
+    {
+        GLTH_LOGE(TAG, "Failed to publish metrics: %d", status);
+    }
+}
@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+struct golioth_client;
+
+#define APP_METRICS_MAX_ENTRIES 24
+#define APP_METRICS_STREAM_PATH "metrics"
+
+void app_metrics_init(void);
+
+/* Sets the latest value of a named metric. The name must be a string literal or otherwise outlive
+ * the application; it is not copied. */
+void app_metrics_set(const char *name, int64_t value);
+
+/* Adds to the value of a named metric (counters) */
+void app_metrics_add(const char *name, int64_t delta);
+
+/* Records the idle percentage of each CPU since the previous call as "cpuN_idle_pct". Requires
+ * CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS; does nothing otherwise. */
+void app_metrics_sample_cpu_idle(void);
+
+/* Sends all metrics as one JSON object to the Golioth stream service */
+void app_metrics_publish(struct golioth_client *client);
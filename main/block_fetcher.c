@@ -0,0 +1,285 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+static const char *TAG = "block_fetcher";
+
+#include "block_fetcher.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+/* Requests of a block after the first one fails, before the download fails */
+#define MAX_BLOCK_RETRIES 3
+/* Longest wait for any response; the client times out each request well before this */
+#ifndef RESPONSE_TIMEOUT_MS
+#define RESPONSE_TIMEOUT_MS 60000
+#endif
+/* Wait before requesting again when the client's request queue was full */
+#define REQUEST_RETRY_DELAY_MS 100
+
+enum slot_state {
+    SLOT_FREE,
+    SLOT_REQUESTED,
+    SLOT_READY,
+    SLOT_FAILED,
+};
+
+/* One entry of the reorder buffer. Block n always uses slot n % window. */
+struct fetch_slot {
+    enum slot_state state;
+    uint32_t block_idx;
+    /* Download the request was made for */
+    uint32_t generation;
+    size_t len;
+    bool is_last;
+    int retries;
+    enum golioth_status status;
+    uint8_t data[GOLIOTH_OTA_BLOCKSIZE];
+};
+
+static struct {
+    const struct golioth_ota_component *component;
+    struct fetch_slot *slots;
+    /* Counts downloads, so a late response to an abandoned one is ignored */
+    uint32_t generation;
+    int window;
+    uint32_t next_write;
+    int in_flight;
+    uint32_t out_of_order;
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lock_buffer;
+    /* Given by the response callback, taken by the downloading task */
+    SemaphoreHandle_t response;
+    StaticSemaphore_t response_buffer;
+} fetcher;
+
+/* Runs on the Golioth client task */
+static void on_block(struct golioth_client *client,
+                     const struct golioth_response *response,
+                     const char *path,
+                     const uint8_t *payload,
+                     size_t payload_size,
+                     bool is_last,
+                     void *arg)
+{
+    struct fetch_slot *slot = (struct fetch_slot *) arg;
+
+    /* After a timeout the slots are leaked, not freed, so slot can still be read */
+    xSemaphoreTake(fetcher.lock, portMAX_DELAY);
+    bool current = (slot->generation == fetcher.generation);
+    if (current && (slot->state == SLOT_REQUESTED))
+    {
+        if ((response->status == GOLIOTH_OK) && (payload_size <= sizeof(slot->data)))
+        {
+            memcpy(slot->data, payload, payload_size);
+            slot->len = payload_size;
+            slot->is_last = is_last;
+            slot->state = SLOT_READY;
+            if (slot->block_idx != fetcher.next_write)
+            {
+                fetcher.out_of_order++;
+            }
+        }
+        else
+        {
+            slot->status = (response->status != GOLIOTH_OK) ? response->status
+                                                             : GOLIOTH_ERR_INVALID_FORMAT;
+            slot->state = SLOT_FAILED;
+        }
+        fetcher.in_flight--;
+    }
+    xSemaphoreGive(fetcher.lock);
+
+    if (current)
+    {
+        xSemaphoreGive(fetcher.response);
+    }
+}
+
+static enum golioth_status request_block(struct golioth_client *client,
+                                         struct fetch_slot *slot,
+                                         uint32_t block_idx)
+{
+    enum slot_state previous = slot->state;
+
+    /* Marked first: the response may arrive before the call returns */
+    xSemaphoreTake(fetcher.lock, portMAX_DELAY);
+    slot->state = SLOT_REQUESTED;
+    slot->block_idx = block_idx;
+    slot->generation = fetcher.generation;
+    fetcher.in_flight++;
+    xSemaphoreGive(fetcher.lock);
+
+    enum golioth_status status = golioth_ota_get_block_async(client,
+                                                             fetcher.component->package,
+                                                             fetcher.component->version,
+                                                             block_idx,
+                                                             on_block,
+                                                             slot);
+    if (status != GOLIOTH_OK)
+    {
+        /* Typically a full request queue; tried again after the next response */
+        xSemaphoreTake(fetcher.lock, portMAX_DELAY);
+        slot->state = previous;
+        fetcher.in_flight--;
+        xSemaphoreGive(fetcher.lock);
+    }
+    return status;
+}
+
+/* Keeps window requests in flight and requests failed blocks again. Returns an error once a block
+ * has failed too often. */
+static enum golioth_status fill_window(struct golioth_client *client,
+                                       uint32_t *next_request,
+                                       uint32_t nblocks,
+                                       uint32_t *retries)
+{
+    for (int i = 0; i < fetcher.window; i++)
+    {
+        struct fetch_slot *slot = &fetcher.slots[i];
+        if (slot->state != SLOT_FAILED)
+        {
+            continue;
+        }
+        if (slot->retries == MAX_BLOCK_RETRIES)
+        {
+            GLTH_LOGE(TAG, "Block %" PRIu32 " failed: %d", slot->block_idx, slot->status);
+            return slot->status;
+        }
+        /* A request the client refused never reached the server and isn't a retry */
+        if (request_block(client, slot, slot->block_idx) == GOLIOTH_OK)
+        {
+            slot->retries++;
+            (*retries)++;
+        }
+    }
+
+    while ((*next_request < nblocks) && (*next_request < fetcher.next_write + fetcher.window))
+    {
+        struct fetch_slot *slot = &fetcher.slots[*next_request % fetcher.window];
+        slot->retries = 0;
+        if (request_block(client, slot, *next_request) != GOLIOTH_OK)
+        {
+            break;
+        }
+        (*next_request)++;
+    }
+    return GOLIOTH_OK;
+}
+
+enum golioth_status block_fetcher_download(struct golioth_client *client,
+                                           const struct golioth_ota_component *component,
+                                           int window,
+                                           ota_component_block_write_cb cb,
+                                           void *arg)
+{
+    if (!fetcher.lock)
+    {
+        fetcher.lock = xSemaphoreCreateMutexStatic(&fetcher.lock_buffer);
+        fetcher.response = xSemaphoreCreateBinaryStatic(&fetcher.response_buffer);
+    }
+
+    if (window < 1)
+    {
+        window = 1;
+    }
+    else if (window > BLOCK_FETCHER_MAX_WINDOW)
+    {
+        window = BLOCK_FETCHER_MAX_WINDOW;
+    }
+
+    /* Blocks are copied out of the client's buffer, which is only valid during the callback */
+    fetcher.slots = heap_caps_calloc(window,
+                                     sizeof(struct fetch_slot),
+                                     MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!fetcher.slots)
+    {
+        GLTH_LOGE(TAG, "Unable to allocate the reorder buffer");
+        return GOLIOTH_ERR_MEM_ALLOC;
+    }
+    xSemaphoreTake(fetcher.lock, portMAX_DELAY);
+    fetcher.generation++;
+    fetcher.component = component;
+    fetcher.window = window;
+    fetcher.next_write = 0;
+    fetcher.in_flight = 0;
+    fetcher.out_of_order = 0;
+    xSemaphoreGive(fetcher.lock);
+    xSemaphoreTake(fetcher.response, 0);
+
+    uint32_t nblocks = golioth_ota_size_to_nblocks(component->size);
+    uint32_t next_request = 0;
+    uint32_t retries = 0;
+    enum golioth_status status = GOLIOTH_OK;
+    while ((fetcher.next_write < nblocks) && (status == GOLIOTH_OK))
+    {
+        status = fill_window(client, &next_request, nblocks, &retries);
+        if (status != GOLIOTH_OK)
+        {
+            break;
+        }
+
+        /* Pass on every block that is next in order before waiting again */
+        struct fetch_slot *slot = &fetcher.slots[fetcher.next_write % window];
+        if ((slot->state == SLOT_READY) && (slot->block_idx == fetcher.next_write))
+        {
+            status = cb(component, slot->block_idx, slot->data, slot->len, slot->is_last, arg);
+            slot->state = SLOT_FREE;
+            fetcher.next_write++;
+            if (slot->is_last)
+            {
+                break;
+            }
+            continue;
+        }
+
+        if (fetcher.in_flight == 0)
+        {
+            /* Nothing was accepted by the client; no response will wake us up */
+            vTaskDelay(pdMS_TO_TICKS(REQUEST_RETRY_DELAY_MS));
+        }
+        else if (xSemaphoreTake(fetcher.response, pdMS_TO_TICKS(RESPONSE_TIMEOUT_MS)) != pdTRUE)
+        {
+            GLTH_LOGE(TAG, "No response for block %" PRIu32, fetcher.next_write);
+            status = GOLIOTH_ERR_TIMEOUT;
+        }
+    }
+
+    /* Requests still in flight write into the reorder buffer when they complete */
+    while (fetcher.in_flight > 0)
+    {
+        if (xSemaphoreTake(fetcher.response, pdMS_TO_TICKS(RESPONSE_TIMEOUT_MS)) != pdTRUE)
+        {
+            break;
+        }
+    }
+    if (fetcher.in_flight > 0)
+    {
+        GLTH_LOGE(TAG, "%d block requests never completed", fetcher.in_flight);
+        /* Leaked rather than freed under a late response */
+    }
+    else
+    {
+        heap_caps_free(fetcher.slots);
+    }
+    fetcher.slots = NULL;
+
+    GLTH_LOGI(TAG,
+              "%" PRIu32 " of %" PRIu32 " blocks, window %d, %" PRIu32 " out of order, %" PRIu32
+              " retried",
+              fetcher.next_write,
+              nblocks,
+              window,
+              fetcher.out_of_order,
+              retries);
+    return status;
+}
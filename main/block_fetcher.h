@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <golioth/client.h>
+#include <golioth/ota.h>
+
+/* Maximum number of block requests in flight, bounded by the Golioth client's request queue */
+#define BLOCK_FETCHER_MAX_WINDOW 8
+
+/* Downloads a component like golioth_ota_download_component(), but keeps up to window block
+ * requests in flight instead of one, so each block doesn't wait for the round trip of the previous
+ * one. Blocks may arrive in any order; they are held in a reorder buffer of window blocks and
+ * passed to cb in order, on the calling task. A failed block is requested again a few times before
+ * the download fails. Only one download may run at a time. */
+enum golioth_status block_fetcher_download(struct golioth_client *client,
+                                           const struct golioth_ota_component *component,
+                                           int window,
+                                           ota_component_block_write_cb cb,
+                                           void *arg);
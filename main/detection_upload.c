@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+static const char *TAG = "detection_upload";
+
+#include "detection_upload.h"
+
+#include <golioth/client.h>
+#include <golioth/stream.h>
+#include <string.h>
+#include <zcbor_encode.h>
+
+#include "app_metrics.h"
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "../tf_micro_speech/main_functions.h"
+
+/* Labels are truncated to keep every entry within DETECTION_ENTRY_MAX_LEN */
+#define DETECTION_LABEL_MAX_LEN 16
+/* [timestamp_ms, model, label, score_pct]: array header, int32, uint8, tstr, uint8, and the break
+ * byte that ends the array unless zcbor is built canonical */
+#define DETECTION_ENTRY_MAX_LEN (1 + 5 + 2 + (1 + DETECTION_LABEL_MAX_LEN) + 2 + 1)
+#define DETECTION_CBOR_MAX_LEN (3 + CONFIG_DETECTION_BATCH_SIZE * DETECTION_ENTRY_MAX_LEN + 1)
+
+struct detection {
+    int32_t timestamp_ms;
+    /* Copied: the batch may outlive the model that produced it */
+    char label[DETECTION_LABEL_MAX_LEN + 1];
+    uint8_t model;
+    uint8_t score_pct;
+};
+
+static struct detection batch[CONFIG_DETECTION_BATCH_SIZE];
+static size_t batch_count;
+static TickType_t batch_start;
+static uint8_t cbor_buf[DETECTION_CBOR_MAX_LEN];
+
+/* Written once by the network task */
+static struct golioth_client *volatile upload_client;
+
+void detection_upload_start(struct golioth_client *client)
+{
+    upload_client = client;
+}
+
+/* Encodes the batch as an array of [timestamp_ms, model, label, score_pct] arrays */
+static bool encode_batch(size_t *len)
+{
+    ZCBOR_STATE_E(zse, 2, cbor_buf, sizeof(cbor_buf), 1);
+
+    bool ok = zcbor_list_start_encode(zse, batch_count);
+    for (size_t i = 0; ok && (i < batch_count); i++)
+    {
+        const struct detection *d = &batch[i];
+        ok = zcbor_list_start_encode(zse, 4) && zcbor_int32_put(zse, d->timestamp_ms)
+            && zcbor_uint32_put(zse, d->model)
+            && zcbor_tstr_encode_ptr(zse, d->label, strlen(d->label))
+            && zcbor_uint32_put(zse, d->score_pct) && zcbor_list_end_encode(zse, 4);
+    }
+    ok = ok && zcbor_list_end_encode(zse, batch_count);
+
+    *len = zse->payload - cbor_buf;
+    return ok;
+}
+
+static void flush(const char *reason)
+{
+    struct golioth_client *client = upload_client;
+    if ((batch_count == 0) || !client || !golioth_client_is_connected(client))
+    {
+        return;
+    }
+
+    size_t len;
+    if (!encode_batch(&len))
+    {
+        GLTH_LOGE(TAG, "Unable to encode %zu detections", batch_count);
+        app_metrics_add("detections_dropped", batch_count);
+        batch_count = 0;
+        return;
+    }
+
+    /* The payload is copied into the request, the buffer can be reused right away */
+    enum golioth_status status = golioth_stream_set_async(client,
+                                                          DETECTION_STREAM_PATH,
+                                                          GOLIOTH_CONTENT_TYPE_CBOR,
+                                                          cbor_buf,
+                                                          len,
+                                                          NULL,
+                                                          NULL);
+    if (status != GOLIOTH_OK)
+    {
+        /* Keep the batch and try again on the next detection or poll */
+        GLTH_LOGW(TAG, "Failed to send detections: %d", status);
+        return;
+    }
+
+    ESP_LOGD(TAG, "Sent %zu detections in %zu bytes (%s)", batch_count, len, reason);
+    app_metrics_add("detection_batches", 1);
+    app_metrics_add("detection_bytes", len);
+    batch_count = 0;
+}
+
+void detection_upload_add(const struct tf_result *result, const char *label)
+{
+    if (batch_count == CONFIG_DETECTION_BATCH_SIZE)
+    {
+        /* Still full from a failed or offline send */
+        flush("full");
+        if (batch_count == CONFIG_DETECTION_BATCH_SIZE)
+        {
+            app_metrics_add("detections_dropped", 1);
+            return;
+        }
+    }
+
+    if (batch_count == 0)
+    {
+        batch_start = xTaskGetTickCount();
+    }
+
+    float score_pct = result->top[0].score * 100.0f + 0.5f;
+    struct detection *d = &batch[batch_count++];
+    *d = (struct detection) {
+        .timestamp_ms = result->timestamp_ms,
+        .model = (uint8_t) result->model,
+        .score_pct = (uint8_t) ((score_pct > 100.0f) ? 100 : (score_pct < 0.0f) ? 0 : score_pct),
+    };
+    strncpy(d->label, label, DETECTION_LABEL_MAX_LEN);
+
+    if (batch_count == CONFIG_DETECTION_BATCH_SIZE)
+    {
+        flush("full");
+    }
+    else if (batch[batch_count - 1].score_pct >= CONFIG_DETECTION_URGENT_SCORE_PCT)
+    {
+        flush("urgent");
+    }
+}
+
+void detection_upload_poll(void)
+{
+    if ((batch_count > 0)
+        && (xTaskGetTickCount() - batch_start >= pdMS_TO_TICKS(CONFIG_DETECTION_BATCH_MAX_AGE_MS)))
+    {
+        flush("age");
+    }
+}
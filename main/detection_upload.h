@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+struct golioth_client;
+struct tf_result;
+
+#define DETECTION_STREAM_PATH "detections"
+
+/* Sends batches through client from now on. Until then, and while the client is disconnected,
+ * detections are kept in the batch. */
+void detection_upload_start(struct golioth_client *client);
+
+/* Adds a detection, named label, to the current batch and sends the batch if it is full or the
+ * detection scores at least CONFIG_DETECTION_URGENT_SCORE_PCT. The label is copied, truncated to
+ * 16 characters. Must be called from the same task as detection_upload_poll(). */
+void detection_upload_add(const struct tf_result *result, const char *label);
+
+/* Sends the current batch once its oldest detection is CONFIG_DETECTION_BATCH_MAX_AGE_MS old */
+void detection_upload_poll(void);
@@ -0,0 +1,583 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+static const char *TAG = "download_service";
+
+#include "download_service.h"
+#include "app_metrics.h"
+#include "block_fetcher.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "unistd.h"
+
+#include "esp_idf_version.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "mbedtls/sha256.h"
+#include "model_inflate.h"
+
+/* Component Queue */
+#define QUEUE_LENGTH CONFIG_GOLIOTH_OTA_MAX_NUM_COMPONENTS
+#define QUEUE_ITEM_SIZE sizeof(struct golioth_ota_component *)
+static StaticQueue_t xStaticQueue;
+static uint8_t ucQueueStorageArea[QUEUE_LENGTH * QUEUE_ITEM_SIZE];
+static QueueHandle_t xQueue;
+
+/* Queued components are copied into this pool; the free queue holds the unused entries */
+static struct golioth_ota_component component_pool[QUEUE_LENGTH];
+static StaticQueue_t free_queue_buffer;
+static uint8_t free_queue_storage[QUEUE_LENGTH * QUEUE_ITEM_SIZE];
+static QueueHandle_t free_queue;
+
+#define DOWNLOAD_TASK_STACK_SIZE 6144
+#define PART_SUFFIX ".part"
+
+/* Release of each package last stored on the SD card, persisted across boots */
+#define STATE_FILE_NAME "ota_state.bin"
+#define STATE_VERSION 1
+#define MAX_APPLIED CONFIG_GOLIOTH_OTA_MAX_NUM_COMPONENTS
+
+/* "<mount point>/<package>_<version>.part" */
+#define MAX_MOUNT_POINT_LEN 16
+#define MAX_PATH_LEN                                                                      \
+    (MAX_MOUNT_POINT_LEN + sizeof("/") + CONFIG_GOLIOTH_OTA_MAX_PACKAGE_NAME_LEN + sizeof("_") \
+     + CONFIG_GOLIOTH_OTA_MAX_VERSION_LEN + sizeof(PART_SUFFIX))
+
+static const char *sd_mount_point;
+static download_filter_cb filter_cb;
+static download_ready_cb ready_cb;
+
+struct applied_component {
+    char package[CONFIG_GOLIOTH_OTA_MAX_PACKAGE_NAME_LEN + 1];
+    char version[CONFIG_GOLIOTH_OTA_MAX_VERSION_LEN + 1];
+    uint8_t hash[GOLIOTH_OTA_COMPONENT_BIN_HASH_LEN];
+    /* The artifact is complete and verified on the SD card (persisted) */
+    bool stored;
+    /* Went through the filter and ready callbacks since boot (RAM only) */
+    bool settled;
+};
+
+struct applied_state_header {
+    uint32_t version;
+    /* Changes with the package name and version length limits */
+    uint32_t entry_size;
+    uint32_t count;
+};
+
+/* Shared by the Golioth client task, which queues components, and the download task */
+static struct applied_component applied[MAX_APPLIED];
+static size_t applied_count;
+static StaticSemaphore_t applied_lock_buffer;
+static SemaphoreHandle_t applied_lock;
+
+struct artifact_writer {
+    /* Opened once the first block tells the size to store */
+    FILE *f;
+    const char *part_path;
+    mbedtls_sha256_context sha;
+    /* Bytes received, which is what the manifest size and hash describe */
+    size_t bytes_written;
+    /* Bytes written to the file, larger than bytes_written for compressed artifacts */
+    size_t bytes_stored;
+    int64_t start_us;
+    bool compressed;
+    struct model_inflate inflate;
+};
+
+/* Spread the download out so that it does not compete with inference for the CPU and the SD card */
+static void throttle(const struct artifact_writer *writer)
+{
+#if CONFIG_MODEL_DOWNLOAD_MAX_WRITE_RATE > 0
+    int64_t min_elapsed_us =
+        (int64_t) writer->bytes_stored * 1000000 / CONFIG_MODEL_DOWNLOAD_MAX_WRITE_RATE;
+    int64_t elapsed_us = esp_timer_get_time() - writer->start_us;
+    if (elapsed_us < min_elapsed_us)
+    {
+        vTaskDelay(pdMS_TO_TICKS((min_elapsed_us - elapsed_us) / 1000));
+    }
+#endif
+
+#if CONFIG_MODEL_DOWNLOAD_BLOCK_DELAY_MS > 0
+    vTaskDelay(pdMS_TO_TICKS(CONFIG_MODEL_DOWNLOAD_BLOCK_DELAY_MS));
+#endif
+}
+
+static esp_err_t store(const uint8_t *data, size_t len, void *arg)
+{
+    struct artifact_writer *writer = (struct artifact_writer *) arg;
+    if (fwrite(data, len, 1, writer->f) != 1)
+    {
+        return ESP_FAIL;
+    }
+    writer->bytes_stored += len;
+    return ESP_OK;
+}
+
+/* Allocates all clusters of the file up front, in one contiguous run, so the loader reads it
+ * without seeking between fragments. Falls back to a regular file if the card has no run that
+ * long, or if the IDF is older than v5.3, which added contiguous allocation. */
+static esp_err_t open_part_file(struct artifact_writer *writer, size_t size)
+{
+#if CONFIG_MODEL_DOWNLOAD_PREALLOCATE && (ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0))
+    esp_err_t err =
+        esp_vfs_fat_create_contiguous_file(sd_mount_point, writer->part_path, size, true);
+    if (err == ESP_OK)
+    {
+        /* "w" would truncate the file and release the clusters */
+        writer->f = fopen(writer->part_path, "r+");
+        if (writer->f)
+        {
+            GLTH_LOGI(TAG, "Preallocated %zu contiguous bytes: %s", size, writer->part_path);
+            return ESP_OK;
+        }
+    }
+    GLTH_LOGW(TAG, "Unable to preallocate %zu bytes (%d), writing without", size, err);
+#endif
+
+    writer->f = fopen(writer->part_path, "w");
+    return writer->f ? ESP_OK : ESP_FAIL;
+}
+
+static enum golioth_status write_artifact_block(const struct golioth_ota_component *component,
+                                                uint32_t block_idx,
+                                                uint8_t *block_buffer,
+                                                size_t block_size,
+                                                bool is_last,
+                                                void *arg)
+{
+
+    if (!arg)
+    {
+        GLTH_LOGE(TAG, "arg is NULL but should be an artifact writer");
+        return GOLIOTH_ERR_INVALID_FORMAT;
+    }
+    struct artifact_writer *writer = (struct artifact_writer *) arg;
+
+    if (block_idx == 0)
+    {
+        writer->compressed = model_inflate_is_compressed(block_buffer, block_size);
+        if (writer->compressed)
+        {
+            GLTH_LOGI(TAG, "Artifact is compressed, decompressing while downloading");
+        }
+
+        size_t stored_size = writer->compressed
+            ? model_inflate_original_size(block_buffer, block_size)
+            : (size_t) component->size;
+        if (open_part_file(writer, stored_size) != ESP_OK)
+        {
+            GLTH_LOGE(TAG, "Error opening file: %s", writer->part_path);
+            return GOLIOTH_ERR_IO;
+        }
+    }
+
+    esp_err_t err = writer->compressed ? model_inflate_feed(&writer->inflate,
+                                                            block_buffer,
+                                                            block_size,
+                                                            store,
+                                                            writer)
+                                       : store(block_buffer, block_size, writer);
+    if (err)
+    {
+        GLTH_LOGE(TAG, "Error writing block %" PRIu32 ": %d", block_idx, err);
+        return GOLIOTH_ERR_IO;
+    }
+
+    mbedtls_sha256_update(&writer->sha, block_buffer, block_size);
+    writer->bytes_written += block_size;
+
+    if (is_last)
+    {
+        GLTH_LOGI(TAG, "Block download complete!");
+    }
+    else
+    {
+        throttle(writer);
+    }
+
+    return GOLIOTH_OK;
+}
+
+/* Downloads the component to a temporary file that is only renamed to path once its size and hash
+ * match the manifest, so a file at path is always a complete, verified artifact. */
+static esp_err_t download_to_file(struct golioth_client *client,
+                                  const struct golioth_ota_component *component,
+                                  const char *path)
+{
+    char part_path[MAX_PATH_LEN];
+    snprintf(part_path, sizeof(part_path), "%s" PART_SUFFIX, path);
+
+    /* Remove leftovers of an interrupted download */
+    unlink(part_path);
+
+    GLTH_LOGI(TAG, "Downloading to: %s", part_path);
+    struct artifact_writer writer = {
+        .f = NULL,
+        .part_path = part_path,
+        .bytes_written = 0,
+        .bytes_stored = 0,
+        .start_us = esp_timer_get_time(),
+        .compressed = false,
+    };
+
+    mbedtls_sha256_init(&writer.sha);
+    mbedtls_sha256_starts(&writer.sha, 0);
+    model_inflate_init(&writer.inflate);
+
+#if CONFIG_MODEL_DOWNLOAD_WINDOW > 1
+    enum golioth_status status = block_fetcher_download(client,
+                                                        component,
+                                                        CONFIG_MODEL_DOWNLOAD_WINDOW,
+                                                        write_artifact_block,
+                                                        &writer);
+#else
+    enum golioth_status status =
+        golioth_ota_download_component(client, component, write_artifact_block, &writer);
+#endif
+
+    uint8_t hash[GOLIOTH_OTA_COMPONENT_BIN_HASH_LEN];
+    mbedtls_sha256_finish(&writer.sha, hash);
+    mbedtls_sha256_free(&writer.sha);
+    bool inflated = !writer.compressed || model_inflate_finished(&writer.inflate);
+    model_inflate_free(&writer.inflate);
+
+    int close_err = writer.f ? fclose(writer.f) : 0;
+
+    esp_err_t err = ESP_OK;
+    if ((status != GOLIOTH_OK) || close_err)
+    {
+        GLTH_LOGE(TAG, "Download of %s failed: %d", component->package, status);
+        err = ESP_FAIL;
+    }
+    else if (writer.bytes_written != (size_t) component->size)
+    {
+        GLTH_LOGE(TAG,
+                  "Downloaded %zu bytes but expected %" PRId32,
+                  writer.bytes_written,
+                  component->size);
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else if (memcmp(hash, component->hash, sizeof(hash)) != 0)
+    {
+        GLTH_LOGE(TAG, "Hash mismatch for %s", component->package);
+        err = ESP_ERR_INVALID_CRC;
+    }
+    else if (!inflated)
+    {
+        GLTH_LOGE(TAG, "Compressed artifact %s is truncated", component->package);
+        err = ESP_ERR_INVALID_SIZE;
+    }
+    else if (rename(part_path, path) != 0)
+    {
+        GLTH_LOGE(TAG, "Unable to rename %s", part_path);
+        err = ESP_FAIL;
+    }
+
+    if (err)
+    {
+        unlink(part_path);
+        return err;
+    }
+
+    int64_t elapsed_ms = (esp_timer_get_time() - writer.start_us) / 1000;
+    GLTH_LOGI(TAG,
+              "Stored %s (%zu bytes from %zu downloaded in %" PRId64 " ms)",
+              path,
+              writer.bytes_stored,
+              writer.bytes_written,
+              elapsed_ms);
+    app_metrics_set("model_download_ms", elapsed_ms);
+    app_metrics_set("model_download_bytes_per_s",
+                    (int64_t) writer.bytes_written * 1000 / (elapsed_ms > 0 ? elapsed_ms : 1));
+    return ESP_OK;
+}
+
+/* Store components with name_version format: "componentname_1.2.3" */
+static void component_path(const char *package, const char *version, char *path)
+{
+    snprintf(path, MAX_PATH_LEN, "%s/%s_%s", sd_mount_point, package, version);
+}
+
+static struct applied_component *find_applied(const char *package)
+{
+    for (size_t i = 0; i < applied_count; i++)
+    {
+        if (strcmp(applied[i].package, package) == 0)
+        {
+            return &applied[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_same_release(const struct applied_component *entry,
+                            const struct golioth_ota_component *component)
+{
+    return (strcmp(entry->version, component->version) == 0)
+        && (memcmp(entry->hash, component->hash, sizeof(entry->hash)) == 0);
+}
+
+/* Returns the applied entry for this exact release, if any. Must hold applied_lock. */
+static struct applied_component *find_release(const struct golioth_ota_component *component)
+{
+    struct applied_component *entry = find_applied(component->package);
+    return (entry && is_same_release(entry, component)) ? entry : NULL;
+}
+
+static void save_applied_state(void)
+{
+    char path[MAX_PATH_LEN];
+    char part_path[MAX_PATH_LEN + sizeof(PART_SUFFIX)];
+    snprintf(path, sizeof(path), "%s/" STATE_FILE_NAME, sd_mount_point);
+    snprintf(part_path, sizeof(part_path), "%s" PART_SUFFIX, path);
+
+    struct applied_state_header header = {
+        .version = STATE_VERSION,
+        .entry_size = sizeof(struct applied_component),
+        .count = 0,
+    };
+    for (size_t i = 0; i < applied_count; i++)
+    {
+        header.count += applied[i].stored;
+    }
+
+    FILE *f = fopen(part_path, "w");
+    if (!f)
+    {
+        GLTH_LOGE(TAG, "Unable to save %s", path);
+        return;
+    }
+    bool ok = (fwrite(&header, sizeof(header), 1, f) == 1);
+    for (size_t i = 0; ok && (i < applied_count); i++)
+    {
+        if (applied[i].stored)
+        {
+            ok = (fwrite(&applied[i], sizeof(applied[i]), 1, f) == 1);
+        }
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || (rename(part_path, path) != 0))
+    {
+        GLTH_LOGE(TAG, "Unable to save %s", path);
+        unlink(part_path);
+    }
+}
+
+/* Reads the releases stored on a previous boot. Entries whose artifact is gone are dropped. */
+static void load_applied_state(void)
+{
+    char path[MAX_PATH_LEN];
+    snprintf(path, sizeof(path), "%s/" STATE_FILE_NAME, sd_mount_point);
+
+    FILE *f = fopen(path, "r");
+    if (!f)
+    {
+        return;
+    }
+
+    struct applied_state_header header;
+    if ((fread(&header, sizeof(header), 1, f) != 1) || (header.version != STATE_VERSION)
+        || (header.entry_size != sizeof(struct applied_component)))
+    {
+        GLTH_LOGW(TAG, "Ignoring %s", path);
+        fclose(f);
+        return;
+    }
+
+    for (uint32_t i = 0; (i < header.count) && (applied_count < MAX_APPLIED); i++)
+    {
+        struct applied_component *entry = &applied[applied_count];
+        if (fread(entry, sizeof(*entry), 1, f) != 1)
+        {
+            break;
+        }
+        entry->package[sizeof(entry->package) - 1] = '\0';
+        entry->version[sizeof(entry->version) - 1] = '\0';
+        entry->settled = false;
+
+        char artifact_path[MAX_PATH_LEN];
+        component_path(entry->package, entry->version, artifact_path);
+        struct stat st;
+        if (entry->stored && (stat(artifact_path, &st) == 0))
+        {
+            applied_count++;
+        }
+    }
+    fclose(f);
+
+    GLTH_LOGI(TAG, "%zu stored components known from the previous boot", applied_count);
+}
+
+/* Records that the component was handled since boot, and whether its artifact is on the card */
+static void record_applied(const struct golioth_ota_component *component, bool stored)
+{
+    xSemaphoreTake(applied_lock, portMAX_DELAY);
+    struct applied_component *entry = find_applied(component->package);
+    if (!entry)
+    {
+        /* A package that left the manifest makes room for a new one */
+        entry = &applied[(applied_count < MAX_APPLIED) ? applied_count++ : MAX_APPLIED - 1];
+        memset(entry, 0, sizeof(*entry));
+        snprintf(entry->package, sizeof(entry->package), "%s", component->package);
+    }
+
+    bool changed = (entry->stored != stored) || !is_same_release(entry, component);
+    snprintf(entry->version, sizeof(entry->version), "%s", component->version);
+    memcpy(entry->hash, component->hash, sizeof(entry->hash));
+    entry->stored = stored;
+    entry->settled = true;
+    if (changed)
+    {
+        save_applied_state();
+    }
+    xSemaphoreGive(applied_lock);
+}
+
+static void process_component(struct golioth_client *client,
+                              const struct golioth_ota_component *component)
+{
+    xSemaphoreTake(applied_lock, portMAX_DELAY);
+    struct applied_component *entry = find_release(component);
+    bool settled = entry && entry->settled;
+    bool stored = entry && entry->stored;
+    xSemaphoreGive(applied_lock);
+
+    /* Queued twice before the first copy was handled */
+    if (settled)
+    {
+        return;
+    }
+
+    char path[MAX_PATH_LEN];
+    component_path(component->package, component->version, path);
+
+    if (filter_cb && !filter_cb(component, path))
+    {
+        record_applied(component, stored);
+        return;
+    }
+
+    /* A release stored on a previous boot was checked for its file when the state was loaded */
+    struct stat st;
+    if (stored)
+    {
+        GLTH_LOGI(TAG, "Package already stored: %s", path);
+    }
+    else if (stat(path, &st) == 0)
+    {
+        GLTH_LOGI(TAG, "Package already exists on SD card: %s", path);
+    }
+    else if (download_to_file(client, component, path) != ESP_OK)
+    {
+        return;
+    }
+
+    record_applied(component, true);
+    if (ready_cb)
+    {
+        ready_cb(component, path);
+    }
+}
+
+static void download_task(void *arg)
+{
+    struct golioth_client *client = (struct golioth_client *) arg;
+
+    while (true)
+    {
+        struct golioth_ota_component *component = NULL;
+
+        if (xQueueReceive(xQueue, &component, portMAX_DELAY) == pdFALSE || !component)
+        {
+            GLTH_LOGE(TAG, "Failed to receive from queue");
+            continue;
+        }
+
+        process_component(client, component);
+        xQueueSendToBack(free_queue, &component, 0);
+    }
+}
+
+void download_service_init(const char *mount_point,
+                           download_filter_cb filter,
+                           download_ready_cb on_ready)
+{
+    assert(strlen(mount_point) <= MAX_MOUNT_POINT_LEN);
+    sd_mount_point = mount_point;
+    filter_cb = filter;
+    ready_cb = on_ready;
+
+    xQueue = xQueueCreateStatic(QUEUE_LENGTH, QUEUE_ITEM_SIZE, ucQueueStorageArea, &xStaticQueue);
+    assert(xQueue);
+
+    free_queue =
+        xQueueCreateStatic(QUEUE_LENGTH, QUEUE_ITEM_SIZE, free_queue_storage, &free_queue_buffer);
+    assert(free_queue);
+    for (size_t i = 0; i < QUEUE_LENGTH; i++)
+    {
+        struct golioth_ota_component *component = &component_pool[i];
+        xQueueSendToBack(free_queue, &component, 0);
+    }
+
+    applied_lock = xSemaphoreCreateMutexStatic(&applied_lock_buffer);
+    load_applied_state();
+}
+
+void download_service_start(struct golioth_client *client)
+{
+    BaseType_t ret = xTaskCreate(download_task,
+                                 "download",
+                                 DOWNLOAD_TASK_STACK_SIZE,
+                                 client,
+                                 CONFIG_MODEL_DOWNLOAD_TASK_PRIORITY,
+                                 NULL);
+    if (ret != pdPASS)
+    {
+        GLTH_LOGE(TAG, "Unable to start download task");
+    }
+}
+
+esp_err_t download_service_enqueue(const struct golioth_ota_component *component)
+{
+    xSemaphoreTake(applied_lock, portMAX_DELAY);
+    struct applied_component *entry = find_release(component);
+    bool settled = entry && entry->settled;
+    xSemaphoreGive(applied_lock);
+
+    if (settled)
+    {
+        GLTH_LOGD(TAG, "Unchanged: %s %s", component->package, component->version);
+        return ESP_OK;
+    }
+
+    struct golioth_ota_component *stored_component = NULL;
+    if (xQueueReceive(free_queue, &stored_component, 0) != pdTRUE)
+    {
+        GLTH_LOGE(TAG, "No free entry to store component");
+        return ESP_ERR_NO_MEM;
+    }
+
+    memcpy(stored_component, component, sizeof(struct golioth_ota_component));
+
+    if (xQueueSendToBack(xQueue, &stored_component, 0) != pdPASS)
+    {
+        GLTH_LOGE(TAG, "Failed to enqueue component");
+        xQueueSendToBack(free_queue, &stored_component, 0);
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
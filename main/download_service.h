@@ -0,0 +1,35 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include <golioth/client.h>
+#include <golioth/ota.h>
+
+/* Called before anything is downloaded or written; return false to skip the component */
+typedef bool (*download_filter_cb)(const struct golioth_ota_component *component,
+                                   const char *path);
+
+/* Called once a component is stored at path and its hash matches the manifest. Runs on the
+ * download task; path is only valid for the duration of the call. */
+typedef void (*download_ready_cb)(const struct golioth_ota_component *component,
+                                  const char *path);
+
+/* Creates the component queue and reads the releases stored on a previous boot, so the SD card
+ * must be mounted. Components may be queued before the service is started. */
+void download_service_init(const char *mount_point,
+                           download_filter_cb filter,
+                           download_ready_cb on_ready);
+
+/* Starts the low-priority download task once the client is connected */
+void download_service_start(struct golioth_client *client);
+
+/* Queues a copy of the component for download; safe to call from Golioth callbacks. A release
+ * that was already handled since boot is skipped without touching the SD card. Copies come from
+ * a pool of CONFIG_GOLIOTH_OTA_MAX_NUM_COMPONENTS entries; ESP_ERR_NO_MEM when it is empty. */
+esp_err_t download_service_enqueue(const struct golioth_ota_component *component);
@@ -1,17 +1,38 @@
 #include "esp_err.h"
+#include "esp_heap_caps.h"
+#include "esp_idf_version.h"
 #include "esp_log.h"
+#include "esp_memory_utils.h"
+#include "esp_timer.h"
+#include "esp_vfs_fat.h"
 #include "model_handler.h"
+#include <fcntl.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <sys/param.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 static const char *TAG = "model_handler";
 
 #define MAX_HEADER_LEN 128
 #define HEADER_START "GLTHBEGIN"
 #define HEADER_END "GLTHEND"
+#define HEADER_STRIDE_KEY "stride_ms="
+
+/* Direct reads transfer whole sectors from sector-aligned file offsets */
+#define SD_SECTOR_SIZE 512
+#define DIRECT_READ_CHUNK_SIZE (16 * SD_SECTOR_SIZE)
+#define LOAD_BENCHMARK_RUNS 3
+
+#if CONFIG_MODEL_LOAD_DIRECT_READ
+#define MODEL_READ_METHOD "direct"
+#else
+#define MODEL_READ_METHOD "stdio"
+#endif
 
 static esp_err_t add_category(struct tf_model_ctx *ctx, char *str, size_t len)
 {
@@ -74,6 +95,11 @@ static esp_err_t ingest_header(struct tf_model_ctx *ctx, char *header, size_t he
             ESP_LOGD(TAG, "Found header end");
             return ESP_OK;
         }
+        else if (strncmp(token, HEADER_STRIDE_KEY, strlen(HEADER_STRIDE_KEY)) == 0)
+        {
+            ctx->stride_ms = atoi(token + strlen(HEADER_STRIDE_KEY));
+            ESP_LOGD(TAG, "Feature stride: %d ms", ctx->stride_ms);
+        }
         else
         {
             ESP_LOGD(TAG, "Token Found: %s", token);
@@ -90,6 +116,227 @@ static esp_err_t ingest_header(struct tf_model_ctx *ctx, char *header, size_t he
     return ESP_ERR_INVALID_ARG;
 }
 
+#define MAX_META_PATH_LEN 128
+
+static void format_meta_path(char *buf, size_t len, const char *path)
+{
+    snprintf(buf, len, "%s" MODEL_META_SUFFIX, path);
+}
+
+/* Reads the descriptor of a model verified on a previous boot. Returns false when there is none or
+ * it does not belong to the file as it is now. */
+static bool load_meta(const char *path, const struct stat *st, struct tf_model_meta *meta)
+{
+    char meta_path[MAX_META_PATH_LEN];
+    format_meta_path(meta_path, sizeof(meta_path), path);
+
+    FILE *f = fopen(meta_path, "r");
+    if (!f)
+    {
+        return false;
+    }
+
+    size_t bytes_read = fread(meta, 1, sizeof(*meta), f);
+    fclose(f);
+
+    if ((bytes_read != sizeof(*meta)) || (meta->version != MODEL_META_VERSION) || !meta->verified
+        || (meta->file_size != (uint32_t) st->st_size) || (meta->mtime != (int64_t) st->st_mtime)
+        || (meta->header_len == 0) || (meta->header_len > MAX_HEADER_LEN))
+    {
+        ESP_LOGW(TAG, "Ignoring stale model descriptor: %s", meta_path);
+        return false;
+    }
+
+    return true;
+}
+
+esp_err_t model_store_meta(const struct tf_model_ctx *ctx, const char *path)
+{
+    if (!ctx || !path || !ctx->meta.verified)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char meta_path[MAX_META_PATH_LEN];
+    format_meta_path(meta_path, sizeof(meta_path), path);
+
+    FILE *f = fopen(meta_path, "w");
+    if (!f)
+    {
+        ESP_LOGE(TAG, "Unable to open %s", meta_path);
+        return ESP_FAIL;
+    }
+
+    size_t bytes_written = fwrite(&ctx->meta, 1, sizeof(ctx->meta), f);
+    int close_err = fclose(f);
+    if ((bytes_written != sizeof(ctx->meta)) || close_err)
+    {
+        ESP_LOGE(TAG, "Unable to write %s", meta_path);
+        unlink(meta_path);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Stored model descriptor: %s", meta_path);
+    return ESP_OK;
+}
+
+static bool place_internal(size_t size)
+{
+#if CONFIG_MODEL_DATA_PLACEMENT_INTERNAL
+    return true;
+#elif CONFIG_MODEL_DATA_PLACEMENT_PSRAM
+    return false;
+#else
+    size_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    return (size <= CONFIG_MODEL_DATA_INTERNAL_MAX_SIZE)
+        && (largest >= size + CONFIG_MODEL_DATA_INTERNAL_RESERVE);
+#endif
+}
+
+/* Weights are read on every invoke, so they go to internal RAM when the policy allows it. Either
+ * tier is tried if the preferred one is exhausted. */
+static uint8_t *alloc_model_data(size_t size, bool *in_psram)
+{
+    uint32_t preferred = place_internal(size) ? MALLOC_CAP_INTERNAL : MALLOC_CAP_SPIRAM;
+    uint32_t fallback =
+        (preferred == MALLOC_CAP_INTERNAL) ? MALLOC_CAP_SPIRAM : MALLOC_CAP_INTERNAL;
+
+    uint8_t *data = heap_caps_malloc(size, preferred | MALLOC_CAP_8BIT);
+    if (!data)
+    {
+        ESP_LOGW(TAG, "Unable to place model in preferred memory, trying the other");
+        data = heap_caps_malloc(size, fallback | MALLOC_CAP_8BIT);
+    }
+
+    *in_psram = data && esp_ptr_external_ram(data);
+    return data;
+}
+
+/* Reads len bytes at offset through the stdio buffer of f */
+static esp_err_t read_stdio(FILE *f, size_t offset, uint8_t *dst, size_t len)
+{
+    if ((fseek(f, offset, SEEK_SET) != 0) || (fread(dst, 1, len, f) != len))
+    {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* Reads len bytes at offset with read() in chunks of whole sectors from a sector-aligned file
+ * offset into a word-aligned, DMA-capable buffer. The SD driver then transfers several sectors per
+ * command straight into it, where a PSRAM or unaligned destination makes it copy every sector
+ * through its own bounce buffer. The chunks are copied to dst, which may be anywhere. */
+static esp_err_t read_direct(const char *path, size_t offset, uint8_t *dst, size_t len)
+{
+    uint8_t *chunk = heap_caps_aligned_alloc(4,
+                                             DIRECT_READ_CHUNK_SIZE,
+                                             MALLOC_CAP_DMA | MALLOC_CAP_INTERNAL);
+    if (!chunk)
+    {
+        return ESP_ERR_NO_MEM;
+    }
+
+    int fd = open(path, O_RDONLY);
+    size_t pos = offset - (offset % SD_SECTOR_SIZE);
+    esp_err_t err = ((fd >= 0) && (lseek(fd, pos, SEEK_SET) == (off_t) pos)) ? ESP_OK : ESP_FAIL;
+
+    size_t copied = 0;
+    while (!err && (copied < len))
+    {
+        ssize_t n = read(fd, chunk, DIRECT_READ_CHUNK_SIZE);
+        if (n <= 0)
+        {
+            err = ESP_FAIL;
+            break;
+        }
+
+        /* The first chunk starts before offset */
+        size_t skip = (pos < offset) ? offset - pos : 0;
+        if ((size_t) n > skip)
+        {
+            size_t take = MIN((size_t) n - skip, len - copied);
+            memcpy(dst + copied, chunk + skip, take);
+            copied += take;
+        }
+        pos += n;
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+    heap_caps_free(chunk);
+    return err;
+}
+
+static esp_err_t read_model_data(FILE *f,
+                                 const char *path,
+                                 size_t offset,
+                                 uint8_t *dst,
+                                 size_t len)
+{
+#if CONFIG_MODEL_LOAD_DIRECT_READ
+    esp_err_t err = read_direct(path, offset, dst, len);
+    if (err != ESP_ERR_NO_MEM)
+    {
+        return err;
+    }
+    ESP_LOGW(TAG, "No DMA memory for direct reads, reading through stdio");
+#endif
+    return read_stdio(f, offset, dst, len);
+}
+
+#if CONFIG_MODEL_LOAD_BENCHMARK
+/* Reads the model data again with both methods and logs their throughput */
+static void benchmark_model_reads(const char *path, size_t offset, uint8_t *dst, size_t len)
+{
+    bool contiguous = false;
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 3, 0)
+    /* The FAT volume is the first path component, e.g. "/sdcard" */
+    char base_path[16];
+    const char *end = strchr(path + 1, '/');
+    int base_len = end ? (int) (end - path) : 0;
+    snprintf(base_path, sizeof(base_path), "%.*s", base_len, path);
+    esp_err_t contiguous_err = esp_vfs_fat_test_contiguous_file(base_path, path, &contiguous);
+#else
+    esp_err_t contiguous_err = ESP_ERR_NOT_SUPPORTED;
+#endif
+
+    int64_t stdio_us = 0;
+    int64_t direct_us = 0;
+    for (int i = 0; i < LOAD_BENCHMARK_RUNS; i++)
+    {
+        /* A new FILE each run, so nothing is served from the previous run's buffer */
+        int64_t start_us = esp_timer_get_time();
+        FILE *f = fopen(path, "r");
+        esp_err_t err = f ? read_stdio(f, offset, dst, len) : ESP_FAIL;
+        if (f)
+        {
+            fclose(f);
+        }
+        stdio_us += esp_timer_get_time() - start_us;
+
+        start_us = esp_timer_get_time();
+        err = err ? err : read_direct(path, offset, dst, len);
+        direct_us += esp_timer_get_time() - start_us;
+        if (err)
+        {
+            ESP_LOGE(TAG, "Read benchmark failed: %d", err);
+            return;
+        }
+    }
+
+    ESP_LOGI(TAG,
+             "Read benchmark for %s (%zu bytes, %s): stdio %" PRId64 " KB/s, direct %" PRId64
+             " KB/s",
+             path,
+             len,
+             contiguous_err ? "contiguity unknown" : (contiguous ? "contiguous" : "fragmented"),
+             (int64_t) len * LOAD_BENCHMARK_RUNS * 1000 / (stdio_us > 0 ? stdio_us : 1),
+             (int64_t) len * LOAD_BENCHMARK_RUNS * 1000 / (direct_us > 0 ? direct_us : 1));
+}
+#endif
+
 struct tf_model_ctx *model_init_from_file(char *path)
 {
     if (!path)
@@ -110,6 +357,10 @@ struct tf_model_ctx *model_init_from_file(char *path)
         return NULL;
     }
 
+    int64_t start_us = esp_timer_get_time();
+    struct tf_model_meta meta;
+    bool cached = load_meta(path, &st, &meta);
+
     FILE *f = fopen(path, "r");
     if (!f)
     {
@@ -119,7 +370,24 @@ struct tf_model_ctx *model_init_from_file(char *path)
 
     /* Read header from file; establish starting index of model data */
     char header[MAX_HEADER_LEN];
-    for (int i = 0; i < MAX_HEADER_LEN; i++)
+    if (cached)
+    {
+        /* The descriptor records where the header ends, no need to scan for it */
+        if ((fread(header, 1, meta.header_len, f) == meta.header_len)
+            && (header[meta.header_len - 1] == '\n'))
+        {
+            model_offset = meta.header_len;
+            model_size = st.st_size - model_offset;
+        }
+        else
+        {
+            ESP_LOGW(TAG, "Model header does not match descriptor");
+            cached = false;
+            rewind(f);
+        }
+    }
+
+    for (int i = 0; (model_offset == 0) && (i < MAX_HEADER_LEN); i++)
     {
         fread(header + i, 1, 1, f);
         if (header[i] == '\n')
@@ -149,6 +417,21 @@ struct tf_model_ctx *model_init_from_file(char *path)
     /* Create new context; initialize to 0 to help in freeing memory later */
     ctx = (struct tf_model_ctx *) calloc(1, sizeof(struct tf_model_ctx));
 
+    ctx->threshold = DEFAULT_DETECTION_THRESHOLD;
+
+    if (cached)
+    {
+        ctx->meta = meta;
+        ctx->verified = true;
+    }
+    else
+    {
+        ctx->meta.version = MODEL_META_VERSION;
+        ctx->meta.file_size = st.st_size;
+        ctx->meta.mtime = st.st_mtime;
+        ctx->meta.header_len = model_offset;
+    }
+
     /* Populate model labels */
     esp_err_t err = ingest_header(ctx, header, model_offset);
     if (err)
@@ -159,28 +442,35 @@ struct tf_model_ctx *model_init_from_file(char *path)
     ESP_LOG_BUFFER_HEXDUMP(TAG, header, model_offset, ESP_LOG_DEBUG);
 
     /* Populate model data */
-    new_data = (unsigned char *) malloc(sizeof(unsigned char) * model_size);
+    new_data = alloc_model_data(model_size, &ctx->data_in_psram);
     if (!new_data)
     {
         ESP_LOGE(TAG, "Unable to allocate memory of size: %zu", model_size);
         goto model_load_error;
     }
 
-    /* File position should already be at the start of the model */
-    size_t bytes_read = fread(new_data, 1, model_size, f);
-    if (bytes_read != model_size)
+    err = read_model_data(f, path, model_offset, new_data, model_size);
+    if (err)
     {
-        ESP_LOGE(TAG,
-                 "Error copying model. Copied %zu but expected to copy %zu",
-                 bytes_read,
-                 model_size);
+        ESP_LOGE(TAG, "Error reading %zu bytes of model data: %d", model_size, err);
         goto model_load_error;
     }
 
     ctx->data_len = model_size;
     ctx->data = new_data;
 
-    ESP_LOGI(TAG, "Loaded model from %s", path);
+    ESP_LOGI(TAG,
+             "Loaded model from %s in %" PRId64 " ms (%s, " MODEL_READ_METHOD " reads)",
+             path,
+             (esp_timer_get_time() - start_us) / 1000,
+             ctx->verified ? "verified before" : "not verified yet");
+#if CONFIG_MODEL_LOAD_BENCHMARK
+    benchmark_model_reads(path, model_offset, new_data, model_size);
+#endif
+    ESP_LOGI(TAG,
+             "Model weights (%zu bytes) in %s",
+             model_size,
+             ctx->data_in_psram ? "PSRAM" : "internal RAM");
     ESP_LOGI(TAG, "Model label count: %d", ctx->label_count);
     for (int i = 0; i < ctx->label_count; i++)
     {
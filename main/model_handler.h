@@ -1,16 +1,75 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
 #include "esp_err.h"
 
 #define MAX_CATEGORY_LABELS 8
+#define DEFAULT_DETECTION_THRESHOLD 0.8f
+
+struct tf_model_stats {
+    uint32_t invokes;
+    int64_t total_us;
+    int64_t min_us;
+    int64_t max_us;
+    /* Windows scored; more than invokes for models with a batch dimension */
+    uint32_t windows;
+    /* Windows scored after newer audio arrived, e.g. after a stall */
+    uint32_t late_windows;
+    /* Windows that left the spectrogram before they were scored */
+    uint32_t dropped_windows;
+    /* Windows passed over because the classifiers run every few strides */
+    uint32_t skipped_windows;
+    /* Windows passed over because the cascade gate was closed */
+    uint32_t gated_windows;
+};
+
+/* Descriptor saved next to a model ("<path>.meta") after its first successful load. A later boot
+ * that finds a descriptor matching the file's size and mtime skips the header scan and the model
+ * checks. Bump the version when the layout changes. */
+#define MODEL_META_SUFFIX ".meta"
+#define MODEL_META_VERSION 1
+
+struct tf_model_meta {
+    uint32_t version;
+    uint32_t file_size;
+    int64_t mtime;
+    uint32_t header_len;
+    /* Set once the interpreter has accepted the model */
+    uint32_t verified;
+    uint32_t arena_used;
+    /* Bit n set for each builtin operator code n used by the model */
+    uint32_t op_mask;
+    float input_scale;
+    int32_t input_zero_point;
+    float output_scale;
+    int32_t output_zero_point;
+};
 
 struct tf_model_ctx {
     int label_count;
     char *labels[MAX_CATEGORY_LABELS];
 
+    /* Minimum score for a label to be reported as detected */
+    float threshold;
+    /* Feature stride from the "stride_ms=<n>" header token, 0 if the model uses the default */
+    int stride_ms;
+    /* Invoke latency, updated by the inference loop */
+    struct tf_model_stats stats;
+
+    /* Filled from the file on load and completed by the interpreter on first verification */
+    struct tf_model_meta meta;
+    /* True when meta was read from a matching descriptor, i.e. the model was verified before */
+    bool verified;
+
     size_t data_len;
     uint8_t *data;
+    /* Where the placement policy put data; reported with the invoke latency */
+    bool data_in_psram;
 };
 
 struct tf_model_ctx *model_init_from_file(char *path);
 esp_err_t model_free(struct tf_model_ctx *ctx);
+
+/* Writes the descriptor for a model that has passed verification */
+esp_err_t model_store_meta(const struct tf_model_ctx *ctx, const char *path);
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+static const char *TAG = "model_inflate";
+
+#include "model_inflate.h"
+
+#include <string.h>
+
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "rom/miniz.h"
+
+struct model_inflate_state {
+    tinfl_decompressor inflator;
+    size_t dict_size;
+    size_t dict_ofs;
+    /* Output ring the inflater resolves back references against */
+    uint8_t dict[];
+};
+
+bool model_inflate_is_compressed(const uint8_t *data, size_t len)
+{
+    size_t magic_len = strlen(MODEL_INFLATE_MAGIC);
+    return (len >= magic_len) && (memcmp(data, MODEL_INFLATE_MAGIC, magic_len) == 0);
+}
+
+uint32_t model_inflate_original_size(const uint8_t *data, size_t len)
+{
+    if ((len < MODEL_INFLATE_HEADER_LEN) || !model_inflate_is_compressed(data, len))
+    {
+        return 0;
+    }
+    return data[8] | (data[9] << 8) | (data[10] << 16) | ((uint32_t) data[11] << 24);
+}
+
+void model_inflate_init(struct model_inflate *inf)
+{
+    memset(inf, 0, sizeof(*inf));
+}
+
+static esp_err_t parse_header(struct model_inflate *inf)
+{
+    const uint8_t *h = inf->header;
+    uint8_t window_bits = h[4];
+    if (!model_inflate_is_compressed(h, MODEL_INFLATE_HEADER_LEN)
+        || (window_bits < MODEL_INFLATE_MIN_WINDOW_BITS)
+        || (window_bits > MODEL_INFLATE_MAX_WINDOW_BITS))
+    {
+        ESP_LOGE(TAG, "Unsupported compressed artifact (window bits %d)", window_bits);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    inf->expected_size = model_inflate_original_size(h, MODEL_INFLATE_HEADER_LEN);
+
+    /* The inflater alone is ~11 KB; it only lives for the duration of a download */
+    size_t dict_size = (size_t) 1 << window_bits;
+    inf->state = heap_caps_malloc(sizeof(*inf->state) + dict_size,
+                                  MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!inf->state)
+    {
+        ESP_LOGE(TAG, "Unable to allocate inflater");
+        return ESP_ERR_NO_MEM;
+    }
+    tinfl_init(&inf->state->inflator);
+    inf->state->dict_size = dict_size;
+    inf->state->dict_ofs = 0;
+
+    ESP_LOGI(TAG,
+             "Decompressing to %lu bytes, %zu byte window",
+             (unsigned long) inf->expected_size,
+             dict_size);
+    return ESP_OK;
+}
+
+esp_err_t model_inflate_feed(struct model_inflate *inf,
+                             const uint8_t *in,
+                             size_t len,
+                             model_inflate_sink_fn sink,
+                             void *arg)
+{
+    size_t i = 0;
+    while ((i < len) && (inf->header_len < MODEL_INFLATE_HEADER_LEN))
+    {
+        inf->header[inf->header_len++] = in[i++];
+        if (inf->header_len == MODEL_INFLATE_HEADER_LEN)
+        {
+            esp_err_t err = parse_header(inf);
+            if (err)
+            {
+                return err;
+            }
+        }
+    }
+
+    struct model_inflate_state *st = inf->state;
+    while (i < len)
+    {
+        if (inf->done)
+        {
+            ESP_LOGE(TAG, "Data continues past the end of the compressed stream");
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        size_t in_bytes = len - i;
+        size_t out_bytes = st->dict_size - st->dict_ofs;
+        tinfl_status status = tinfl_decompress(&st->inflator,
+                                               in + i,
+                                               &in_bytes,
+                                               st->dict,
+                                               st->dict + st->dict_ofs,
+                                               &out_bytes,
+                                               TINFL_FLAG_HAS_MORE_INPUT);
+        i += in_bytes;
+
+        if (status < TINFL_STATUS_DONE)
+        {
+            ESP_LOGE(TAG, "Corrupt compressed stream (%d)", status);
+            return ESP_ERR_INVALID_CRC;
+        }
+
+        if (out_bytes > 0)
+        {
+            if (out_bytes > inf->expected_size - inf->produced)
+            {
+                ESP_LOGE(TAG, "Compressed data expands past the original size");
+                return ESP_ERR_INVALID_SIZE;
+            }
+
+            esp_err_t err = sink(st->dict + st->dict_ofs, out_bytes, arg);
+            if (err)
+            {
+                return err;
+            }
+            inf->produced += out_bytes;
+            st->dict_ofs = (st->dict_ofs + out_bytes) & (st->dict_size - 1);
+        }
+
+        if (status == TINFL_STATUS_DONE)
+        {
+            inf->done = true;
+        }
+        else if ((status == TINFL_STATUS_NEEDS_MORE_INPUT) && (in_bytes == 0) && (out_bytes == 0))
+        {
+            /* No progress possible until the next block arrives */
+            break;
+        }
+    }
+
+    return ESP_OK;
+}
+
+bool model_inflate_finished(const struct model_inflate *inf)
+{
+    return inf->done && (inf->produced == inf->expected_size);
+}
+
+void model_inflate_free(struct model_inflate *inf)
+{
+    heap_caps_free(inf->state);
+    inf->state = NULL;
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Streaming decompression of artifacts produced by tools/compress_model.py.
+ *
+ * Stream layout (little endian):
+ *   "GMZ1", window bits (1 byte), 3 reserved bytes, original size (4 bytes),
+ *   then a raw deflate stream whose back references stay within 2^window_bits bytes.
+ *
+ * Decoding uses the inflater in ROM with a window of 2^window_bits output bytes, so RAM is
+ * bounded by MODEL_INFLATE_MAX_WINDOW_BITS whatever the artifact size. Input may be split
+ * anywhere. */
+
+#define MODEL_INFLATE_MAGIC "GMZ1"
+#define MODEL_INFLATE_HEADER_LEN 12
+#define MODEL_INFLATE_MIN_WINDOW_BITS 9
+#define MODEL_INFLATE_MAX_WINDOW_BITS 15
+
+/* Receives decompressed data; return ESP_OK to continue */
+typedef esp_err_t (*model_inflate_sink_fn)(const uint8_t *data, size_t len, void *arg);
+
+struct model_inflate_state;
+
+struct model_inflate {
+    uint8_t header[MODEL_INFLATE_HEADER_LEN];
+    size_t header_len;
+    uint32_t expected_size;
+    uint32_t produced;
+    bool done;
+    /* Inflater and window, allocated once the header is read */
+    struct model_inflate_state *state;
+};
+
+/* True if data starts like a compressed artifact */
+bool model_inflate_is_compressed(const uint8_t *data, size_t len);
+
+/* Size of the decompressed artifact given its first bytes, or 0 without a complete header */
+uint32_t model_inflate_original_size(const uint8_t *data, size_t len);
+
+void model_inflate_init(struct model_inflate *inf);
+
+/* Decodes len bytes of input and passes all output produced by it to sink */
+esp_err_t model_inflate_feed(struct model_inflate *inf,
+                             const uint8_t *in,
+                             size_t len,
+                             model_inflate_sink_fn sink,
+                             void *arg);
+
+/* True once the deflate stream ended after producing exactly the original size */
+bool model_inflate_finished(const struct model_inflate *inf);
+
+/* Releases the inflater; safe to call on an initialised decoder in any state */
+void model_inflate_free(struct model_inflate *inf);
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+static const char *TAG = "model_regression";
+
+#include "model_regression.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "esp_app_desc.h"
+#include "esp_log.h"
+#include "../tf_micro_speech/main_functions.h"
+
+#define BASELINE_PATH CONFIG_MODEL_REGRESSION_CORPUS_DIR "/" MODEL_REGRESSION_BASELINE_FILE
+#define FIRMWARE_PATH CONFIG_MODEL_REGRESSION_CORPUS_DIR "/" MODEL_REGRESSION_FIRMWARE_FILE
+#define FIRMWARE_ID_LEN 64
+
+/* "clips=<n>" etc., one value per line */
+#define BASELINE_FORMAT(U32, D32)                                                          \
+    "clips=%" U32 "\ncorrect=%" U32 "\ndetections=%" U32 "\ninvokes=%" U32 "\navg_us=%" D32 \
+    "\nmax_us=%" D32 "\narena_used=%zu\n"
+
+static bool corpus_exists(void)
+{
+    struct stat st;
+    return (stat(CONFIG_MODEL_REGRESSION_CORPUS_DIR, &st) == 0) && S_ISDIR(st.st_mode);
+}
+
+esp_err_t model_regression_run(struct tf_model_ctx *ctx, struct tf_corpus_report *report)
+{
+    if (!corpus_exists())
+    {
+        return ESP_ERR_NOT_FOUND;
+    }
+    switch (tf_micro_speech_run_corpus(ctx, CONFIG_MODEL_REGRESSION_CORPUS_DIR, report))
+    {
+        case TF_CORPUS_OK:
+            return ESP_OK;
+        case TF_CORPUS_NO_MEMORY:
+            return ESP_ERR_NO_MEM;
+        case TF_CORPUS_UNREADABLE:
+            ESP_LOGW(TAG, "Unable to read the corpus in %s", CONFIG_MODEL_REGRESSION_CORPUS_DIR);
+            return ESP_ERR_INVALID_RESPONSE;
+        case TF_CORPUS_ERROR:
+        default:
+            return ESP_FAIL;
+    }
+}
+
+static bool load_baseline(struct tf_corpus_report *baseline)
+{
+    FILE *f = fopen(BASELINE_PATH, "r");
+    if (!f)
+    {
+        return false;
+    }
+    int n = fscanf(f,
+                   BASELINE_FORMAT(SCNu32, SCNd32),
+                   &baseline->clips,
+                   &baseline->correct,
+                   &baseline->detections,
+                   &baseline->invokes,
+                   &baseline->avg_us,
+                   &baseline->max_us,
+                   &baseline->arena_used);
+    fclose(f);
+    if ((n != 7) || (baseline->clips == 0))
+    {
+        ESP_LOGW(TAG, "Ignoring malformed baseline %s", BASELINE_PATH);
+        return false;
+    }
+    return true;
+}
+
+bool model_regression_has_baseline(void)
+{
+    struct tf_corpus_report baseline;
+    return load_baseline(&baseline);
+}
+
+bool model_regression_passes(const struct tf_corpus_report *report)
+{
+    struct tf_corpus_report baseline;
+    if (!load_baseline(&baseline))
+    {
+        return true;
+    }
+
+    int accuracy_pct = (int) (report->correct * 100 / report->clips);
+    int baseline_pct = (int) (baseline.correct * 100 / baseline.clips);
+    ESP_LOGI(TAG,
+             "Accuracy %d%% (baseline %d%%), %" PRId32 " us per invoke (baseline %" PRId32
+             "), arena %zu bytes (baseline %zu)",
+             accuracy_pct,
+             baseline_pct,
+             report->avg_us,
+             baseline.avg_us,
+             report->arena_used,
+             baseline.arena_used);
+
+    bool passes = true;
+    if (baseline_pct - accuracy_pct > CONFIG_MODEL_REGRESSION_MAX_ACCURACY_DROP_PCT)
+    {
+        ESP_LOGW(TAG,
+                 "Accuracy dropped by more than %d%%",
+                 CONFIG_MODEL_REGRESSION_MAX_ACCURACY_DROP_PCT);
+        passes = false;
+    }
+    if ((int64_t) report->avg_us * 100
+        > (int64_t) baseline.avg_us * CONFIG_MODEL_REGRESSION_MAX_LATENCY_PCT)
+    {
+        ESP_LOGW(TAG,
+                 "Invoke latency above %d%% of the baseline",
+                 CONFIG_MODEL_REGRESSION_MAX_LATENCY_PCT);
+        passes = false;
+    }
+    if (report->arena_used > baseline.arena_used + CONFIG_MODEL_REGRESSION_MAX_ARENA_GROWTH)
+    {
+        ESP_LOGW(TAG, "Arena grew by more than %d bytes", CONFIG_MODEL_REGRESSION_MAX_ARENA_GROWTH);
+        passes = false;
+    }
+    return passes;
+}
+
+enum model_regression_gate model_regression_gate(struct tf_model_ctx *ctx,
+                                                 struct tf_corpus_report *report)
+{
+    memset(report, 0, sizeof(*report));
+    esp_err_t err = model_regression_run(ctx, report);
+    switch (err)
+    {
+        case ESP_OK:
+            return model_regression_passes(report) ? MODEL_REGRESSION_GATE_PASS
+                                                   : MODEL_REGRESSION_GATE_REJECT;
+        case ESP_ERR_NO_MEM:
+            return MODEL_REGRESSION_GATE_DEFER;
+        case ESP_ERR_NOT_FOUND:
+        case ESP_ERR_INVALID_RESPONSE:
+            /* Nothing is known about the model, so the gate is left to the shadow evaluation */
+            return MODEL_REGRESSION_GATE_NOT_RUN;
+        default:
+            ESP_LOGW(TAG, "Unable to play the corpus through the candidate");
+            return MODEL_REGRESSION_GATE_REJECT;
+    }
+}
+
+esp_err_t model_regression_store_baseline(const struct tf_corpus_report *report)
+{
+    FILE *f = fopen(BASELINE_PATH, "w");
+    if (!f)
+    {
+        ESP_LOGE(TAG, "Unable to write %s", BASELINE_PATH);
+        return ESP_FAIL;
+    }
+    fprintf(f,
+            BASELINE_FORMAT(PRIu32, PRId32),
+            report->clips,
+            report->correct,
+            report->detections,
+            report->invokes,
+            report->avg_us,
+            report->max_us,
+            report->arena_used);
+    int err = fclose(f);
+    ESP_LOGI(TAG, "Stored regression baseline %s", BASELINE_PATH);
+    return err ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t model_regression_check_firmware(struct tf_model_ctx *ctx)
+{
+    char firmware[FIRMWARE_ID_LEN + 1];
+    esp_app_get_elf_sha256(firmware, sizeof(firmware));
+
+    /* "<elf sha256> <regressed>" from the last check, so the verdict survives reboots */
+    char checked[FIRMWARE_ID_LEN + 1] = "";
+    int regressed = 0;
+    FILE *f = fopen(FIRMWARE_PATH, "r");
+    if (f)
+    {
+        if (fscanf(f, "%64s %d", checked, &regressed) != 2)
+        {
+            checked[0] = '\0';
+        }
+        fclose(f);
+    }
+    if (strcmp(firmware, checked) == 0)
+    {
+        return regressed ? ESP_ERR_INVALID_STATE : ESP_OK;
+    }
+
+    struct tf_corpus_report report;
+    esp_err_t err = model_regression_run(ctx, &report);
+    if (err)
+    {
+        return err;
+    }
+
+    if (!model_regression_has_baseline())
+    {
+        err = model_regression_store_baseline(&report);
+    }
+    else if (!model_regression_passes(&report))
+    {
+        err = ESP_ERR_INVALID_STATE;
+    }
+
+    if (err && (err != ESP_ERR_INVALID_STATE))
+    {
+        return err;
+    }
+    f = fopen(FIRMWARE_PATH, "w");
+    if (f)
+    {
+        fprintf(f, "%s %d\n", firmware, err == ESP_ERR_INVALID_STATE);
+        fclose(f);
+    }
+    ESP_LOGI(TAG, "Checked firmware %.16s against the regression corpus", firmware);
+    return err;
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+struct tf_corpus_report;
+struct tf_model_ctx;
+
+/* A regression corpus is a directory of labeled WAV clips (CONFIG_MODEL_REGRESSION_CORPUS_DIR).
+ * The results of the accepted model are kept next to the clips as a baseline, and a candidate is
+ * held to it within the CONFIG_MODEL_REGRESSION_* tolerances. */
+#define MODEL_REGRESSION_BASELINE_FILE "baseline.txt"
+/* ELF SHA-256 of the firmware that last checked the running model against the baseline */
+#define MODEL_REGRESSION_FIRMWARE_FILE "firmware.txt"
+
+/* What to do with a candidate model after playing the corpus through it */
+enum model_regression_gate {
+    /* Within the tolerances of the baseline, or there is no baseline yet */
+    MODEL_REGRESSION_GATE_PASS,
+    /* There is no corpus or it can't be read, so nothing is known about the model */
+    MODEL_REGRESSION_GATE_NOT_RUN,
+    /* No memory to run the model right now; try again after a reboot */
+    MODEL_REGRESSION_GATE_DEFER,
+    /* Regressed, or the model can't be built or invoked */
+    MODEL_REGRESSION_GATE_REJECT,
+};
+
+/* Plays the corpus through the model. Returns ESP_ERR_NOT_FOUND when there is no corpus,
+ * ESP_ERR_INVALID_RESPONSE when it can't be read, ESP_ERR_NO_MEM when there is no arena section
+ * or buffer for the model right now and ESP_FAIL when the model can't be run. Must be called from
+ * the inference task. */
+esp_err_t model_regression_run(struct tf_model_ctx *ctx, struct tf_corpus_report *report);
+
+/* Plays the corpus through a candidate model and holds it to the baseline. report holds the
+ * candidate's results after MODEL_REGRESSION_GATE_PASS. Must be called from the inference task. */
+enum model_regression_gate model_regression_gate(struct tf_model_ctx *ctx,
+                                                 struct tf_corpus_report *report);
+
+/* True if report is within the tolerances of the stored baseline, or if there is no baseline */
+bool model_regression_passes(const struct tf_corpus_report *report);
+
+bool model_regression_has_baseline(void);
+
+/* Makes report the baseline that later candidates are compared with */
+esp_err_t model_regression_store_baseline(const struct tf_corpus_report *report);
+
+/* Plays the corpus through the running model when the firmware changed since the last check, so
+ * that code changes are held to the baseline too. Without a baseline the results become it.
+ * Returns ESP_OK if there was nothing to check or the results pass, ESP_ERR_INVALID_STATE if they
+ * regressed, and the errors of model_regression_run() if the corpus could not be played; the
+ * check is then repeated on the next call. Must be called from the inference task. */
+esp_err_t model_regression_check_firmware(struct tf_model_ctx *ctx);
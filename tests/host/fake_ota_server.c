@@ -0,0 +1,238 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+#include "fake_ota_server.h"
+#include "test_util.h"
+
+/* Every request ever accepted; keeps the callback arguments of held responses reachable */
+#define MAX_REQUESTS 4096
+
+struct request {
+    uint32_t block_idx;
+    golioth_get_block_cb_fn cb;
+    void *arg;
+    int64_t due_us;
+    bool held;
+    bool answered;
+    /* Every transmission was lost */
+    bool timed_out;
+};
+
+static struct {
+    struct server_config config;
+    pthread_mutex_t mutex;
+    pthread_t thread;
+    bool stop;
+    struct request requests[MAX_REQUESTS];
+    int count;
+    int pending;
+    int refused;
+    int failed;
+    int refused_retries;
+    int lost;
+    bool hold_used;
+} server = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+uint8_t server_block_byte(uint32_t block_idx, size_t offset)
+{
+    return (uint8_t) (block_idx * 7 + offset);
+}
+
+size_t golioth_ota_size_to_nblocks(size_t component_size)
+{
+    return (component_size + GOLIOTH_OTA_BLOCKSIZE - 1) / GOLIOTH_OTA_BLOCKSIZE;
+}
+
+enum golioth_status golioth_ota_get_block_async(struct golioth_client *client,
+                                                const char *package,
+                                                const char *version,
+                                                size_t block_index,
+                                                golioth_get_block_cb_fn callback,
+                                                void *arg)
+{
+    pthread_mutex_lock(&server.mutex);
+    bool refuse_retry = ((int) block_index == server.config.fail_block) && (server.failed > 0)
+                        && (server.refused_retries < server.config.refuse_times);
+    server.refused_retries += refuse_retry;
+    if (refuse_retry || (server.pending >= server.config.queue_size)
+        || (server.count == MAX_REQUESTS))
+    {
+        server.refused++;
+        pthread_mutex_unlock(&server.mutex);
+        return GOLIOTH_ERR_QUEUE_FULL;
+    }
+
+    int64_t now_us = esp_timer_get_time();
+    int jitter_ms = server.config.jitter_ms;
+    int rtt_ms = server.config.rtt_ms + (jitter_ms ? rand() % (2 * jitter_ms + 1) - jitter_ms : 0);
+    struct request *request = &server.requests[server.count++];
+    *request = (struct request){
+        .block_idx = block_index,
+        .cb = callback,
+        .arg = arg,
+        .due_us = now_us + rtt_ms * 1000,
+    };
+    if ((int) block_index == server.config.slow_block)
+    {
+        request->due_us += 100000;
+    }
+    for (int n = 0; rand() % 100 < server.config.loss_pct; n++)
+    {
+        server.lost++;
+        request->due_us += (int64_t) (server.config.retransmit_ms << n) * 1000;
+        if (n == server.config.max_retransmits)
+        {
+            request->timed_out = true;
+            break;
+        }
+    }
+    if (((int) block_index == server.config.hold_block) && !server.hold_used)
+    {
+        request->held = true;
+        server.hold_used = true;
+    }
+    if ((int) block_index == server.config.release_block)
+    {
+        for (int i = 0; i < server.count; i++)
+        {
+            if (server.requests[i].held)
+            {
+                server.requests[i].held = false;
+                server.requests[i].due_us = now_us;
+            }
+        }
+    }
+    server.pending++;
+    pthread_mutex_unlock(&server.mutex);
+    return GOLIOTH_OK;
+}
+
+/* The client task: answers the request that is due first */
+static void *respond(void *arg)
+{
+    uint8_t payload[GOLIOTH_OTA_BLOCKSIZE];
+    while (true)
+    {
+        pthread_mutex_lock(&server.mutex);
+        if (server.stop)
+        {
+            pthread_mutex_unlock(&server.mutex);
+            break;
+        }
+        struct request *next = NULL;
+        for (int i = 0; i < server.count; i++)
+        {
+            struct request *r = &server.requests[i];
+            if (!r->answered && !r->held && (!next || (r->due_us < next->due_us)))
+            {
+                next = r;
+            }
+        }
+        if (!next || (next->due_us > esp_timer_get_time()))
+        {
+            pthread_mutex_unlock(&server.mutex);
+            usleep(100);
+            continue;
+        }
+
+        next->answered = true;
+        server.pending--;
+        struct golioth_response response = {.status = GOLIOTH_OK};
+        if (((int) next->block_idx == server.config.fail_block)
+            && (server.failed < server.config.fail_times))
+        {
+            server.failed++;
+            response.status = GOLIOTH_ERR_TIMEOUT;
+        }
+        if (next->timed_out)
+        {
+            response.status = GOLIOTH_ERR_TIMEOUT;
+        }
+        struct request request = *next;
+        pthread_mutex_unlock(&server.mutex);
+
+        uint32_t nblocks = golioth_ota_size_to_nblocks(server.config.size);
+        bool is_last = (request.block_idx == nblocks - 1);
+        size_t len = is_last ? server.config.size - request.block_idx * GOLIOTH_OTA_BLOCKSIZE
+                             : GOLIOTH_OTA_BLOCKSIZE;
+        const uint8_t *data = payload;
+        if (server.config.data)
+        {
+            data = server.config.data + request.block_idx * GOLIOTH_OTA_BLOCKSIZE;
+        }
+        else
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                payload[i] = server_block_byte(request.block_idx, i);
+            }
+        }
+        request.cb(NULL, &response, "", data, len, is_last, request.arg);
+    }
+    return NULL;
+}
+
+void server_start(struct server_config config)
+{
+    pthread_mutex_lock(&server.mutex);
+    server.config = config;
+    server.stop = false;
+    server.refused = 0;
+    server.failed = 0;
+    server.refused_retries = 0;
+    server.lost = 0;
+    server.hold_used = false;
+    pthread_mutex_unlock(&server.mutex);
+    CHECK(pthread_create(&server.thread, NULL, respond, NULL) == 0);
+}
+
+void server_stop(void)
+{
+    pthread_mutex_lock(&server.mutex);
+    server.stop = true;
+    pthread_mutex_unlock(&server.mutex);
+    pthread_join(server.thread, NULL);
+}
+
+int server_requests(void)
+{
+    pthread_mutex_lock(&server.mutex);
+    int count = server.count;
+    pthread_mutex_unlock(&server.mutex);
+    return count;
+}
+
+int server_refused(void)
+{
+    pthread_mutex_lock(&server.mutex);
+    int refused = server.refused;
+    pthread_mutex_unlock(&server.mutex);
+    return refused;
+}
+
+bool server_all_answered(void)
+{
+    pthread_mutex_lock(&server.mutex);
+    bool answered = true;
+    for (int i = 0; i < server.count; i++)
+    {
+        answered &= server.requests[i].answered;
+    }
+    pthread_mutex_unlock(&server.mutex);
+    return answered;
+}
+
+int server_lost(void)
+{
+    pthread_mutex_lock(&server.mutex);
+    int lost = server.lost;
+    pthread_mutex_unlock(&server.mutex);
+    return lost;
+}
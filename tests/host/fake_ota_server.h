@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/* A fake Golioth client for the OTA block requests: a responder thread answers them after a round
+ * trip with jitter, so responses arrive out of order, and can fail chosen requests, refuse
+ * requests as if its queue were full, or hold a response back until a later request. It can also
+ * lose requests at random, as a lossy link loses CoAP messages. */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <golioth/ota.h>
+
+struct server_config {
+    int32_t size;
+    /* Served as the component's content; NULL serves server_block_byte() */
+    const uint8_t *data;
+    /* Requests the client queues at a time; further ones are refused */
+    int queue_size;
+    int rtt_ms;
+    int jitter_ms;
+    /* Answers the first fail_times requests of fail_block with an error, and then refuses the next
+     * refuse_times requests of it */
+    int fail_block;
+    int fail_times;
+    int refuse_times;
+    /* Doesn't answer the first request of hold_block until release_block is requested */
+    int hold_block;
+    int release_block;
+    /* Answers requests of slow_block 100 ms late */
+    int slow_block;
+    /* Loses each transmission of a request with this probability. The client retransmits after
+     * retransmit_ms, doubling the wait after each loss, and gives up with a timeout once
+     * max_retransmits retransmissions are lost as well. */
+    int loss_pct;
+    int retransmit_ms;
+    int max_retransmits;
+};
+
+/* Byte at offset of block_idx when config.data is NULL */
+uint8_t server_block_byte(uint32_t block_idx, size_t offset);
+
+void server_start(struct server_config config);
+void server_stop(void);
+
+/* Requests accepted since the process started */
+int server_requests(void);
+/* Requests refused since the server was started */
+int server_refused(void);
+/* Whether every request accepted was answered */
+bool server_all_answered(void);
+/* Transmissions lost since the server was started */
+int server_lost(void);
@@ -0,0 +1,12 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/* Defined by the test, which chooses the firmware build it runs as */
+int esp_app_get_elf_sha256(char *dst, size_t size);
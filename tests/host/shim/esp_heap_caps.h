@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The host has one heap; the capabilities are accepted and ignored */
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DMA (1 << 3)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    (void) caps;
+    return malloc(size);
+}
+
+static inline void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    (void) caps;
+    return calloc(n, size);
+}
+
+static inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+    (void) caps;
+    /* posix_memalign() takes no less than the alignment of a pointer */
+    if (alignment < sizeof(void *))
+    {
+        alignment = sizeof(void *);
+    }
+    void *ptr = NULL;
+    return (posix_memalign(&ptr, alignment, size) == 0) ? ptr : NULL;
+}
+
+/* Large enough for any placement the application checks for */
+static inline size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    (void) caps;
+    return SIZE_MAX / 2;
+}
+
+static inline void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdio.h>
+
+#include "sdkconfig.h"
+
+/* Errors and warnings go to stderr, where ctest shows them for failing tests only */
+#define ESP_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) ((void) 0)
+
+/* Only logged at debug level, which the host tests leave out */
+#define ESP_LOG_BUFFER_HEXDUMP(tag, buffer, len, level) ((void) 0)
@@ -0,0 +1,16 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/* The host has no PSRAM */
+static inline bool esp_ptr_external_ram(const void *ptr)
+{
+    (void) ptr;
+    return false;
+}
@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "esp_timer.h"
+
+#include <pthread.h>
+#include <time.h>
+
+static struct timespec start;
+static pthread_once_t start_once = PTHREAD_ONCE_INIT;
+
+static void record_start(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    pthread_once(&start_once, record_start);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) (now.tv_sec - start.tv_sec) * 1000000 + (now.tv_nsec - start.tv_nsec) / 1000;
+}
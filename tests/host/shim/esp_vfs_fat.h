@@ -0,0 +1,10 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/* The SD card is a host directory. The contiguous file calls arrived in IDF v5.3, after the version
+ * the host tests build as, so none are needed. */
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <pthread.h>
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Fixed-size items copied in and out in FIFO order */
+struct shim_queue {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t *storage;
+    size_t item_size;
+    UBaseType_t length;
+    UBaseType_t head;
+    UBaseType_t count;
+    bool is_static;
+};
+
+typedef struct shim_queue *QueueHandle_t;
+typedef struct shim_queue StaticQueue_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size);
+QueueHandle_t xQueueCreateStatic(UBaseType_t length,
+                                 UBaseType_t item_size,
+                                 uint8_t *storage,
+                                 StaticQueue_t *buffer);
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait);
+void vQueueDelete(QueueHandle_t queue);
+
+#ifdef __cplusplus
+}
+#endif
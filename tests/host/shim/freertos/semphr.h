@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <pthread.h>
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Binary semaphores and mutexes. As in FreeRTOS, giving a mutex the caller doesn't hold and
+ * giving a binary semaphore that is already available both fail. */
+struct shim_semaphore {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    bool available;
+    bool is_mutex;
+    bool held;
+    pthread_t holder;
+    bool is_static;
+};
+
+typedef struct shim_semaphore *SemaphoreHandle_t;
+typedef struct shim_semaphore StaticSemaphore_t;
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer);
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+void vSemaphoreDelete(SemaphoreHandle_t sem);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,38 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef void (*TaskFunction_t)(void *arg);
+typedef struct shim_task *TaskHandle_t;
+
+/* Tasks below this priority run at a nice value of the difference, so a low-priority task gets a
+ * smaller share of a CPU it shares with the test's own threads. FreeRTOS would not run it at all
+ * while a higher-priority task is ready; this is only as close as Linux comes without
+ * privileges. */
+#define SHIM_TASK_NICE_PRIORITY 19
+
+/* Runs fn on a detached thread; the stack size is ignored */
+BaseType_t xTaskCreate(TaskFunction_t fn,
+                       const char *name,
+                       uint32_t stack_size,
+                       void *arg,
+                       UBaseType_t priority,
+                       TaskHandle_t *handle);
+/* Only a task deleting itself (NULL) is supported */
+void vTaskDelete(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+
+#ifdef __cplusplus
+}
+#endif
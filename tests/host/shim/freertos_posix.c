@@ -0,0 +1,303 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+static void init_cond(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static struct timespec deadline_after(TickType_t ticks)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t ns = deadline.tv_nsec + (uint64_t) ticks * portTICK_PERIOD_MS * 1000000;
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec = ns % 1000000000;
+    return deadline;
+}
+
+/* Waits on cond until woken, or until the deadline unless ticks_to_wait is portMAX_DELAY.
+ * Returns false once the deadline has passed. */
+static bool wait_until(pthread_cond_t *cond,
+                       pthread_mutex_t *mutex,
+                       TickType_t ticks_to_wait,
+                       const struct timespec *deadline)
+{
+    if (ticks_to_wait == portMAX_DELAY)
+    {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+static void init_semaphore(struct shim_semaphore *sem, bool is_mutex, bool is_static)
+{
+    init_cond(&sem->cond);
+    pthread_mutex_init(&sem->mutex, NULL);
+
+    /* A mutex starts out available, a binary semaphore taken */
+    sem->available = is_mutex;
+    sem->is_mutex = is_mutex;
+    sem->held = false;
+    sem->is_static = is_static;
+}
+
+static SemaphoreHandle_t create_semaphore(bool is_mutex)
+{
+    struct shim_semaphore *sem = malloc(sizeof(*sem));
+    if (sem)
+    {
+        init_semaphore(sem, is_mutex, false);
+    }
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return create_semaphore(false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return create_semaphore(true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer)
+{
+    init_semaphore(buffer, false, true);
+    return buffer;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    init_semaphore(buffer, true, true);
+    return buffer;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&sem->mutex);
+    bool waiting = true;
+    while (!sem->available && waiting)
+    {
+        waiting = wait_until(&sem->cond, &sem->mutex, ticks_to_wait, &deadline);
+    }
+    bool taken = sem->available;
+    if (taken)
+    {
+        sem->available = false;
+        sem->held = sem->is_mutex;
+        sem->holder = pthread_self();
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->mutex);
+    bool given = sem->is_mutex ? (sem->held && pthread_equal(sem->holder, pthread_self()))
+                               : !sem->available;
+    if (given)
+    {
+        sem->available = true;
+        sem->held = false;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->mutex);
+    return given ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_cond_destroy(&sem->cond);
+    pthread_mutex_destroy(&sem->mutex);
+    if (!sem->is_static)
+    {
+        free(sem);
+    }
+}
+
+static void init_queue(struct shim_queue *queue,
+                       UBaseType_t length,
+                       UBaseType_t item_size,
+                       uint8_t *storage,
+                       bool is_static)
+{
+    init_cond(&queue->cond);
+    pthread_mutex_init(&queue->mutex, NULL);
+    queue->storage = storage;
+    queue->item_size = item_size;
+    queue->length = length;
+    queue->head = 0;
+    queue->count = 0;
+    queue->is_static = is_static;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    struct shim_queue *queue = malloc(sizeof(*queue) + (size_t) length * item_size);
+    if (queue)
+    {
+        init_queue(queue, length, item_size, (uint8_t *) (queue + 1), false);
+    }
+    return queue;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length,
+                                 UBaseType_t item_size,
+                                 uint8_t *storage,
+                                 StaticQueue_t *buffer)
+{
+    init_queue(buffer, length, item_size, storage, true);
+    return buffer;
+}
+
+/* Senders and receivers share the condition variable, so every change wakes all waiters */
+BaseType_t xQueueSendToBack(QueueHandle_t queue, const void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    bool waiting = (ticks_to_wait > 0);
+    while ((queue->count == queue->length) && waiting)
+    {
+        waiting = wait_until(&queue->cond, &queue->mutex, ticks_to_wait, &deadline);
+    }
+    bool sent = (queue->count < queue->length);
+    if (sent)
+    {
+        UBaseType_t tail = (queue->head + queue->count) % queue->length;
+        memcpy(queue->storage + tail * queue->item_size, item, queue->item_size);
+        queue->count++;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return sent ? pdTRUE : errQUEUE_FULL;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks_to_wait)
+{
+    struct timespec deadline = deadline_after(ticks_to_wait);
+
+    pthread_mutex_lock(&queue->mutex);
+    bool waiting = (ticks_to_wait > 0);
+    while ((queue->count == 0) && waiting)
+    {
+        waiting = wait_until(&queue->cond, &queue->mutex, ticks_to_wait, &deadline);
+    }
+    bool received = (queue->count > 0);
+    if (received)
+    {
+        memcpy(item, queue->storage + queue->head * queue->item_size, queue->item_size);
+        queue->head = (queue->head + 1) % queue->length;
+        queue->count--;
+        pthread_cond_broadcast(&queue->cond);
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return received ? pdTRUE : pdFALSE;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    pthread_cond_destroy(&queue->cond);
+    pthread_mutex_destroy(&queue->mutex);
+    if (!queue->is_static)
+    {
+        free(queue);
+    }
+}
+
+struct task_start {
+    TaskFunction_t fn;
+    void *arg;
+    UBaseType_t priority;
+};
+
+static void *run_task(void *arg)
+{
+    struct task_start start = *(struct task_start *) arg;
+    free(arg);
+    /* Linux nice values are per thread. Raising one needs no privileges. */
+    int nice = (start.priority < SHIM_TASK_NICE_PRIORITY) ? SHIM_TASK_NICE_PRIORITY - start.priority
+                                                          : 0;
+    setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), nice);
+    start.fn(start.arg);
+    return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn,
+                       const char *name,
+                       uint32_t stack_size,
+                       void *arg,
+                       UBaseType_t priority,
+                       TaskHandle_t *handle)
+{
+    (void) name;
+    (void) stack_size;
+
+    struct task_start *start = malloc(sizeof(*start));
+    if (!start)
+    {
+        return pdFAIL;
+    }
+    start->fn = fn;
+    start->arg = arg;
+    start->priority = priority;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, run_task, start) != 0)
+    {
+        free(start);
+        return pdFAIL;
+    }
+    pthread_detach(thread);
+    if (handle)
+    {
+        *handle = NULL;
+    }
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    if (task == NULL)
+    {
+        pthread_exit(NULL);
+    }
+    abort();
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    usleep((useconds_t) ticks * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t) (esp_timer_get_time() / (portTICK_PERIOD_MS * 1000));
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/* The parts of the Golioth client API the tested modules use. The client itself is faked by each
+ * test. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum golioth_status {
+    GOLIOTH_OK,
+    GOLIOTH_ERR_FAIL,
+    GOLIOTH_ERR_MEM_ALLOC,
+    GOLIOTH_ERR_NULL,
+    GOLIOTH_ERR_INVALID_FORMAT,
+    GOLIOTH_ERR_SERIALIZE,
+    GOLIOTH_ERR_IO,
+    GOLIOTH_ERR_TIMEOUT,
+    GOLIOTH_ERR_QUEUE_FULL,
+};
+
+enum golioth_content_type {
+    GOLIOTH_CONTENT_TYPE_JSON,
+    GOLIOTH_CONTENT_TYPE_CBOR,
+    GOLIOTH_CONTENT_TYPE_OCTET_STREAM,
+};
+
+struct golioth_client;
+
+struct golioth_response {
+    enum golioth_status status;
+    uint8_t status_class;
+    uint8_t status_code;
+};
+
+bool golioth_client_is_connected(struct golioth_client *client);
+
+typedef void (*golioth_set_cb_fn)(struct golioth_client *client,
+                                  const struct golioth_response *response,
+                                  const char *path,
+                                  void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#define GLTH_LOGE(tag, fmt, ...) fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define GLTH_LOGW(tag, fmt, ...) fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define GLTH_LOGI(tag, fmt, ...) fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define GLTH_LOGD(tag, fmt, ...) ((void) 0)
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "client.h"
+#include "sdkconfig.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define GOLIOTH_OTA_BLOCKSIZE 1024
+#define GOLIOTH_OTA_COMPONENT_BIN_HASH_LEN 32
+
+struct golioth_ota_component {
+    char package[CONFIG_GOLIOTH_OTA_MAX_PACKAGE_NAME_LEN + 1];
+    char version[CONFIG_GOLIOTH_OTA_MAX_VERSION_LEN + 1];
+    uint8_t hash[GOLIOTH_OTA_COMPONENT_BIN_HASH_LEN];
+    int32_t size;
+};
+
+typedef enum golioth_status (*ota_component_block_write_cb)(
+    const struct golioth_ota_component *component,
+    uint32_t block_idx,
+    uint8_t *block_buffer,
+    size_t block_buffer_len,
+    bool is_last,
+    void *arg);
+
+typedef void (*golioth_get_block_cb_fn)(struct golioth_client *client,
+                                        const struct golioth_response *response,
+                                        const char *path,
+                                        const uint8_t *payload,
+                                        size_t payload_size,
+                                        bool is_last,
+                                        void *arg);
+
+size_t golioth_ota_size_to_nblocks(size_t component_size);
+enum golioth_status golioth_ota_get_block_async(struct golioth_client *client,
+                                                const char *package,
+                                                const char *version,
+                                                size_t block_index,
+                                                golioth_get_block_cb_fn callback,
+                                                void *arg);
+
+#ifdef __cplusplus
+}
+#endif
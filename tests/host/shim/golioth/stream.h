@@ -0,0 +1,25 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include "client.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum golioth_status golioth_stream_set_async(struct golioth_client *client,
+                                             const char *path,
+                                             enum golioth_content_type content_type,
+                                             const uint8_t *buf,
+                                             size_t buf_len,
+                                             golioth_set_cb_fn callback,
+                                             void *callback_arg);
+
+#ifdef __cplusplus
+}
+#endif
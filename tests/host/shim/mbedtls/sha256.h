@@ -0,0 +1,45 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/* The mbedtls SHA-256 calls on the host's OpenSSL */
+
+#include <stddef.h>
+
+#include <openssl/evp.h>
+
+typedef struct {
+    EVP_MD_CTX *ctx;
+} mbedtls_sha256_context;
+
+static inline void mbedtls_sha256_init(mbedtls_sha256_context *sha)
+{
+    sha->ctx = EVP_MD_CTX_new();
+}
+
+/* SHA-224 isn't offered */
+static inline int mbedtls_sha256_starts(mbedtls_sha256_context *sha, int is224)
+{
+    return (is224 || !EVP_DigestInit_ex(sha->ctx, EVP_sha256(), NULL)) ? -1 : 0;
+}
+
+static inline int mbedtls_sha256_update(mbedtls_sha256_context *sha,
+                                        const unsigned char *input,
+                                        size_t len)
+{
+    return EVP_DigestUpdate(sha->ctx, input, len) ? 0 : -1;
+}
+
+static inline int mbedtls_sha256_finish(mbedtls_sha256_context *sha, unsigned char output[32])
+{
+    return EVP_DigestFinal_ex(sha->ctx, output, NULL) ? 0 : -1;
+}
+
+static inline void mbedtls_sha256_free(mbedtls_sha256_context *sha)
+{
+    EVP_MD_CTX_free(sha->ctx);
+}
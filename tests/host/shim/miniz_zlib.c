@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include "rom/miniz.h"
+
+/* Hands out memory from the decompressor's pool; zlib frees it all at once with the decompressor */
+static voidpf pool_alloc(voidpf opaque, uInt items, uInt size)
+{
+    tinfl_decompressor *r = opaque;
+    size_t len = ((size_t) items * size + 15) & ~(size_t) 15;
+    if (len > sizeof(r->pool) - r->pool_used)
+    {
+        return Z_NULL;
+    }
+    void *ptr = &r->pool[r->pool_used];
+    r->pool_used += len;
+    return ptr;
+}
+
+static void pool_free(voidpf opaque, voidpf ptr)
+{
+    (void) opaque;
+    (void) ptr;
+}
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r,
+                              const mz_uint8 *pIn_buf_next,
+                              size_t *pIn_buf_size,
+                              mz_uint8 *pOut_buf_start,
+                              mz_uint8 *pOut_buf_next,
+                              size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags)
+{
+    /* Only raw streams into a wrapping buffer, which is how model_inflate uses it */
+    size_t ring_size = (pOut_buf_next - pOut_buf_start) + *pOut_buf_size;
+    if ((decomp_flags & (TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF))
+        || (ring_size & (ring_size - 1)))
+    {
+        *pIn_buf_size = 0;
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_BAD_PARAM;
+    }
+    if (r->finished)
+    {
+        *pIn_buf_size = 0;
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_DONE;
+    }
+
+    if (!r->started)
+    {
+        int window_bits = 0;
+        while (((size_t) 1 << window_bits) < ring_size)
+        {
+            window_bits++;
+        }
+        r->stream = (z_stream){
+            .zalloc = pool_alloc,
+            .zfree = pool_free,
+            .opaque = r,
+        };
+        if (inflateInit2(&r->stream, -window_bits) != Z_OK)
+        {
+            return TINFL_STATUS_BAD_PARAM;
+        }
+        r->started = true;
+    }
+
+    /* The ROM inflater reads back references from the ring, which only works if output continues
+     * right after the previous call's */
+    if ((size_t) (pOut_buf_next - pOut_buf_start) != (r->stream.total_out & (ring_size - 1)))
+    {
+        *pIn_buf_size = 0;
+        *pOut_buf_size = 0;
+        return TINFL_STATUS_BAD_PARAM;
+    }
+
+    r->stream.next_in = (Bytef *) pIn_buf_next;
+    r->stream.avail_in = *pIn_buf_size;
+    r->stream.next_out = pOut_buf_next;
+    r->stream.avail_out = *pOut_buf_size;
+    int ret = inflate(&r->stream, Z_NO_FLUSH);
+    *pIn_buf_size -= r->stream.avail_in;
+    *pOut_buf_size -= r->stream.avail_out;
+
+    if (ret == Z_STREAM_END)
+    {
+        r->finished = true;
+        return TINFL_STATUS_DONE;
+    }
+    if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+    {
+        return TINFL_STATUS_FAILED;
+    }
+    return (r->stream.avail_out == 0) ? TINFL_STATUS_HAS_MORE_OUTPUT
+                                      : TINFL_STATUS_NEEDS_MORE_INPUT;
+}
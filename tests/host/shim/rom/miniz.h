@@ -0,0 +1,71 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/* The ESP32 ROM inflater API on top of zlib's raw inflate. Like the ROM tinfl, it writes into a
+ * wrapping output buffer whose size is a power of two. Where the ROM inflater would silently
+ * decode garbage, this one fails: the buffer size sets the window zlib accepts, so a stream that
+ * reaches back further fails, and so does output that doesn't continue where the previous call
+ * left off. All of zlib's state lives inside the decompressor, so nothing needs to be freed. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef uint8_t mz_uint8;
+typedef uint32_t mz_uint32;
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+enum {
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+};
+
+/* Room for zlib's inflate state and a 32 KB window */
+#define TINFL_SHIM_POOL_SIZE (48 * 1024)
+
+typedef struct {
+    z_stream stream;
+    bool started;
+    bool finished;
+    size_t pool_used;
+    _Alignas(16) uint8_t pool[TINFL_SHIM_POOL_SIZE];
+} tinfl_decompressor;
+
+#define tinfl_init(r)             \
+    do                            \
+    {                             \
+        (r)->started = false;     \
+        (r)->finished = false;    \
+        (r)->pool_used = 0;       \
+    } while (0)
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r,
+                              const mz_uint8 *pIn_buf_next,
+                              size_t *pIn_buf_size,
+                              mz_uint8 *pOut_buf_start,
+                              mz_uint8 *pOut_buf_next,
+                              size_t *pOut_buf_size,
+                              const mz_uint32 decomp_flags);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/* The Kconfig defaults the host tests build against. A test target may override any of them with
+ * a compile definition. */
+
+#ifndef CONFIG_RINGBUF_STATS
+#define CONFIG_RINGBUF_STATS 1
+#endif
+
+#ifndef CONFIG_AUDIO_CAPTURE_SAMPLE_RATE
+#define CONFIG_AUDIO_CAPTURE_SAMPLE_RATE 16000
+#endif
+
+/* The portable filter loop; esp-dsp only builds for the ESP32-S3 */
+#ifndef CONFIG_AUDIO_DECIMATOR_USE_ESP_DSP
+#define CONFIG_AUDIO_DECIMATOR_USE_ESP_DSP 0
+#endif
+
+#ifndef CONFIG_INFERENCE_CATCHUP_WINDOWS
+#define CONFIG_INFERENCE_CATCHUP_WINDOWS 8
+#endif
+
+#ifndef CONFIG_MODEL_CASCADE
+#define CONFIG_MODEL_CASCADE 1
+#endif
+
+#ifndef CONFIG_DETECTION_BATCH_SIZE
+#define CONFIG_DETECTION_BATCH_SIZE 16
+#endif
+
+#ifndef CONFIG_DETECTION_BATCH_MAX_AGE_MS
+#define CONFIG_DETECTION_BATCH_MAX_AGE_MS 30000
+#endif
+
+#ifndef CONFIG_DETECTION_URGENT_SCORE_PCT
+#define CONFIG_DETECTION_URGENT_SCORE_PCT 95
+#endif
+
+#ifndef CONFIG_MODEL_REGRESSION_GATE
+#define CONFIG_MODEL_REGRESSION_GATE 1
+#endif
+
+#ifndef CONFIG_MODEL_REGRESSION_MAX_ACCURACY_DROP_PCT
+#define CONFIG_MODEL_REGRESSION_MAX_ACCURACY_DROP_PCT 2
+#endif
+
+#ifndef CONFIG_MODEL_REGRESSION_MAX_LATENCY_PCT
+#define CONFIG_MODEL_REGRESSION_MAX_LATENCY_PCT 120
+#endif
+
+#ifndef CONFIG_MODEL_REGRESSION_MAX_ARENA_GROWTH
+#define CONFIG_MODEL_REGRESSION_MAX_ARENA_GROWTH 4096
+#endif
+
+#ifndef CONFIG_MODEL_DOWNLOAD_TASK_PRIORITY
+#define CONFIG_MODEL_DOWNLOAD_TASK_PRIORITY 1
+#endif
+
+#ifndef CONFIG_MODEL_DOWNLOAD_WINDOW
+#define CONFIG_MODEL_DOWNLOAD_WINDOW 4
+#endif
+
+#ifndef CONFIG_MODEL_DOWNLOAD_BLOCK_DELAY_MS
+#define CONFIG_MODEL_DOWNLOAD_BLOCK_DELAY_MS 0
+#endif
+
+#ifndef CONFIG_MODEL_DOWNLOAD_MAX_WRITE_RATE
+#define CONFIG_MODEL_DOWNLOAD_MAX_WRITE_RATE 0
+#endif
+
+#ifndef CONFIG_MODEL_DOWNLOAD_PREALLOCATE
+#define CONFIG_MODEL_DOWNLOAD_PREALLOCATE 1
+#endif
+
+#ifndef CONFIG_MODEL_LOAD_DIRECT_READ
+#define CONFIG_MODEL_LOAD_DIRECT_READ 1
+#endif
+
+#if !defined(CONFIG_MODEL_DATA_PLACEMENT_INTERNAL) && !defined(CONFIG_MODEL_DATA_PLACEMENT_PSRAM)
+#define CONFIG_MODEL_DATA_PLACEMENT_AUTO 1
+#endif
+
+#ifndef CONFIG_MODEL_DATA_INTERNAL_MAX_SIZE
+#define CONFIG_MODEL_DATA_INTERNAL_MAX_SIZE 32768
+#endif
+
+#ifndef CONFIG_MODEL_DATA_INTERNAL_RESERVE
+#define CONFIG_MODEL_DATA_INTERNAL_RESERVE 49152
+#endif
+
+#define CONFIG_GOLIOTH_OTA_MAX_PACKAGE_NAME_LEN 64
+#define CONFIG_GOLIOTH_OTA_MAX_VERSION_LEN 64
+#define CONFIG_GOLIOTH_OTA_MAX_NUM_COMPONENTS 4
@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+/* The status type of TensorFlow Lite, for modules that return it but don't use TFLM */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum TfLiteStatus {
+    kTfLiteOk = 0,
+    kTfLiteError = 1,
+} TfLiteStatus;
+
+#ifdef __cplusplus
+}
+#endif
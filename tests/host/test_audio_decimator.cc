@@ -0,0 +1,182 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// The decimation filter with the portable C loop, built once per capture rate:
+// gain in the pass band, attenuation of what would alias, streaming across
+// blocks, and the cost of one capture read on the host.
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "audio_decimator.h"
+#include "deferred_log.h"
+#include "esp_timer.h"
+#include "micro_model_settings.h"
+#include "test_util.h"
+
+namespace {
+constexpr int kReadSamples = kAudioCaptureRawReadSize / sizeof(int16_t);
+constexpr float kAmplitude = 10000.0f;
+
+int g_stats_logged = 0;
+
+std::vector<int16_t> Sine(float hz, int samples) {
+  std::vector<int16_t> signal(samples);
+  for (int n = 0; n < samples; n++) {
+    signal[n] = static_cast<int16_t>(std::lround(
+        kAmplitude * std::sin(2.0 * M_PI * hz * n / kAudioCaptureSampleRate)));
+  }
+  return signal;
+}
+
+// Decimates |input| in blocks of |block| samples.
+std::vector<int16_t> Decimate(const std::vector<int16_t>& input, int block) {
+  CHECK(InitAudioDecimator() == kTfLiteOk);
+  std::vector<int16_t> output(input.size() / kAudioDecimationFactor);
+  int produced = 0;
+  for (size_t pos = 0; pos + block <= input.size(); pos += block) {
+    produced += DecimateAudio(&input[pos], block, &output[produced]);
+  }
+  output.resize(produced);
+  return output;
+}
+
+// Gain in dB of a sine at |hz| through the filter, after the filter settled.
+float GainDb(float hz) {
+  std::vector<int16_t> output = Decimate(Sine(hz, 25 * kReadSamples),
+                                         kReadSamples);
+  double sum = 0;
+  int count = 0;
+  for (size_t i = kAudioSampleFrequency / 50; i < output.size(); i++) {
+    sum += static_cast<double>(output[i]) * output[i];
+    count++;
+  }
+  const double amplitude = std::sqrt(2.0 * sum / count);
+  return 20.0f * std::log10(std::max(amplitude, 0.5) / kAmplitude);
+}
+
+void TestPassBand() {
+  // Up to 6 kHz; the roll-off towards the 7.2 kHz cutoff starts above that.
+  static const float kFrequencies[] = {100, 1000, 4000, 6000};
+  for (float hz : kFrequencies) {
+    const float gain = GainDb(hz);
+    printf("%5.0f Hz: %6.2f dB\n", hz, gain);
+    CHECK(std::fabs(gain) < 1.0f);
+  }
+}
+
+void TestStopBand() {
+  // Everything from the model's Nyquist frequency up would alias into the
+  // spectrogram; the filter's transition band ends by 10 kHz.
+  float worst = -200;
+  for (float hz = 10000; hz < kAudioCaptureSampleRate / 2; hz += 250) {
+    worst = std::max(worst, GainDb(hz));
+  }
+  printf("stop band from 10 kHz: at most %.1f dB\n", worst);
+  CHECK(worst < -50.0f);
+}
+
+void TestBlocksCarryState() {
+  // Whole capture reads and smaller pieces of them give the same output.
+  const std::vector<int16_t> input = Sine(440, 10 * kReadSamples);
+  const std::vector<int16_t> whole = Decimate(input, kReadSamples);
+  const std::vector<int16_t> pieces =
+      Decimate(input, 10 * kAudioDecimationFactor);
+  CHECK(whole.size() == input.size() / kAudioDecimationFactor);
+  CHECK(whole == pieces);
+}
+
+void TestInPlace() {
+  const std::vector<int16_t> input = Sine(1000, kReadSamples);
+  const std::vector<int16_t> expected = Decimate(input, kReadSamples);
+  std::vector<int16_t> buffer = input;
+  CHECK(InitAudioDecimator() == kTfLiteOk);
+  CHECK(DecimateAudio(buffer.data(), kReadSamples, buffer.data()) ==
+        kReadSamples / kAudioDecimationFactor);
+  buffer.resize(expected.size());
+  CHECK(buffer == expected);
+}
+
+void TestFullScale() {
+  // A full-scale square wave overshoots at its edges. Those outputs saturate
+  // instead of wrapping around: they follow the output for half the amplitude,
+  // doubled and clamped.
+  std::vector<int16_t> full(4 * kReadSamples);
+  std::vector<int16_t> half(full.size());
+  for (size_t n = 0; n < full.size(); n++) {
+    const bool high = (n / (kAudioCaptureSampleRate / 100)) % 2;
+    full[n] = high ? INT16_MAX : INT16_MIN + 1;
+    half[n] = high ? INT16_MAX / 2 : -INT16_MAX / 2;
+  }
+  const std::vector<int16_t> full_out = Decimate(full, kReadSamples);
+  const std::vector<int16_t> half_out = Decimate(half, kReadSamples);
+  int saturated = 0;
+  for (size_t i = 0; i < full_out.size(); i++) {
+    const int expected =
+        std::clamp(2 * half_out[i], int{INT16_MIN}, int{INT16_MAX});
+    CHECK(std::abs(full_out[i] - expected) <= 4);
+    saturated += std::abs(expected) == INT16_MAX;
+  }
+  CHECK(saturated > 0);
+}
+
+void TestBenchmark() {
+  const std::vector<int16_t> input = Sine(1000, kReadSamples);
+  std::vector<int16_t> output(kReadSamples);
+  CHECK(InitAudioDecimator() == kTfLiteOk);
+  constexpr int kBlocks = 5000;
+  g_stats_logged = 0;
+  const int64_t start_us = esp_timer_get_time();
+  for (int i = 0; i < kBlocks; i++) {
+    DecimateAudio(input.data(), kReadSamples, output.data());
+  }
+  const int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+  const double block_ns = elapsed_us * 1000.0 / kBlocks;
+  const int taps = 16 * kAudioDecimationFactor;
+  const int outputs = kReadSamples / kAudioDecimationFactor;
+  printf("%d Hz -> %d Hz, %d taps: %.0f ns per %d ms read, %.1f ns per output "
+         "sample, %.3f%% of real time; group delay %.2f ms\n",
+         kAudioCaptureSampleRate, kAudioSampleFrequency, taps, block_ns,
+         kAudioCaptureReadMs, block_ns / outputs,
+         block_ns / (kAudioCaptureReadMs * 1e6) * 100,
+         (taps - 1) / 2.0 * 1000 / kAudioCaptureSampleRate);
+  // The per-block cost is reported through the deferred log, every 500 blocks
+  // counting those of earlier cases in the same process.
+  CHECK(g_stats_logged >= kBlocks / 500 && g_stats_logged <= kBlocks / 500 + 1);
+}
+
+const test_case kCases[] = {
+    {"pass_band", TestPassBand},
+    {"stop_band", TestStopBand},
+    {"blocks_carry_state", TestBlocksCarryState},
+    {"in_place", TestInPlace},
+    {"full_scale", TestFullScale},
+    {"benchmark", TestBenchmark},
+};
+}  // namespace
+
+extern "C" void deferred_log(enum deferred_log_id id, int32_t arg0,
+                             int32_t arg1) {
+  if (id == DLOG_DECIMATOR_STATS) {
+    g_stats_logged++;
+  }
+}
+
+int main(int argc, char** argv) {
+  return run_test_cases(kCases, sizeof(kCases) / sizeof(kCases[0]), argc,
+                        argv);
+}
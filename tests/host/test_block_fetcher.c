@@ -0,0 +1,262 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* block_fetcher against the fake Golioth client of fake_ota_server.c */
+
+#include <inttypes.h>
+
+#include "block_fetcher.h"
+#include "esp_timer.h"
+#include "fake_ota_server.h"
+#include "test_util.h"
+
+struct written {
+    /* Block whose write fails, or -1 */
+    int error_block;
+    uint32_t next_block;
+    size_t bytes;
+    bool corrupt;
+    bool saw_last;
+};
+
+static enum golioth_status write_block(const struct golioth_ota_component *component,
+                                       uint32_t block_idx,
+                                       uint8_t *block_buffer,
+                                       size_t block_buffer_len,
+                                       bool is_last,
+                                       void *arg)
+{
+    struct written *w = arg;
+    if ((int) block_idx == w->error_block)
+    {
+        return GOLIOTH_ERR_IO;
+    }
+    w->corrupt |= (block_idx != w->next_block) || w->saw_last;
+    for (size_t i = 0; i < block_buffer_len; i++)
+    {
+        w->corrupt |= (block_buffer[i] != server_block_byte(block_idx, i));
+    }
+    w->next_block++;
+    w->bytes += block_buffer_len;
+    w->saw_last |= is_last;
+    return GOLIOTH_OK;
+}
+
+/* Downloads a component of config.size bytes and returns the status and the time it took. Writing
+ * error_block fails, unless it is -1. */
+static enum golioth_status download(const struct server_config *config,
+                                    int window,
+                                    int error_block,
+                                    struct written *w,
+                                    int64_t *elapsed_us)
+{
+    struct golioth_ota_component component = {
+        .package = "model",
+        .version = "1.0.0",
+        .size = config->size,
+    };
+    *w = (struct written){.error_block = error_block};
+    int64_t start_us = esp_timer_get_time();
+    enum golioth_status status = block_fetcher_download(NULL, &component, window, write_block, w);
+    if (elapsed_us)
+    {
+        *elapsed_us = esp_timer_get_time() - start_us;
+    }
+    return status;
+}
+
+/* Checks that every block of the component was written once, in order and intact */
+static void check_complete(const struct written *w, int32_t size)
+{
+    CHECK(!w->corrupt);
+    CHECK(w->saw_last);
+    CHECK(w->next_block == golioth_ota_size_to_nblocks(size));
+    CHECK(w->bytes == (size_t) size);
+}
+
+static void test_in_order_with_jitter(void)
+{
+    struct server_config config = {
+        .size = 64 * GOLIOTH_OTA_BLOCKSIZE - 300,
+        .queue_size = 10,
+        .rtt_ms = 5,
+        .jitter_ms = 4,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    server_start(config);
+    struct written w;
+    int requests = server_requests();
+    CHECK(download(&config, BLOCK_FETCHER_MAX_WINDOW, -1, &w, NULL) == GOLIOTH_OK);
+    server_stop();
+    check_complete(&w, config.size);
+    CHECK(server_requests() - requests == 64);
+}
+
+static void test_window_speedup(void)
+{
+    struct server_config config = {
+        .size = 100 * GOLIOTH_OTA_BLOCKSIZE,
+        .queue_size = 10,
+        .rtt_ms = 10,
+        .jitter_ms = 2,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    server_start(config);
+    int64_t elapsed_us[2];
+    static const int windows[] = {1, BLOCK_FETCHER_MAX_WINDOW};
+    for (int i = 0; i < 2; i++)
+    {
+        struct written w;
+        CHECK(download(&config, windows[i], -1, &w, &elapsed_us[i]) == GOLIOTH_OK);
+        check_complete(&w, config.size);
+        printf("window %d: %d blocks in %" PRId64 " ms at %d ms RTT, %" PRId64 " KB/s\n",
+               windows[i],
+               100,
+               elapsed_us[i] / 1000,
+               config.rtt_ms,
+               (int64_t) config.size * 1000 / elapsed_us[i]);
+    }
+    server_stop();
+    printf("speedup %.1fx\n", (double) elapsed_us[0] / elapsed_us[1]);
+    /* Eight requests in flight hide most of the round trip */
+    CHECK(elapsed_us[0] > 4 * elapsed_us[1]);
+}
+
+static void test_retries_failed_block(void)
+{
+    /* Three failures are retried; the fourth request of the block succeeds */
+    struct server_config config = {
+        .size = 20 * GOLIOTH_OTA_BLOCKSIZE,
+        .queue_size = 10,
+        .rtt_ms = 2,
+        .fail_block = 5,
+        .fail_times = 3,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    server_start(config);
+    struct written w;
+    int requests = server_requests();
+    CHECK(download(&config, 4, -1, &w, NULL) == GOLIOTH_OK);
+    server_stop();
+    check_complete(&w, config.size);
+    CHECK(server_requests() - requests == 20 + 3);
+}
+
+static void test_fails_after_max_retries(void)
+{
+    struct server_config config = {
+        .size = 20 * GOLIOTH_OTA_BLOCKSIZE,
+        .queue_size = 10,
+        .rtt_ms = 2,
+        .fail_block = 5,
+        .fail_times = 4,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    server_start(config);
+    struct written w;
+    CHECK(download(&config, 4, -1, &w, NULL) == GOLIOTH_ERR_TIMEOUT);
+    server_stop();
+    /* Nothing after the failed block is passed on */
+    CHECK(!w.corrupt);
+    CHECK(w.next_block == 5);
+}
+
+static void test_full_queue_not_a_retry(void)
+{
+    /* The client refuses four requests of the failing block between its two failures; they never
+     * reach the server and don't count against its three retries */
+    struct server_config config = {
+        .size = 40 * GOLIOTH_OTA_BLOCKSIZE,
+        .queue_size = 10,
+        .rtt_ms = 2,
+        .fail_block = 5,
+        .fail_times = 2,
+        .refuse_times = 4,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    server_start(config);
+    struct written w;
+    int requests = server_requests();
+    CHECK(download(&config, BLOCK_FETCHER_MAX_WINDOW, -1, &w, NULL) == GOLIOTH_OK);
+    int refused = server_refused();
+    server_stop();
+    check_complete(&w, config.size);
+    CHECK(server_requests() - requests == 40 + 2);
+    CHECK(refused == 4);
+}
+
+static void test_full_queue_window(void)
+{
+    /* A client queue of two under a window of eight */
+    struct server_config config = {
+        .size = 40 * GOLIOTH_OTA_BLOCKSIZE,
+        .queue_size = 2,
+        .rtt_ms = 2,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    server_start(config);
+    struct written w;
+    int requests = server_requests();
+    CHECK(download(&config, BLOCK_FETCHER_MAX_WINDOW, -1, &w, NULL) == GOLIOTH_OK);
+    server_stop();
+    check_complete(&w, config.size);
+    CHECK(server_requests() - requests == 40);
+}
+
+static void test_ignores_late_response(void)
+{
+    /* The response to block 3 of the first download is held back past the response timeout and
+     * only delivered while the next download is requesting block 10 */
+    struct server_config config = {
+        .size = 30 * GOLIOTH_OTA_BLOCKSIZE,
+        .queue_size = 10,
+        .rtt_ms = 2,
+        .fail_block = -1,
+        .hold_block = 3,
+        .release_block = 10,
+        .slow_block = 20,
+    };
+    server_start(config);
+    struct written w;
+    CHECK(download(&config, 4, -1, &w, NULL) == GOLIOTH_ERR_TIMEOUT);
+    CHECK(!w.corrupt);
+    CHECK(w.next_block == 3);
+
+    /* The next download stops at a write error while block 20 is still in flight. Had the late
+     * response counted against that download, its slots would be freed before block 20 completed,
+     * which AddressSanitizer reports. */
+    CHECK(download(&config, BLOCK_FETCHER_MAX_WINDOW, 15, &w, NULL) == GOLIOTH_ERR_IO);
+    CHECK(!w.corrupt);
+    CHECK(w.next_block == 15);
+    CHECK(download(&config, BLOCK_FETCHER_MAX_WINDOW, -1, &w, NULL) == GOLIOTH_OK);
+    server_stop();
+    check_complete(&w, config.size);
+    CHECK(server_all_answered());
+}
+
+static const struct test_case cases[] = {
+    {"in_order_with_jitter", test_in_order_with_jitter},
+    {"window_speedup", test_window_speedup},
+    {"retries_failed_block", test_retries_failed_block},
+    {"fails_after_max_retries", test_fails_after_max_retries},
+    {"full_queue_not_a_retry", test_full_queue_not_a_retry},
+    {"full_queue_window", test_full_queue_window},
+    {"ignores_late_response", test_ignores_late_response},
+};
+
+int main(int argc, char **argv)
+{
+    return run_test_cases(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
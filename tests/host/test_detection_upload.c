@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* detection_upload with the zcbor encoder against a CoAP stand-in: golioth_stream_set_async()
+ * decodes and keeps every payload, and counts the bytes a CoAP request over DTLS would take for
+ * it, so batching can be compared with one request per detection. */
+
+#include <unistd.h>
+
+#include "detection_upload.h"
+#include "freertos/FreeRTOS.h"
+#include "golioth/stream.h"
+#include "main_functions.h"
+#include "test_util.h"
+
+/* Per request: CoAP header and 8 byte token (12), Uri-Path "detections" (11), Content-Format (2),
+ * payload marker (1), and a DTLS 1.2 record with AES-128-CCM-8 (13 + 8 + 8) */
+#define COAP_DTLS_OVERHEAD 55
+
+#define MAX_ENTRIES 64
+
+struct entry {
+    int64_t timestamp_ms;
+    uint64_t model;
+    char label[32];
+    uint64_t score_pct;
+};
+
+struct message {
+    struct entry entries[MAX_ENTRIES];
+    size_t count;
+    size_t len;
+};
+
+static struct {
+    bool connected;
+    int fail_next;
+    struct message messages[64];
+    int count;
+    size_t wire_bytes;
+} coap = {.connected = true};
+
+static struct {
+    int64_t batches;
+    int64_t bytes;
+    int64_t dropped;
+} metrics;
+
+void app_metrics_add(const char *name, int64_t delta)
+{
+    if (strcmp(name, "detection_batches") == 0)
+    {
+        metrics.batches += delta;
+    }
+    else if (strcmp(name, "detection_bytes") == 0)
+    {
+        metrics.bytes += delta;
+    }
+    else if (strcmp(name, "detections_dropped") == 0)
+    {
+        metrics.dropped += delta;
+    }
+}
+
+bool golioth_client_is_connected(struct golioth_client *client)
+{
+    return coap.connected;
+}
+
+/* Reads the head of a CBOR item; an indefinite length is returned as UINT64_MAX */
+static bool cbor_head(const uint8_t **p, const uint8_t *end, int *major, uint64_t *value)
+{
+    if (*p >= end)
+    {
+        return false;
+    }
+    *major = **p >> 5;
+    uint8_t info = *(*p)++ & 0x1f;
+    if (info < 24)
+    {
+        *value = info;
+        return true;
+    }
+    if (info == 31)
+    {
+        *value = UINT64_MAX;
+        return true;
+    }
+    if ((info > 27) || (end - *p < (1 << (info - 24))))
+    {
+        return false;
+    }
+    *value = 0;
+    for (int i = 0; i < (1 << (info - 24)); i++)
+    {
+        *value = (*value << 8) | *(*p)++;
+    }
+    return true;
+}
+
+/* Consumes the end of an array of the given length: the break byte of an indefinite one */
+static bool cbor_array_end(const uint8_t **p, const uint8_t *end, uint64_t len, size_t count)
+{
+    if (len == UINT64_MAX)
+    {
+        return (*p < end) && (*(*p)++ == 0xff);
+    }
+    return count == len;
+}
+
+static bool cbor_more(const uint8_t *p, const uint8_t *end, uint64_t len, size_t count)
+{
+    return (len == UINT64_MAX) ? ((p < end) && (*p != 0xff)) : (count < len);
+}
+
+/* Decodes an array of [timestamp_ms, model, label, score_pct] arrays */
+static bool decode(const uint8_t *p, size_t len, struct message *m)
+{
+    const uint8_t *end = p + len;
+    int major;
+    uint64_t outer;
+    if (!cbor_head(&p, end, &major, &outer) || (major != 4))
+    {
+        return false;
+    }
+    m->count = 0;
+    while (cbor_more(p, end, outer, m->count))
+    {
+        struct entry *e = &m->entries[m->count++];
+        uint64_t inner, value;
+        if ((m->count > MAX_ENTRIES) || !cbor_head(&p, end, &major, &inner) || (major != 4))
+        {
+            return false;
+        }
+        if (!cbor_head(&p, end, &major, &value) || (major > 1))
+        {
+            return false;
+        }
+        e->timestamp_ms = (major == 0) ? (int64_t) value : -1 - (int64_t) value;
+        if (!cbor_head(&p, end, &major, &e->model) || (major != 0))
+        {
+            return false;
+        }
+        if (!cbor_head(&p, end, &major, &value) || (major != 3) || (value >= sizeof(e->label))
+            || (end - p < (ptrdiff_t) value))
+        {
+            return false;
+        }
+        memcpy(e->label, p, value);
+        e->label[value] = '\0';
+        p += value;
+        if (!cbor_head(&p, end, &major, &e->score_pct) || (major != 0)
+            || !cbor_array_end(&p, end, inner, 4))
+        {
+            return false;
+        }
+    }
+    return cbor_array_end(&p, end, outer, m->count) && (p == end);
+}
+
+enum golioth_status golioth_stream_set_async(struct golioth_client *client,
+                                             const char *path,
+                                             enum golioth_content_type content_type,
+                                             const uint8_t *buf,
+                                             size_t buf_len,
+                                             golioth_set_cb_fn callback,
+                                             void *callback_arg)
+{
+    CHECK(strcmp(path, DETECTION_STREAM_PATH) == 0);
+    CHECK(content_type == GOLIOTH_CONTENT_TYPE_CBOR);
+    if (coap.fail_next > 0)
+    {
+        coap.fail_next--;
+        return GOLIOTH_ERR_QUEUE_FULL;
+    }
+    CHECK(coap.count < (int) (sizeof(coap.messages) / sizeof(coap.messages[0])));
+    struct message *m = &coap.messages[coap.count++];
+    CHECK(decode(buf, buf_len, m));
+    m->len = buf_len;
+    coap.wire_bytes += buf_len + COAP_DTLS_OVERHEAD;
+    return GOLIOTH_OK;
+}
+
+/* Any non-NULL client; the stand-in doesn't look at it */
+static struct golioth_client *const client = (struct golioth_client *) &coap;
+
+static void add(int32_t timestamp_ms, int model, const char *label, float score)
+{
+    struct tf_result result = {
+        .model = model,
+        .timestamp_ms = timestamp_ms,
+        .count = 1,
+        .top = {{.label = 2, .score = score}},
+    };
+    detection_upload_add(&result, label);
+}
+
+static void test_batches_when_full(void)
+{
+    detection_upload_start(client);
+    for (int i = 0; i < CONFIG_DETECTION_BATCH_SIZE - 1; i++)
+    {
+        add(1000 + 20 * i, i % 2, "yes", 0.8f);
+    }
+    CHECK(coap.count == 0);
+    add(5000, 1, "no", 0.8f);
+    CHECK(coap.count == 1);
+
+    const struct message *m = &coap.messages[0];
+    CHECK(m->count == CONFIG_DETECTION_BATCH_SIZE);
+    CHECK(m->entries[0].timestamp_ms == 1000);
+    CHECK(m->entries[1].timestamp_ms == 1020);
+    CHECK(m->entries[1].model == 1);
+    CHECK(strcmp(m->entries[0].label, "yes") == 0);
+    CHECK(m->entries[0].score_pct == 80);
+    CHECK(strcmp(m->entries[CONFIG_DETECTION_BATCH_SIZE - 1].label, "no") == 0);
+    CHECK(metrics.batches == 1);
+    CHECK(metrics.bytes == (int64_t) m->len);
+}
+
+static void test_urgent_sends_at_once(void)
+{
+    detection_upload_start(client);
+    add(100, 0, "yes", 0.5f);
+    add(200, 0, "no", 0.94f);
+    CHECK(coap.count == 0);
+    add(300, 0, "yes", 0.95f);
+    CHECK(coap.count == 1);
+    CHECK(coap.messages[0].count == 3);
+    CHECK(coap.messages[0].entries[2].score_pct == 95);
+}
+
+static void test_sends_by_age(void)
+{
+    detection_upload_start(client);
+    add(100, 0, "yes", 0.5f);
+    add(200, 0, "no", 0.5f);
+    detection_upload_poll();
+    CHECK(coap.count == 0);
+    usleep((CONFIG_DETECTION_BATCH_MAX_AGE_MS + 50) * 1000);
+    detection_upload_poll();
+    CHECK(coap.count == 1);
+    CHECK(coap.messages[0].count == 2);
+    detection_upload_poll();
+    CHECK(coap.count == 1);
+}
+
+static void test_keeps_batch_offline(void)
+{
+    /* Nothing is sent before the client is started or while it is disconnected */
+    add(100, 0, "yes", 0.99f);
+    CHECK(coap.count == 0);
+    detection_upload_start(client);
+    coap.connected = false;
+    for (int i = 1; i < CONFIG_DETECTION_BATCH_SIZE + 4; i++)
+    {
+        add(100 + i, 0, "yes", 0.5f);
+    }
+    CHECK(coap.count == 0);
+    CHECK(metrics.dropped == 4);
+
+    /* The full batch goes out before the next detection is added */
+    coap.connected = true;
+    add(1000, 0, "no", 0.5f);
+    CHECK(coap.count == 1);
+    CHECK(coap.messages[0].count == CONFIG_DETECTION_BATCH_SIZE);
+    CHECK(coap.messages[0].entries[0].score_pct == 99);
+    add(1100, 0, "no", 0.99f);
+    CHECK(coap.count == 2);
+    CHECK(coap.messages[1].count == 2);
+}
+
+static void test_retries_failed_send(void)
+{
+    detection_upload_start(client);
+    coap.fail_next = 1;
+    add(100, 0, "yes", 0.99f);
+    CHECK(coap.count == 0);
+    CHECK(metrics.batches == 0);
+    add(200, 0, "yes", 0.99f);
+    CHECK(coap.count == 1);
+    CHECK(coap.messages[0].count == 2);
+    CHECK(metrics.dropped == 0);
+}
+
+static void test_longest_entries_fit(void)
+{
+    /* Five byte timestamps, two byte model indexes and scores, and labels longer than kept. The
+     * last score is out of range and clamped, which also sends the full batch. */
+    detection_upload_start(client);
+    for (int i = 0; i < CONFIG_DETECTION_BATCH_SIZE; i++)
+    {
+        float score = (i == CONFIG_DETECTION_BATCH_SIZE - 1) ? 2.0f : 0.9f;
+        add(INT32_MIN + i, 255, "a_very_long_keyword_label", score);
+    }
+    CHECK(coap.count == 1);
+    CHECK(metrics.dropped == 0);
+    const struct message *m = &coap.messages[0];
+    CHECK(m->count == CONFIG_DETECTION_BATCH_SIZE);
+    CHECK(m->entries[0].timestamp_ms == INT32_MIN);
+    CHECK(m->entries[0].model == 255);
+    CHECK(m->entries[0].score_pct == 90);
+    CHECK(m->entries[CONFIG_DETECTION_BATCH_SIZE - 1].score_pct == 100);
+    CHECK(strcmp(m->entries[0].label, "a_very_long_keyw") == 0);
+    printf("largest batch: %zu bytes\n", m->len);
+}
+
+static void test_batching_saves_bytes(void)
+{
+    /* The same 64 detections as urgent ones, each in a request of its own, and batched */
+    detection_upload_start(client);
+    static const char *const labels[] = {"yes", "no", "stop", "go"};
+    for (int i = 0; i < 64; i++)
+    {
+        add(60000 + 1000 * i, 0, labels[i % 4], 0.97f);
+    }
+    int single_count = coap.count;
+    size_t single_bytes = coap.wire_bytes;
+
+    coap.count = 0;
+    coap.wire_bytes = 0;
+    for (int i = 0; i < 64; i++)
+    {
+        add(60000 + 1000 * i, 0, labels[i % 4], 0.87f);
+    }
+    printf("64 detections: %d requests, %zu bytes one by one; %d requests, %zu bytes in batches "
+           "of %d\n",
+           single_count,
+           single_bytes,
+           coap.count,
+           coap.wire_bytes,
+           CONFIG_DETECTION_BATCH_SIZE);
+    CHECK(single_count == 64);
+    CHECK(coap.count == 64 / CONFIG_DETECTION_BATCH_SIZE);
+    CHECK(coap.wire_bytes * 3 < single_bytes);
+}
+
+static const struct test_case cases[] = {
+    {"batches_when_full", test_batches_when_full},
+    {"urgent_sends_at_once", test_urgent_sends_at_once},
+    {"sends_by_age", test_sends_by_age},
+    {"keeps_batch_offline", test_keeps_batch_offline},
+    {"retries_failed_send", test_retries_failed_send},
+    {"longest_entries_fit", test_longest_entries_fit},
+    {"batching_saves_bytes", test_batching_saves_bytes},
+};
+
+int main(int argc, char **argv)
+{
+    /* The module keeps its batch across cases, so each runs in a process of its own */
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s <test case>\n", argv[0]);
+        return 1;
+    }
+    return run_test_cases(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,315 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* download_service against the fake Golioth client of fake_ota_server.c, storing to a directory
+ * in the build tree that stands in for the SD card. The stride case runs a 20 ms stride consumer,
+ * standing in for the inference loop, on one thread while the download task runs on another, both
+ * on one CPU, and bounds how late the strides start and how far they fall behind. */
+
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "app_metrics.h"
+#include "download_service.h"
+#include "fake_ota_server.h"
+#include "freertos/semphr.h"
+#include "mbedtls/sha256.h"
+#include "test_util.h"
+
+#define STRIDE_MS 20
+/* The work of one stride: features, invoke and the scores */
+#define STRIDE_WORK_MS 5
+#define MAX_STRIDES 2000
+
+/* Strides may start this late at the 99th percentile, half the stride. A host thread that
+ * sleeps on an idle CPU already wakes over 5 ms late for about one stride in a hundred. */
+#define MAX_P99_JITTER_US (STRIDE_MS * 1000 / 2)
+/* Enough strides for the 99th percentile to leave out the two latest */
+#define MIN_STRIDES 150
+/* Blocks of the component downloaded while the strides run */
+#define STRIDE_CASE_BLOCKS 256
+
+static SemaphoreHandle_t ready;
+static char ready_path[128];
+static int64_t download_ms = -1;
+
+void app_metrics_set(const char *name, int64_t value)
+{
+    if (strcmp(name, "model_download_ms") == 0)
+    {
+        download_ms = value;
+    }
+}
+
+static void on_ready(const struct golioth_ota_component *component, const char *path)
+{
+    snprintf(ready_path, sizeof(ready_path), "%s", path);
+    xSemaphoreGive(ready);
+}
+
+/* The service has no stop, so the cases of a process share one */
+static void start_service(void)
+{
+    static bool started;
+    if (!started)
+    {
+        ready = xSemaphoreCreateBinary();
+        download_service_init(SD_DIR, NULL, on_ready);
+        download_service_start(NULL);
+        started = true;
+    }
+}
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Random content for a component of size bytes, and its manifest entry */
+static uint8_t *make_component(const char *package,
+                               int32_t size,
+                               struct golioth_ota_component *component)
+{
+    uint8_t *data = malloc(size);
+    CHECK(data);
+    for (int32_t i = 0; i < size; i++)
+    {
+        data[i] = (uint8_t) rand();
+    }
+
+    *component = (struct golioth_ota_component){.size = size};
+    snprintf(component->package, sizeof(component->package), "%s", package);
+    snprintf(component->version, sizeof(component->version), "1.0.0");
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    CHECK(mbedtls_sha256_starts(&sha, 0) == 0);
+    CHECK(mbedtls_sha256_update(&sha, data, size) == 0);
+    CHECK(mbedtls_sha256_finish(&sha, component->hash) == 0);
+    mbedtls_sha256_free(&sha);
+    return data;
+}
+
+static void check_stored(const char *path, const uint8_t *data, int32_t size)
+{
+    FILE *f = fopen(path, "r");
+    CHECK(f);
+    uint8_t *stored = malloc(size + 1);
+    CHECK(stored);
+    CHECK(fread(stored, 1, size + 1, f) == (size_t) size);
+    fclose(f);
+    CHECK(memcmp(stored, data, size) == 0);
+    free(stored);
+}
+
+static bool exists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static void test_stores_verified_artifact(void)
+{
+    start_service();
+    struct golioth_ota_component component;
+    uint8_t *data = make_component("stored", 20 * GOLIOTH_OTA_BLOCKSIZE - 300, &component);
+    struct server_config config = {
+        .size = component.size,
+        .data = data,
+        .queue_size = 10,
+        .rtt_ms = 5,
+        .jitter_ms = 4,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    server_start(config);
+    download_ms = -1;
+    CHECK(download_service_enqueue(&component) == ESP_OK);
+    CHECK(xSemaphoreTake(ready, pdMS_TO_TICKS(10000)) == pdTRUE);
+    server_stop();
+
+    CHECK(strcmp(ready_path, SD_DIR "/stored_1.0.0") == 0);
+    check_stored(ready_path, data, component.size);
+    CHECK(!exists(SD_DIR "/stored_1.0.0.part"));
+    CHECK(download_ms >= 0);
+
+    /* The same release again is settled and not downloaded twice */
+    int requests = server_requests();
+    CHECK(download_service_enqueue(&component) == ESP_OK);
+    CHECK(xSemaphoreTake(ready, pdMS_TO_TICKS(200)) == pdFALSE);
+    CHECK(server_requests() == requests);
+    free(data);
+}
+
+static void test_discards_corrupt_artifact(void)
+{
+    start_service();
+    struct golioth_ota_component component;
+    uint8_t *data = make_component("corrupt", 20 * GOLIOTH_OTA_BLOCKSIZE, &component);
+    struct server_config config = {
+        .size = component.size,
+        .data = data,
+        .queue_size = 10,
+        .rtt_ms = 5,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    component.hash[0] ^= 1;
+    server_start(config);
+    int requests = server_requests();
+    CHECK(download_service_enqueue(&component) == ESP_OK);
+
+    /* The part file is there from the first block until the hash is checked */
+    int64_t deadline_us = now_us() + 10000000;
+    while (((server_requests() - requests < 20) || !server_all_answered()
+            || exists(SD_DIR "/corrupt_1.0.0.part"))
+           && (now_us() < deadline_us))
+    {
+        usleep(1000);
+    }
+    server_stop();
+    CHECK(server_requests() - requests == 20);
+    CHECK(!exists(SD_DIR "/corrupt_1.0.0.part"));
+    CHECK(!exists(SD_DIR "/corrupt_1.0.0"));
+    CHECK(xSemaphoreTake(ready, 0) == pdFALSE);
+    free(data);
+}
+
+struct strides {
+    pthread_mutex_t mutex;
+    bool stop;
+    int count;
+    /* How late each stride started, and how many more strides were due when it finished */
+    int64_t jitter_us[MAX_STRIDES];
+    int backlog[MAX_STRIDES];
+};
+
+/* Runs a stride every STRIDE_MS on an absolute schedule, as audio arrives, until stopped */
+static void *run_strides(void *arg)
+{
+    struct strides *s = arg;
+    int64_t start_us = now_us();
+    for (int i = 0; i < MAX_STRIDES; i++)
+    {
+        pthread_mutex_lock(&s->mutex);
+        bool stop = s->stop;
+        pthread_mutex_unlock(&s->mutex);
+        if (stop)
+        {
+            break;
+        }
+
+        int64_t due_us = start_us + (int64_t) i * STRIDE_MS * 1000;
+        struct timespec due = {.tv_sec = due_us / 1000000, .tv_nsec = (due_us % 1000000) * 1000};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        int64_t begin_us = now_us();
+        while (now_us() - begin_us < STRIDE_WORK_MS * 1000)
+        {
+        }
+        int64_t end_us = now_us();
+
+        s->jitter_us[i] = begin_us - due_us;
+        s->backlog[i] = (int) ((end_us - start_us) / (STRIDE_MS * 1000)) - i;
+        s->count = i + 1;
+    }
+    return NULL;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *) a;
+    int64_t y = *(const int64_t *) b;
+    return (x > y) - (x < y);
+}
+
+static void test_stride_latency_during_download(void)
+{
+    start_service();
+    struct golioth_ota_component component;
+    uint8_t *data =
+        make_component("strides", STRIDE_CASE_BLOCKS * GOLIOTH_OTA_BLOCKSIZE, &component);
+    struct server_config config = {
+        .size = component.size,
+        .data = data,
+        .queue_size = 10,
+        .rtt_ms = 60,
+        .jitter_ms = 10,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+
+    static struct strides s = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+    pthread_t thread;
+    CHECK(pthread_create(&thread, NULL, run_strides, &s) == 0);
+    server_start(config);
+    download_ms = -1;
+    CHECK(download_service_enqueue(&component) == ESP_OK);
+    CHECK(xSemaphoreTake(ready, pdMS_TO_TICKS(60000)) == pdTRUE);
+    pthread_mutex_lock(&s.mutex);
+    s.stop = true;
+    pthread_mutex_unlock(&s.mutex);
+    pthread_join(thread, NULL);
+    server_stop();
+    check_stored(ready_path, data, component.size);
+    free(data);
+
+    int max_backlog = 0;
+    for (int i = 0; i < s.count; i++)
+    {
+        max_backlog = MAX(max_backlog, s.backlog[i]);
+    }
+    qsort(s.jitter_us, s.count, sizeof(s.jitter_us[0]), compare_int64);
+    int64_t p99_us = s.jitter_us[(s.count * 99 + 99) / 100 - 1];
+    printf("%d blocks in %" PRId64 " ms with a %d ms block delay: %d strides, jitter p50 %" PRId64
+           " us, p99 %" PRId64 " us, max %" PRId64 " us, backlog max %d\n",
+           STRIDE_CASE_BLOCKS,
+           download_ms,
+           CONFIG_MODEL_DOWNLOAD_BLOCK_DELAY_MS,
+           s.count,
+           s.jitter_us[s.count / 2],
+           p99_us,
+           s.jitter_us[s.count - 1],
+           max_backlog);
+
+    CHECK(s.count >= MIN_STRIDES);
+    CHECK(p99_us <= MAX_P99_JITTER_US);
+    /* No stride was still running when the one after next was due */
+    CHECK(max_backlog <= 1);
+    /* Every block but the last is followed by the delay */
+    CHECK(download_ms >= (STRIDE_CASE_BLOCKS - 1) * CONFIG_MODEL_DOWNLOAD_BLOCK_DELAY_MS);
+}
+
+static const struct test_case cases[] = {
+    {"stores_verified_artifact", test_stores_verified_artifact},
+    {"discards_corrupt_artifact", test_discards_corrupt_artifact},
+    {"stride_latency_during_download", test_stride_latency_during_download},
+};
+
+int main(int argc, char **argv)
+{
+    /* An empty card, so that nothing is known from an earlier run */
+    CHECK(chdir(WORK_DIR) == 0);
+    empty_dir(SD_DIR);
+
+    /* One CPU, so the download competes with the strides for it */
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(sched_getcpu(), &cpus);
+    CHECK(sched_setaffinity(0, sizeof(cpus), &cpus) == 0);
+
+    return run_test_cases(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
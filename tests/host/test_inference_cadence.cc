@@ -0,0 +1,154 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+// InferenceCadence decisions for measured front-end and classifier costs at
+// the default 20 ms stride.
+
+#include "inference_cadence.h"
+#include "test_util.h"
+
+namespace {
+constexpr int kStrideMs = 20;
+// Steps per evaluation period in inference_cadence.cc.
+constexpr int kEvaluationSteps = 50;
+
+// Runs one evaluation period of one slice per step, as the inference loop does
+// it. Returns whether the cadence changed at the end of it.
+bool RunPeriod(InferenceCadence* cadence, int64_t feature_us,
+               int64_t classifier_us, int backlog_ms = 0) {
+  bool changed = false;
+  for (int step = 0; step < kEvaluationSteps; step++) {
+    cadence->RecordFeatures(1, feature_us);
+    if (cadence->AddStrides(1) > 0) {
+      cadence->RecordClassifiers(classifier_us);
+    }
+    cadence->RecordBacklog(backlog_ms);
+    changed = cadence->Update(kStrideMs);
+  }
+  return changed;
+}
+
+void TestKeepsEveryStrideUnderLoad() {
+  InferenceCadence cadence(4);
+  // 4 + 10 ms of 20 ms: 70 %
+  for (int i = 0; i < 5; i++) {
+    CHECK(!RunPeriod(&cadence, 4000, 10000));
+  }
+  CHECK(cadence.strides() == 1);
+  CHECK(cadence.load_pct() == 70);
+  CHECK(cadence.increases() == 0);
+}
+
+void TestRaisesAboveLoad() {
+  InferenceCadence cadence(4);
+  // 5 + 15 ms of 20 ms: 100 %
+  CHECK(RunPeriod(&cadence, 5000, 15000));
+  CHECK(cadence.strides() == 2);
+  CHECK(cadence.load_pct() == 100);
+  // Every other stride is 62 %, but one stride would be 100 % again.
+  for (int i = 0; i < 5; i++) {
+    CHECK(!RunPeriod(&cadence, 5000, 15000));
+  }
+  CHECK(cadence.strides() == 2);
+  CHECK(cadence.load_pct() == 62);
+  CHECK(cadence.increases() == 1);
+  CHECK(cadence.decreases() == 0);
+}
+
+void TestRaisesOnBacklog() {
+  InferenceCadence cadence(4);
+  // Two strides behind is still keeping up.
+  CHECK(!RunPeriod(&cadence, 1000, 1000, 2 * kStrideMs));
+  CHECK(cadence.strides() == 1);
+  // Three strides behind raises the cadence whatever the measured load.
+  CHECK(RunPeriod(&cadence, 1000, 1000, 3 * kStrideMs));
+  CHECK(cadence.strides() == 2);
+  CHECK(cadence.backlog_ms() == 3 * kStrideMs);
+  // Still behind: raised again rather than lowered for the low load.
+  CHECK(RunPeriod(&cadence, 1000, 1000, 3 * kStrideMs));
+  CHECK(cadence.strides() == 3);
+  CHECK(cadence.decreases() == 0);
+}
+
+void TestLowersOnlyWellUnderLoad() {
+  InferenceCadence cadence(4);
+  CHECK(RunPeriod(&cadence, 1000, 1000, 3 * kStrideMs));
+  CHECK(cadence.strides() == 2);
+  // 10 + 5/2 ms is 62 %, but one stride is predicted at 75 %, above the 70 %
+  // needed to lower it.
+  for (int i = 0; i < 5; i++) {
+    CHECK(!RunPeriod(&cadence, 10000, 5000));
+  }
+  CHECK(cadence.strides() == 2);
+  // 8 + 5 ms predicts 65 %.
+  CHECK(RunPeriod(&cadence, 8000, 5000));
+  CHECK(cadence.strides() == 1);
+  CHECK(cadence.decreases() == 1);
+}
+
+void TestStopsAtMaxStrides() {
+  InferenceCadence cadence(3);
+  for (int i = 0; i < 5; i++) {
+    RunPeriod(&cadence, 15000, 30000);
+  }
+  CHECK(cadence.strides() == 3);
+  CHECK(cadence.increases() == 2);
+}
+
+void TestWaitsForClassifierSamples() {
+  InferenceCadence cadence(4);
+  // A period without any invoke can't predict the load.
+  for (int step = 0; step < 2 * kEvaluationSteps; step++) {
+    cadence.RecordFeatures(1, 30000);
+    CHECK(!cadence.Update(kStrideMs));
+  }
+  CHECK(cadence.strides() == 1);
+  CHECK(cadence.load_pct() == 0);
+}
+
+void TestAddStridesSkipsSteps() {
+  InferenceCadence cadence(4);
+  CHECK(cadence.AddStrides(1) == 1);
+  // After a stall the classifiers cover every stride since the last invoke.
+  CHECK(cadence.AddStrides(3) == 3);
+
+  CHECK(RunPeriod(&cadence, 1000, 1000, 3 * kStrideMs));
+  CHECK(RunPeriod(&cadence, 1000, 1000, 3 * kStrideMs));
+  CHECK(cadence.strides() == 3);
+  // Line up with an invoke, then every third stride runs the classifiers.
+  while (cadence.AddStrides(1) == 0) {
+  }
+  CHECK(cadence.AddStrides(1) == 0);
+  CHECK(cadence.AddStrides(1) == 0);
+  CHECK(cadence.AddStrides(1) == 3);
+  CHECK(cadence.AddStrides(2) == 0);
+  CHECK(cadence.AddStrides(2) == 4);
+}
+
+const test_case kCases[] = {
+    {"keeps_every_stride_under_load", TestKeepsEveryStrideUnderLoad},
+    {"raises_above_load", TestRaisesAboveLoad},
+    {"raises_on_backlog", TestRaisesOnBacklog},
+    {"lowers_only_well_under_load", TestLowersOnlyWellUnderLoad},
+    {"stops_at_max_strides", TestStopsAtMaxStrides},
+    {"waits_for_classifier_samples", TestWaitsForClassifierSamples},
+    {"add_strides_skips_steps", TestAddStridesSkipsSteps},
+};
+}  // namespace
+
+int main(int argc, char** argv) {
+  return run_test_cases(kCases, sizeof(kCases) / sizeof(kCases[0]), argc,
+                        argv);
+}
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* The regression gate's decisions for every outcome of a corpus run. tf_micro_speech_run_corpus()
+ * is a stand-in that returns a chosen status and report; the baseline and firmware files are
+ * written to a corpus directory in the build tree. */
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../tf_micro_speech/main_functions.h"
+#include "model_regression.h"
+#include "test_util.h"
+
+#define BASELINE_PATH CONFIG_MODEL_REGRESSION_CORPUS_DIR "/" MODEL_REGRESSION_BASELINE_FILE
+#define FIRMWARE_PATH CONFIG_MODEL_REGRESSION_CORPUS_DIR "/" MODEL_REGRESSION_FIRMWARE_FILE
+
+static struct {
+    enum tf_corpus_status status;
+    struct tf_corpus_report report;
+    int runs;
+} corpus;
+
+static const char *firmware = "1111111111111111111111111111111111111111111111111111111111111111";
+
+int esp_app_get_elf_sha256(char *dst, size_t size)
+{
+    snprintf(dst, size, "%s", firmware);
+    return (int) strlen(dst);
+}
+
+enum tf_corpus_status tf_micro_speech_run_corpus(struct tf_model_ctx *ctx,
+                                                 const char *dir,
+                                                 struct tf_corpus_report *report)
+{
+    CHECK(strcmp(dir, CONFIG_MODEL_REGRESSION_CORPUS_DIR) == 0);
+    corpus.runs++;
+    *report = (corpus.status == TF_CORPUS_OK) ? corpus.report : (struct tf_corpus_report){0};
+    return corpus.status;
+}
+
+/* Any non-NULL model; the stand-in doesn't look at it */
+static struct tf_model_ctx *const model = (struct tf_model_ctx *) &corpus;
+
+static const struct tf_corpus_report baseline = {
+    .clips = 50,
+    .correct = 45,
+    .detections = 40,
+    .invokes = 400,
+    .avg_us = 10000,
+    .max_us = 12000,
+    .arena_used = 20000,
+};
+
+/* An empty corpus directory, with the baseline if given */
+static void reset_corpus(const struct tf_corpus_report *stored)
+{
+    mkdir(CONFIG_MODEL_REGRESSION_CORPUS_DIR, 0755);
+    unlink(BASELINE_PATH);
+    unlink(FIRMWARE_PATH);
+    if (stored)
+    {
+        CHECK(model_regression_store_baseline(stored) == ESP_OK);
+    }
+    corpus.runs = 0;
+}
+
+static enum model_regression_gate gate(enum tf_corpus_status status,
+                                       const struct tf_corpus_report *report)
+{
+    corpus.status = status;
+    corpus.report = report ? *report : baseline;
+    struct tf_corpus_report result;
+    return model_regression_gate(model, &result);
+}
+
+static void test_gate_passes_within_baseline(void)
+{
+    reset_corpus(&baseline);
+    struct tf_corpus_report candidate = baseline;
+    candidate.correct = 44;
+    candidate.avg_us = 11000;
+    candidate.arena_used = 24000;
+    CHECK(gate(TF_CORPUS_OK, &candidate) == MODEL_REGRESSION_GATE_PASS);
+
+    /* Without a baseline anything passes */
+    reset_corpus(NULL);
+    candidate.correct = 0;
+    CHECK(gate(TF_CORPUS_OK, &candidate) == MODEL_REGRESSION_GATE_PASS);
+}
+
+static void test_gate_rejects_regression(void)
+{
+    reset_corpus(&baseline);
+    struct tf_corpus_report candidate = baseline;
+    candidate.correct = 43;
+    CHECK(gate(TF_CORPUS_OK, &candidate) == MODEL_REGRESSION_GATE_REJECT);
+    candidate = baseline;
+    candidate.avg_us = 12100;
+    CHECK(gate(TF_CORPUS_OK, &candidate) == MODEL_REGRESSION_GATE_REJECT);
+    candidate = baseline;
+    candidate.arena_used = baseline.arena_used + 4097;
+    CHECK(gate(TF_CORPUS_OK, &candidate) == MODEL_REGRESSION_GATE_REJECT);
+}
+
+static void test_gate_rejects_broken_model(void)
+{
+    reset_corpus(&baseline);
+    CHECK(gate(TF_CORPUS_ERROR, NULL) == MODEL_REGRESSION_GATE_REJECT);
+}
+
+static void test_gate_defers_without_memory(void)
+{
+    /* A full arena says nothing about the candidate */
+    reset_corpus(&baseline);
+    CHECK(gate(TF_CORPUS_NO_MEMORY, NULL) == MODEL_REGRESSION_GATE_DEFER);
+    struct tf_corpus_report report;
+    CHECK(model_regression_run(model, &report) == ESP_ERR_NO_MEM);
+}
+
+static void test_gate_not_run_without_readable_corpus(void)
+{
+    /* A corpus that can't be read is no verdict on the candidate */
+    reset_corpus(&baseline);
+    CHECK(gate(TF_CORPUS_UNREADABLE, NULL) == MODEL_REGRESSION_GATE_NOT_RUN);
+    CHECK(corpus.runs == 1);
+
+    /* Nor is a missing one, which isn't played at all */
+    reset_corpus(NULL);
+    CHECK(rmdir(CONFIG_MODEL_REGRESSION_CORPUS_DIR) == 0);
+    CHECK(gate(TF_CORPUS_OK, NULL) == MODEL_REGRESSION_GATE_NOT_RUN);
+    CHECK(corpus.runs == 0);
+}
+
+static void test_firmware_check_records_verdict(void)
+{
+    reset_corpus(NULL);
+
+    /* The first build records the baseline */
+    corpus.status = TF_CORPUS_OK;
+    corpus.report = baseline;
+    CHECK(model_regression_check_firmware(model) == ESP_OK);
+    CHECK(model_regression_has_baseline());
+    CHECK(corpus.runs == 1);
+    CHECK(model_regression_check_firmware(model) == ESP_OK);
+    CHECK(corpus.runs == 1);
+
+    /* A build that regressed is reported until the next one, without playing the corpus again */
+    firmware = "2222222222222222222222222222222222222222222222222222222222222222";
+    corpus.report.correct = 30;
+    CHECK(model_regression_check_firmware(model) == ESP_ERR_INVALID_STATE);
+    CHECK(model_regression_check_firmware(model) == ESP_ERR_INVALID_STATE);
+    CHECK(corpus.runs == 2);
+}
+
+static void test_firmware_check_retried_after_errors(void)
+{
+    reset_corpus(&baseline);
+
+    /* Neither a full arena nor an unreadable corpus is a verdict on the build */
+    static const enum tf_corpus_status errors[] = {TF_CORPUS_NO_MEMORY, TF_CORPUS_UNREADABLE};
+    for (size_t i = 0; i < sizeof(errors) / sizeof(errors[0]); i++)
+    {
+        corpus.status = errors[i];
+        CHECK(model_regression_check_firmware(model) != ESP_OK);
+        CHECK(model_regression_check_firmware(model) != ESP_ERR_INVALID_STATE);
+        CHECK(access(FIRMWARE_PATH, F_OK) != 0);
+    }
+    CHECK(corpus.runs == 4);
+
+    corpus.status = TF_CORPUS_OK;
+    corpus.report = baseline;
+    CHECK(model_regression_check_firmware(model) == ESP_OK);
+    CHECK(access(FIRMWARE_PATH, F_OK) == 0);
+}
+
+static const struct test_case cases[] = {
+    {"gate_passes_within_baseline", test_gate_passes_within_baseline},
+    {"gate_rejects_regression", test_gate_rejects_regression},
+    {"gate_rejects_broken_model", test_gate_rejects_broken_model},
+    {"gate_defers_without_memory", test_gate_defers_without_memory},
+    {"gate_not_run_without_readable_corpus", test_gate_not_run_without_readable_corpus},
+    {"firmware_check_records_verdict", test_firmware_check_records_verdict},
+    {"firmware_check_retried_after_errors", test_firmware_check_retried_after_errors},
+};
+
+int main(int argc, char **argv)
+{
+    return run_test_cases(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
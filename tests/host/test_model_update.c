@@ -0,0 +1,463 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* The model update path of app_main.c on the host: manifests from a stand-in for the OTA service,
+ * downloads by download_service over the fake client of fake_ota_server.c with configurable
+ * latency and loss, a directory in the build tree as the SD card, and an inference loop that hands
+ * the stored models to model_handler. Each case prints the download throughput and the time
+ * inference was stopped by the switch.
+ *
+ * The interpreter, the shadow evaluation and the reboot that promotes a candidate need TFLM and
+ * the device, so the loop switches to a new model as app_main.c does when no model is running:
+ * it loads the model and invokes it in the next stride. A stand-in invoke reads the weights. */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "app_metrics.h"
+#include "download_service.h"
+#include "fake_ota_server.h"
+#include "freertos/queue.h"
+#include "mbedtls/sha256.h"
+#include "model_handler.h"
+#include "test_util.h"
+
+/* As in app_main.c */
+#define MODEL_PACKAGE_NAME "model"
+#define READY_QUEUE_LENGTH 2
+
+#define STRIDE_MS 20
+#define STRIDE_WORK_MS 5
+
+#define FIRST_MODEL MODELS_DIR "/model.bin_header_yn"
+#define UPDATE_MODEL MODELS_DIR "/model.bin_header_ynsg"
+/* The update is served as compressed by tools/compress_model.py */
+#define UPDATE_ARTIFACT COMPRESSED_MODELS_DIR "/w15/model.bin_header_ynsg.gmz"
+
+static QueueHandle_t ready_queue;
+
+static struct {
+    pthread_mutex_t mutex;
+    /* Model the inference loop runs, or an empty string */
+    char running[128];
+    int strides;
+    /* Strides that started over a stride late */
+    int late_strides;
+    /* Strides without a model after the first was loaded */
+    int idle_strides;
+    int switches;
+    /* Of the last switch: from releasing the old model to the end of the new one's first invoke,
+     * and the part of it model_init_from_file() took */
+    int64_t downtime_us;
+    int64_t load_us;
+} app = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+static struct {
+    pthread_mutex_t mutex;
+    int64_t download_ms;
+    int64_t bytes_per_s;
+} metrics = {.mutex = PTHREAD_MUTEX_INITIALIZER};
+
+void app_metrics_set(const char *name, int64_t value)
+{
+    pthread_mutex_lock(&metrics.mutex);
+    if (strcmp(name, "model_download_ms") == 0)
+    {
+        metrics.download_ms = value;
+    }
+    else if (strcmp(name, "model_download_bytes_per_s") == 0)
+    {
+        metrics.bytes_per_s = value;
+    }
+    pthread_mutex_unlock(&metrics.mutex);
+}
+
+static int64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Runs on the download task, as on_model_ready() in app_main.c */
+static void on_ready(const struct golioth_ota_component *component, const char *path)
+{
+    char *model_path = strdup(path);
+    CHECK(model_path);
+    CHECK(xQueueSendToBack(ready_queue, &model_path, portMAX_DELAY) == pdPASS);
+}
+
+/* Stands in for an invoke: reads every weight */
+static uint32_t invoke(const struct tf_model_ctx *ctx)
+{
+    uint32_t sum = 0;
+    int64_t start_us = now_us();
+    while (now_us() - start_us < STRIDE_WORK_MS * 1000)
+    {
+        for (size_t i = 0; i < ctx->data_len; i++)
+        {
+            sum += ctx->data[i];
+        }
+    }
+    return sum;
+}
+
+/* The main loop of app_main.c: takes the models handed over, and runs a stride every STRIDE_MS */
+static void *run_inference(void *arg)
+{
+    struct tf_model_ctx *ctx = NULL;
+    int64_t start_us = now_us();
+    volatile uint32_t sum = 0;
+    for (int stride = 0;; stride++)
+    {
+        int64_t due_us = start_us + (int64_t) stride * STRIDE_MS * 1000;
+        struct timespec due = {.tv_sec = due_us / 1000000, .tv_nsec = (due_us % 1000000) * 1000};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+        bool late = (now_us() - due_us > STRIDE_MS * 1000);
+
+        char *path;
+        int64_t switch_us = 0;
+        int64_t load_us = 0;
+        while (xQueueReceive(ready_queue, &path, 0) == pdTRUE)
+        {
+            switch_us = now_us();
+            struct tf_model_ctx *next = model_init_from_file(path);
+            load_us = now_us() - switch_us;
+            if (next)
+            {
+                /* BuildSlot() in speech_pipeline.cc fills in the descriptor once the interpreter
+                 * accepts the model, which every model does here */
+                if (!next->verified)
+                {
+                    next->meta.verified = 1;
+                    model_store_meta(next, path);
+                }
+                if (ctx)
+                {
+                    model_free(ctx);
+                }
+                ctx = next;
+                pthread_mutex_lock(&app.mutex);
+                snprintf(app.running, sizeof(app.running), "%s", path);
+                pthread_mutex_unlock(&app.mutex);
+            }
+            free(path);
+        }
+
+        if (ctx)
+        {
+            sum += invoke(ctx);
+        }
+
+        pthread_mutex_lock(&app.mutex);
+        app.strides++;
+        app.late_strides += late;
+        app.idle_strides += !ctx && app.switches;
+        if (ctx && switch_us)
+        {
+            app.switches++;
+            app.downtime_us = now_us() - switch_us;
+            app.load_us = load_us;
+        }
+        pthread_mutex_unlock(&app.mutex);
+    }
+    return NULL;
+}
+
+/* The service and the inference loop run for the life of the process; each case uses versions of
+ * its own */
+static void start_app(void)
+{
+    static bool started;
+    if (!started)
+    {
+        ready_queue = xQueueCreate(READY_QUEUE_LENGTH, sizeof(char *));
+        CHECK(ready_queue);
+        download_service_init(SD_DIR, NULL, on_ready);
+        download_service_start(NULL);
+        pthread_t thread;
+        CHECK(pthread_create(&thread, NULL, run_inference, NULL) == 0);
+        pthread_detach(thread);
+        started = true;
+    }
+}
+
+struct artifact {
+    uint8_t *data;
+    struct golioth_ota_component component;
+};
+
+static uint8_t *read_file(const char *path, int32_t *size)
+{
+    struct stat st;
+    CHECK(stat(path, &st) == 0);
+    uint8_t *data = malloc(st.st_size);
+    CHECK(data);
+    FILE *f = fopen(path, "r");
+    CHECK(f);
+    CHECK(fread(data, 1, st.st_size, f) == (size_t) st.st_size);
+    fclose(f);
+    *size = (int32_t) st.st_size;
+    return data;
+}
+
+/* The manifest entry of a release of the model package, and the artifact served for it */
+static void load_artifact(const char *path, const char *version, struct artifact *artifact)
+{
+    struct golioth_ota_component *component = &artifact->component;
+    *component = (struct golioth_ota_component){0};
+    snprintf(component->package, sizeof(component->package), MODEL_PACKAGE_NAME);
+    snprintf(component->version, sizeof(component->version), "%s", version);
+    artifact->data = read_file(path, &component->size);
+
+    mbedtls_sha256_context sha;
+    mbedtls_sha256_init(&sha);
+    CHECK(mbedtls_sha256_starts(&sha, 0) == 0);
+    CHECK(mbedtls_sha256_update(&sha, artifact->data, component->size) == 0);
+    CHECK(mbedtls_sha256_finish(&sha, component->hash) == 0);
+    mbedtls_sha256_free(&sha);
+}
+
+/* Stands in for a manifest from the OTA service that lists the release, which on_manifest() in
+ * app_main.c queues for download */
+static void deliver_manifest(const struct artifact *artifact, struct server_config config)
+{
+    config.size = artifact->component.size;
+    config.data = artifact->data;
+    server_start(config);
+    pthread_mutex_lock(&metrics.mutex);
+    metrics.download_ms = -1;
+    pthread_mutex_unlock(&metrics.mutex);
+    CHECK(download_service_enqueue(&artifact->component) == ESP_OK);
+}
+
+static bool running(const char *path)
+{
+    pthread_mutex_lock(&app.mutex);
+    bool is_running = (strcmp(app.running, path) == 0);
+    pthread_mutex_unlock(&app.mutex);
+    return is_running;
+}
+
+static bool wait_running(const char *path, int timeout_ms)
+{
+    int64_t deadline_us = now_us() + (int64_t) timeout_ms * 1000;
+    while (!running(path) && (now_us() < deadline_us))
+    {
+        usleep(1000);
+    }
+    return running(path);
+}
+
+static bool exists(const char *path)
+{
+    struct stat st;
+    return stat(path, &st) == 0;
+}
+
+static void check_stored(const char *path, const char *original)
+{
+    int32_t stored_size;
+    int32_t original_size;
+    uint8_t *stored = read_file(path, &stored_size);
+    uint8_t *expected = read_file(original, &original_size);
+    CHECK(stored_size == original_size);
+    CHECK(memcmp(stored, expected, stored_size) == 0);
+    free(stored);
+    free(expected);
+}
+
+/* Runs the first release, then updates to the second over a link with the given latency and
+ * loss, while inference keeps running the first */
+static void update(const char *name, struct server_config config)
+{
+    start_app();
+    char first_version[64];
+    char update_version[64];
+    char first_path[128];
+    char update_path[128];
+    snprintf(first_version, sizeof(first_version), "%s-1", name);
+    snprintf(update_version, sizeof(update_version), "%s-2", name);
+    snprintf(first_path, sizeof(first_path), SD_DIR "/" MODEL_PACKAGE_NAME "_%s", first_version);
+    snprintf(update_path, sizeof(update_path), SD_DIR "/" MODEL_PACKAGE_NAME "_%s", update_version);
+
+    struct artifact first;
+    struct server_config clean = {
+        .queue_size = 10,
+        .rtt_ms = 5,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    load_artifact(FIRST_MODEL, first_version, &first);
+    deliver_manifest(&first, clean);
+    CHECK(wait_running(first_path, 10000));
+    server_stop();
+
+    pthread_mutex_lock(&app.mutex);
+    int switches = app.switches;
+    int strides = app.strides;
+    int late_strides = app.late_strides;
+    pthread_mutex_unlock(&app.mutex);
+
+    struct artifact artifact;
+    load_artifact(UPDATE_ARTIFACT, update_version, &artifact);
+    deliver_manifest(&artifact, config);
+    CHECK(wait_running(update_path, 60000));
+    int lost = server_lost();
+    server_stop();
+    CHECK((config.loss_pct == 0) || (lost > 0));
+
+    check_stored(update_path, UPDATE_MODEL);
+    CHECK(exists(SD_DIR "/ota_state.bin"));
+    char meta_path[160];
+    snprintf(meta_path, sizeof(meta_path), "%s" MODEL_META_SUFFIX, update_path);
+    CHECK(exists(meta_path));
+
+    pthread_mutex_lock(&metrics.mutex);
+    int64_t download_ms = metrics.download_ms;
+    int64_t bytes_per_s = metrics.bytes_per_s;
+    pthread_mutex_unlock(&metrics.mutex);
+    CHECK(download_ms >= 0);
+
+    pthread_mutex_lock(&app.mutex);
+    CHECK(app.switches == switches + 1);
+    CHECK(app.idle_strides == 0);
+    printf("%s: %" PRId32 " bytes in %" PRId64 " ms (%" PRId64 " B/s) at %d ms RTT, %d %% loss, "
+           "%d transmissions lost; %d strides during the download, %d late; switch stopped "
+           "inference for %" PRId64 " us, loading %" PRId64 " us\n",
+           name,
+           artifact.component.size,
+           download_ms,
+           bytes_per_s,
+           config.rtt_ms,
+           config.loss_pct,
+           lost,
+           app.strides - strides,
+           app.late_strides - late_strides,
+           app.downtime_us,
+           app.load_us);
+    pthread_mutex_unlock(&app.mutex);
+    free(first.data);
+    free(artifact.data);
+}
+
+static void test_update_over_clean_link(void)
+{
+    struct server_config config = {
+        .queue_size = 10,
+        .rtt_ms = 40,
+        .jitter_ms = 10,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    update("clean", config);
+}
+
+static void test_update_over_lossy_link(void)
+{
+    /* CoAP's 2 s first retransmission, and its four retransmissions, scaled down tenfold */
+    struct server_config config = {
+        .queue_size = 10,
+        .rtt_ms = 40,
+        .jitter_ms = 10,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+        .loss_pct = 20,
+        .retransmit_ms = 200,
+        .max_retransmits = 4,
+    };
+    update("lossy", config);
+}
+
+static void test_update_fails_over_broken_link(void)
+{
+    start_app();
+    struct server_config clean = {
+        .queue_size = 10,
+        .rtt_ms = 5,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+    };
+    struct artifact first;
+    load_artifact(FIRST_MODEL, "broken-1", &first);
+    deliver_manifest(&first, clean);
+    CHECK(wait_running(SD_DIR "/" MODEL_PACKAGE_NAME "_broken-1", 10000));
+    server_stop();
+
+    /* Every transmission is lost, so every block request times out */
+    struct server_config broken = {
+        .queue_size = 10,
+        .rtt_ms = 5,
+        .fail_block = -1,
+        .hold_block = -1,
+        .slow_block = -1,
+        .loss_pct = 100,
+        .retransmit_ms = 10,
+        .max_retransmits = 2,
+    };
+    struct artifact artifact;
+    load_artifact(UPDATE_ARTIFACT, "broken-2", &artifact);
+    int requests = server_requests();
+    deliver_manifest(&artifact, broken);
+
+    /* The download has given up once its retries stop */
+    int64_t deadline_us = now_us() + 30000000;
+    int last_requests = requests;
+    int64_t last_change_us = now_us();
+    while (now_us() < deadline_us)
+    {
+        int current = server_requests();
+        if (current != last_requests)
+        {
+            last_requests = current;
+            last_change_us = now_us();
+        }
+        else if ((current > requests) && server_all_answered()
+                 && (now_us() - last_change_us > 1000000))
+        {
+            break;
+        }
+        usleep(10000);
+    }
+    server_stop();
+
+    CHECK(server_all_answered());
+    CHECK(!exists(SD_DIR "/" MODEL_PACKAGE_NAME "_broken-2"));
+    CHECK(!exists(SD_DIR "/" MODEL_PACKAGE_NAME "_broken-2.part"));
+    CHECK(running(SD_DIR "/" MODEL_PACKAGE_NAME "_broken-1"));
+    pthread_mutex_lock(&app.mutex);
+    int strides = app.strides;
+    pthread_mutex_unlock(&app.mutex);
+    usleep(5 * STRIDE_MS * 1000);
+    pthread_mutex_lock(&app.mutex);
+    CHECK(app.strides > strides);
+    CHECK(app.idle_strides == 0);
+    pthread_mutex_unlock(&app.mutex);
+    printf("%d requests before giving up\n", last_requests - requests);
+    free(first.data);
+    free(artifact.data);
+}
+
+static const struct test_case cases[] = {
+    {"update_over_clean_link", test_update_over_clean_link},
+    {"update_over_lossy_link", test_update_over_lossy_link},
+    {"update_fails_over_broken_link", test_update_fails_over_broken_link},
+};
+
+int main(int argc, char **argv)
+{
+    /* An empty card, so that nothing is known from an earlier run */
+    CHECK(chdir(WORK_DIR) == 0);
+    empty_dir(SD_DIR);
+    return run_test_cases(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
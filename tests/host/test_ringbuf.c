@@ -0,0 +1,375 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/* Ring buffer scenarios: the capture task's write pattern at 16 and 48 kHz against steady and
+ * bursty readers, an unpaced throughput run per chunk size, and the reader wakeup and abort
+ * paths. Each scenario prints throughput, wakeup latency percentiles and blocked time from the
+ * ring's own counters. Timings come from the host scheduler, not from an ESP32-S3, so only the
+ * data and the control flow are checked; the numbers are for comparing ring implementations on
+ * the same machine. */
+
+#include <inttypes.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+#include "ringbuf.h"
+#include "test_util.h"
+
+/* The capture ring: 1250 ms of 16 kHz 16-bit audio */
+#define RING_SIZE 40000
+#define SCENARIO_MS 1000
+
+struct stream {
+    ringbuf_t *rb;
+    /* Producer: bytes per chunk and chunks per second, 0 for as fast as possible */
+    int write_chunk;
+    int write_rate;
+    int total;
+    /* First byte of the stream, so that data crossing between rings is noticed */
+    uint8_t first;
+    /* Consumer: bytes per read, and an optional pause after each read */
+    int read_chunk;
+    int read_pause_ms;
+    int received;
+    bool corrupt;
+};
+
+static void pace(int64_t start_us, int64_t done, int rate)
+{
+    if (rate > 0)
+    {
+        int64_t due_us = start_us + done * 1000000 / rate;
+        int64_t wait_us = due_us - esp_timer_get_time();
+        if (wait_us > 0)
+        {
+            usleep(wait_us);
+        }
+    }
+}
+
+static void *produce(void *arg)
+{
+    struct stream *s = arg;
+    uint8_t *chunk = malloc(s->write_chunk);
+    CHECK(chunk);
+
+    uint8_t next = s->first;
+    int64_t start_us = esp_timer_get_time();
+    for (int written = 0, n = 0; written < s->total; n++)
+    {
+        pace(start_us, n, s->write_rate);
+        for (int i = 0; i < s->write_chunk; i++)
+        {
+            chunk[i] = next++;
+        }
+        CHECK(rb_write(s->rb, chunk, s->write_chunk, portMAX_DELAY) == s->write_chunk);
+        written += s->write_chunk;
+    }
+    rb_signal_writer_finished(s->rb);
+    free(chunk);
+    return NULL;
+}
+
+static void *consume(void *arg)
+{
+    struct stream *s = arg;
+    uint8_t *chunk = malloc(s->read_chunk);
+    CHECK(chunk);
+
+    uint8_t expected = s->first;
+    while (true)
+    {
+        int n = rb_read(s->rb, chunk, s->read_chunk, portMAX_DELAY);
+        /* rb_read() gives up as soon as it sees the writer finish, even with data left */
+        if ((n == RB_WRITER_FINISHED) && (rb_filled(s->rb) > 0))
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            break;
+        }
+        for (int i = 0; i < n; i++)
+        {
+            s->corrupt |= (chunk[i] != expected++);
+        }
+        s->received += n;
+        if (s->read_pause_ms)
+        {
+            usleep(s->read_pause_ms * 1000);
+        }
+    }
+    free(chunk);
+    return NULL;
+}
+
+/* Runs the streams side by side, each through a ring of its own */
+static void run_streams(const char *name, struct stream *streams, int count)
+{
+    pthread_t producers[count];
+    pthread_t consumers[count];
+    for (int i = 0; i < count; i++)
+    {
+        streams[i].rb = rb_init("test", RING_SIZE);
+        CHECK(streams[i].rb);
+    }
+
+    int64_t start_us = esp_timer_get_time();
+    for (int i = 0; i < count; i++)
+    {
+        CHECK(pthread_create(&consumers[i], NULL, consume, &streams[i]) == 0);
+        CHECK(pthread_create(&producers[i], NULL, produce, &streams[i]) == 0);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        pthread_join(producers[i], NULL);
+        pthread_join(consumers[i], NULL);
+    }
+    int64_t elapsed_us = esp_timer_get_time() - start_us;
+
+    for (int i = 0; i < count; i++)
+    {
+        struct stream *s = &streams[i];
+
+        rb_stats_t stats;
+        rb_get_stats(s->rb, &stats);
+        printf("%-24s %9" PRId64 " B/s, wakeup p50 %5" PRId64 " us p99 %5" PRId64
+               " us max %5" PRId64 " us, reader blocked %3" PRId64 " %%, writer blocked %3" PRId64
+               " %%\n",
+               name,
+               (int64_t) s->received * 1000000 / elapsed_us,
+               rb_stats_wakeup_percentile_us(&stats, 50),
+               rb_stats_wakeup_percentile_us(&stats, 99),
+               stats.wakeup_max_us,
+               stats.reader_blocked_us * 100 / elapsed_us,
+               stats.writer_blocked_us * 100 / elapsed_us);
+
+        CHECK(!s->corrupt);
+        CHECK(s->received == s->total);
+        CHECK(stats.bytes_written == (uint64_t) s->total);
+        CHECK(stats.bytes_read == (uint64_t) s->total);
+        rb_cleanup(s->rb);
+    }
+}
+
+static void run_stream(const char *name, struct stream *s)
+{
+    run_streams(name, s, 1);
+}
+
+/* One codec read per 20 ms stride, decimated to 16 kHz, as the capture task writes it */
+static void capture_stream(const char *name, int capture_rate, int read_chunk, int read_pause_ms)
+{
+    int stride_bytes = 20 * (capture_rate / 1000) * 2;
+    struct stream s = {
+        .write_chunk = stride_bytes,
+        .write_rate = 50,
+        .total = stride_bytes * 50 * SCENARIO_MS / 1000,
+        .read_chunk = read_chunk,
+        .read_pause_ms = read_pause_ms,
+    };
+    run_stream(name, &s);
+}
+
+static void test_capture_16k_steady_reader(void)
+{
+    capture_stream("16 kHz, 20 ms reads", 16000, 640, 0);
+}
+
+static void test_capture_48k_steady_reader(void)
+{
+    capture_stream("48 kHz, 20 ms reads", 48000, 1920, 0);
+}
+
+static void test_capture_16k_bursty_reader(void)
+{
+    /* An inference loop that stalls for 100 ms and then catches up */
+    capture_stream("16 kHz, 100 ms stalls", 16000, 3200, 100);
+}
+
+static void test_capture_48k_small_reads(void)
+{
+    capture_stream("48 kHz, 2 ms reads", 48000, 192, 0);
+}
+
+static void test_throughput_by_chunk_size(void)
+{
+    static const int chunks[] = {64, 640, 4096, 16384};
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "unpaced, %d B chunks", chunks[i]);
+        struct stream s = {
+            .write_chunk = chunks[i],
+            .total = chunks[i] * (8 * 1024 * 1024 / chunks[i]),
+            .read_chunk = chunks[i],
+        };
+        run_stream(name, &s);
+    }
+}
+
+/* Pipelines running side by side, each reading the capture ring of its own audio source */
+static void test_parallel_instances(void)
+{
+    struct stream s[4];
+    for (int i = 0; i < 4; i++)
+    {
+        /* 16 and 48 kHz sources, read in 20 ms strides */
+        int stride_bytes = (i % 2) ? 1920 : 640;
+        s[i] = (struct stream){
+            .write_chunk = stride_bytes,
+            .write_rate = 50,
+            .total = stride_bytes * 50 * SCENARIO_MS / 1000,
+            .first = 61 * i,
+            .read_chunk = stride_bytes,
+        };
+    }
+    run_streams("4 instances", s, 4);
+}
+
+struct waiter {
+    ringbuf_t *rb;
+    int result;
+    int64_t returned_us;
+};
+
+static void *wait_for_data(void *arg)
+{
+    struct waiter *w = arg;
+    uint8_t buf[640];
+    w->result = rb_read(w->rb, buf, sizeof(buf), portMAX_DELAY);
+    w->returned_us = esp_timer_get_time();
+    return NULL;
+}
+
+/* Starts a reader on an empty ring and wakes it with signal() once it is blocked */
+static struct waiter wake_blocked_reader(void (*signal)(ringbuf_t *rb))
+{
+    struct waiter w = {.rb = rb_init("test", RING_SIZE)};
+    CHECK(w.rb);
+
+    pthread_t reader;
+    CHECK(pthread_create(&reader, NULL, wait_for_data, &w) == 0);
+    usleep(20000);
+    int64_t signal_us = esp_timer_get_time();
+    signal(w.rb);
+    pthread_join(reader, NULL);
+    w.returned_us -= signal_us;
+
+    rb_stats_t stats;
+    rb_get_stats(w.rb, &stats);
+    CHECK(stats.reader_waits == 1);
+    rb_cleanup(w.rb);
+    return w;
+}
+
+static void test_wakeup_reader(void)
+{
+    struct waiter w = wake_blocked_reader(rb_wakeup_reader);
+    printf("rb_wakeup_reader: reader back after %" PRId64 " us\n", w.returned_us);
+    CHECK(w.result == RB_READER_UNBLOCK);
+}
+
+static void test_abort_reader(void)
+{
+    struct waiter w = wake_blocked_reader(rb_abort);
+    printf("rb_abort: reader back after %" PRId64 " us\n", w.returned_us);
+    CHECK(w.result == RB_ABORT);
+}
+
+static void test_writer_finished(void)
+{
+    struct waiter w = wake_blocked_reader(rb_signal_writer_finished);
+    CHECK(w.result == RB_WRITER_FINISHED);
+}
+
+/* A full ring keeps the newest data when the writer discards what doesn't fit, as the capture
+ * task does while nothing reads */
+static void test_discard_keeps_newest(void)
+{
+    ringbuf_t *rb = rb_init("test", 1000);
+    CHECK(rb);
+
+    uint8_t chunk[300];
+    for (int n = 0; n < 10; n++)
+    {
+        memset(chunk, n, sizeof(chunk));
+        ssize_t room = rb_available(rb);
+        if (room < (ssize_t) sizeof(chunk))
+        {
+            CHECK(rb_discard(rb, sizeof(chunk) - room) == (int) (sizeof(chunk) - room));
+        }
+        CHECK(rb_write(rb, chunk, sizeof(chunk), 0) == (int) sizeof(chunk));
+    }
+    CHECK(rb_filled(rb) == 1000);
+
+    /* The last 1000 bytes written: 100 of chunk 6, then chunks 7 to 9 */
+    uint8_t out[1000];
+    CHECK(rb_read(rb, out, sizeof(out), 0) == (int) sizeof(out));
+    CHECK(out[0] == 6 && out[99] == 6);
+    CHECK(out[100] == 7 && out[999] == 9);
+    CHECK(rb_discard(rb, 10) == 0);
+    rb_cleanup(rb);
+}
+
+static void test_read_timeout(void)
+{
+    ringbuf_t *rb = rb_init("test", 1000);
+    CHECK(rb);
+
+    uint8_t buf[100] = {0};
+    CHECK(rb_write(rb, buf, 40, 0) == 40);
+    /* Returns what there is once the wait times out */
+    CHECK(rb_read(rb, buf, sizeof(buf), pdMS_TO_TICKS(10)) == 40);
+
+    rb_stats_t stats;
+    rb_get_stats(rb, &stats);
+    CHECK(stats.reader_timeouts == 1);
+    rb_cleanup(rb);
+}
+
+/* Tears a ring down and builds it again the way a pipeline deinit and re-init does: the reader is
+ * blocked when the ring is aborted, and freed only once it has returned. LeakSanitizer reports
+ * anything rb_cleanup() doesn't free at exit. */
+static void test_reinit_cycles(void)
+{
+    for (int n = 0; n < 200; n++)
+    {
+        struct waiter w = {.rb = rb_init("test", RING_SIZE)};
+        CHECK(w.rb);
+
+        pthread_t reader;
+        CHECK(pthread_create(&reader, NULL, wait_for_data, &w) == 0);
+        uint8_t chunk[320] = {0};
+        CHECK(rb_write(w.rb, chunk, sizeof(chunk), 0) == (int) sizeof(chunk));
+        rb_abort(w.rb);
+        pthread_join(reader, NULL);
+        /* Aborted while waiting for the rest, or before it started reading */
+        CHECK(w.result == RB_ABORT);
+        rb_cleanup(w.rb);
+    }
+}
+
+static const struct test_case cases[] = {
+    {"capture_16k_steady_reader", test_capture_16k_steady_reader},
+    {"capture_48k_steady_reader", test_capture_48k_steady_reader},
+    {"capture_16k_bursty_reader", test_capture_16k_bursty_reader},
+    {"capture_48k_small_reads", test_capture_48k_small_reads},
+    {"throughput_by_chunk_size", test_throughput_by_chunk_size},
+    {"wakeup_reader", test_wakeup_reader},
+    {"abort_reader", test_abort_reader},
+    {"writer_finished", test_writer_finished},
+    {"discard_keeps_newest", test_discard_keeps_newest},
+    {"read_timeout", test_read_timeout},
+    {"parallel_instances", test_parallel_instances},
+    {"reinit_cycles", test_reinit_cycles},
+};
+
+int main(int argc, char **argv)
+{
+    return run_test_cases(cases, sizeof(cases) / sizeof(cases[0]), argc, argv);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2024 Golioth, Inc.
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#pragma once
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* Fails the test, which ctest reports with the output so far */
+#define CHECK(cond)                                                                        \
+    do                                                                                     \
+    {                                                                                      \
+        if (!(cond))                                                                       \
+        {                                                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond);       \
+            exit(1);                                                                       \
+        }                                                                                  \
+    } while (0)
+
+/* Creates dir if needed and removes the files in it */
+static inline void empty_dir(const char *dir)
+{
+    mkdir(dir, 0755);
+    DIR *d = opendir(dir);
+    CHECK(d);
+    struct dirent *entry;
+    char path[512];
+    while ((entry = readdir(d)) != NULL)
+    {
+        if (entry->d_name[0] != '.')
+        {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            CHECK(unlink(path) == 0);
+        }
+    }
+    closedir(d);
+}
+
+struct test_case {
+    const char *name;
+    void (*run)(void);
+};
+
+/* Runs the case named by the first argument, or every case without one. CMake registers each
+ * case as its own test. */
+static inline int run_test_cases(const struct test_case *cases,
+                                 size_t count,
+                                 int argc,
+                                 char **argv)
+{
+    for (size_t i = 0; i < count; i++)
+    {
+        if ((argc < 2) || (strcmp(argv[1], cases[i].name) == 0))
+        {
+            printf("%s\n", cases[i].name);
+            cases[i].run();
+            if (argc >= 2)
+            {
+                return 0;
+            }
+        }
+    }
+    if (argc >= 2)
+    {
+        fprintf(stderr, "unknown test case: %s\n", argv[1]);
+        return 1;
+    }
+    return 0;
+}
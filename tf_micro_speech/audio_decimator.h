@@ -0,0 +1,37 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_AUDIO_DECIMATOR_H_
+#define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_AUDIO_DECIMATOR_H_
+
+#include <cstdint>
+
+#include "tensorflow/lite/c/common.h"
+
+// Streaming decimator from kAudioCaptureSampleRate down to
+// kAudioSampleFrequency: a linear-phase low-pass FIR in Q15 of which only every
+// kAudioDecimationFactor-th output is computed. Filter state carries over
+// between blocks, so audio can be fed one capture read at a time. Only used
+// when the capture rate is above the model rate.
+
+// Computes the filter coefficients. Must be called before DecimateAudio().
+TfLiteStatus InitAudioDecimator();
+
+// Decimates |input_count| samples, at most one capture read, into |output|,
+// which may alias |input|. |input_count| must be a multiple of
+// kAudioDecimationFactor. Returns the number of output samples.
+int DecimateAudio(const int16_t* input, int input_count, int16_t* output);
+
+#endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_AUDIO_DECIMATOR_H_
@@ -30,90 +30,130 @@ limitations under the License.
 #include "spi_flash_mmap.h"
 #include "esp_system.h"
 #include "esp_timer.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
 #include "ringbuf.h"
 #include "micro_model_settings.h"
 
+#include "audio_decimator.h"
+#include "deferred_log.h"
 #include "esp_codec_dev.h"
 #include "bsp/m5stack_core_s3.h"
+#include "wav_source.h"
 static esp_codec_dev_handle_t mic_codec_dev = NULL;
 
 using namespace std;
 
 static const char* TAG = "TF_LITE_AUDIO_PROVIDER";
-/* ringbuffer to hold the incoming audio data */
-ringbuf_t* g_audio_capture_buffer;
-volatile int32_t g_latest_audio_timestamp = 0;
-/* model requires 20ms new data from g_audio_capture_buffer and 10ms old data
- * each time , storing old data in the histrory buffer , {
- * history_samples_to_keep = 10 * 16 } */
-constexpr int32_t history_samples_to_keep =
-    ((kFeatureDurationMs - kFeatureStrideMs) *
-     (kAudioSampleFrequency / 1000));
-/* new samples to get each time from ringbuffer, { new_samples_to_get =  20 * 16
- * } */
-constexpr int32_t new_samples_to_get =
-    (kFeatureStrideMs * (kAudioSampleFrequency / 1000));
-
-const int32_t kAudioCaptureBufferSize = 40000;
-const int32_t i2s_bytes_to_read = 3200;
+
+/* one stride at the capture rate, decimated to kAudioCaptureReadSize */
+const int32_t i2s_bytes_to_read = kAudioCaptureRawReadSize;
+
+static_assert(kFeatureDurationMs * kAudioSampleFrequency / 1000 <=
+                  kAudioOutputBufferSize,
+              "Audio output buffer too small for one feature window");
 
 namespace {
-int16_t g_audio_output_buffer[kMaxAudioSampleSize * 32];
+/* There is one microphone, so its capture task and ring are process-wide */
+AudioCapture g_microphone = {};
+// Signalled by the capture task once the first audio has been written.
+SemaphoreHandle_t g_audio_started = nullptr;
 bool g_is_audio_initialized = false;
-int16_t g_history_buffer[history_samples_to_keep];
-uint8_t g_i2s_read_buffer[i2s_bytes_to_read] = {};
+alignas(4) uint8_t g_i2s_read_buffer[i2s_bytes_to_read] = {};
+// The ring is allocated on the heap, so tools/memory_budget.py reads its size
+// from here. Being volatile, the allocation really reads it and the linker
+// keeps it in the ELF.
+const volatile uint32_t g_audio_capture_buffer_size = kAudioCaptureBufferSize;
+// Likewise the size of one read, which the budget of the decimator follows.
+const volatile uint32_t g_i2s_read_size = i2s_bytes_to_read;
 }  // namespace
 
-static void i2s_init(void) {
+#if CONFIG_AUDIO_SOURCE_WAV_FILE
+/* the microphone is replaced by a WAV file played in real time */
+static TfLiteStatus audio_source_init(void) {
+  return WavSourceOpen(CONFIG_AUDIO_SOURCE_WAV_PATH, kAudioCaptureSampleRate);
+}
+
+static int audio_source_read(uint8_t* buffer, size_t len) {
+  return WavSourceRead(buffer, len);
+}
+#else
+static TfLiteStatus audio_source_init(void) {
     mic_codec_dev = bsp_audio_codec_microphone_init();
 
     esp_codec_dev_sample_info_t codec_record_cfg = {
         .bits_per_sample = 16,
         .channel = 1,
-        .sample_rate = 16000,
+        .sample_rate = kAudioCaptureSampleRate,
     };
 
     int err = esp_codec_dev_open(mic_codec_dev, &codec_record_cfg);
     if (err != ESP_CODEC_DEV_OK)
     {
         ESP_LOGE(TAG, "Unable to open mic codec %d", err);
-        return;
+        return kTfLiteError;
     }
+    return kTfLiteOk;
 }
 
+static int audio_source_read(uint8_t* buffer, size_t len) {
+  return esp_codec_dev_read(mic_codec_dev, (void*)buffer, len);
+}
+#endif
+
 static void CaptureSamples(void* arg) {
-  size_t bytes_read = i2s_bytes_to_read;
-  i2s_init();
+  size_t bytes_read = g_i2s_read_size;
   while (1) {
-    /* read 100ms data at once from i2s */
-    int err = esp_codec_dev_read(mic_codec_dev, (void*)g_i2s_read_buffer, bytes_read);
+    /* read one stride of data at once from i2s */
+    int err = audio_source_read(g_i2s_read_buffer, bytes_read);
     if (err)
     {
 
-      ESP_LOGE(TAG, "Error reading from codec %d", err);
+      deferred_log(DLOG_CODEC_READ_ERROR, err, 0);
+      /* the buffer holds no new audio; don't spin on a source that keeps
+       * failing */
+      vTaskDelay(1);
+      continue;
     }
 
     if (bytes_read <= 0) {
-      ESP_LOGE(TAG, "Error in I2S read : %d", bytes_read);
+      deferred_log(DLOG_I2S_READ_ERROR, bytes_read, 0);
     } else {
       if (bytes_read < i2s_bytes_to_read) {
-        ESP_LOGW(TAG, "Partial I2S read");
+        deferred_log(DLOG_I2S_PARTIAL_READ, bytes_read, i2s_bytes_to_read);
       }
-      /* write bytes read by i2s into ring buffer */
-      int bytes_written = rb_write(g_audio_capture_buffer,
-                                   (uint8_t*)g_i2s_read_buffer, bytes_read, pdMS_TO_TICKS(100));
-      if (bytes_written != bytes_read) {
-        ESP_LOGI(TAG, "Could only write %d bytes out of %zu", bytes_written, bytes_read);
+      /* bring the audio down to the model rate, in place */
+      size_t bytes_to_write = bytes_read;
+      if (kAudioDecimationFactor > 1) {
+        int16_t* samples = reinterpret_cast<int16_t*>(g_i2s_read_buffer);
+        bytes_to_write =
+            DecimateAudio(samples, bytes_read / sizeof(int16_t), samples) *
+            sizeof(int16_t);
+      }
+      /* nothing may be reading (no model yet, a corpus run, a download):
+       * drop the oldest audio instead of waiting for room */
+      const ssize_t room = rb_available(g_microphone.ring);
+      if (room < (ssize_t)bytes_to_write) {
+        rb_discard(g_microphone.ring, bytes_to_write - room);
       }
+      /* write bytes read by i2s into ring buffer */
+      int bytes_written = rb_write(g_microphone.ring,
+                                   (uint8_t*)g_i2s_read_buffer, bytes_to_write, pdMS_TO_TICKS(100));
       /* update the timestamp (in ms) to let the model know that new data has
        * arrived */
-      g_latest_audio_timestamp = g_latest_audio_timestamp +
+      const bool first_write = (g_microphone.timestamp_ms == 0);
+      g_microphone.timestamp_ms = g_microphone.timestamp_ms +
           ((1000 * (bytes_written / 2)) / kAudioSampleFrequency);
+      if (first_write && g_microphone.timestamp_ms) {
+        xSemaphoreGive(g_audio_started);
+      }
+      if (bytes_written > 0) {
+        xSemaphoreGive(g_microphone.new_audio);
+      }
       if (bytes_written <= 0) {
-        ESP_LOGE(TAG, "Could Not Write in Ring Buffer: %d ", bytes_written);
-      } else if (bytes_written < bytes_read) {
-        ESP_LOGW(TAG, "Partial Write");
+        deferred_log(DLOG_RB_WRITE_ERROR, bytes_written, 0);
+      } else if (bytes_written < bytes_to_write) {
+        deferred_log(DLOG_RB_PARTIAL_WRITE, bytes_written, bytes_to_write);
       }
     }
   }
@@ -121,78 +161,138 @@ static void CaptureSamples(void* arg) {
 }
 
 TfLiteStatus InitAudioRecording() {
-  g_audio_capture_buffer = rb_init("tf_ringbuffer", kAudioCaptureBufferSize);
-  if (!g_audio_capture_buffer) {
+  if (g_is_audio_initialized) {
+    return kTfLiteOk;
+  }
+  if (deferred_log_start() != 0) {
+    ESP_LOGE(TAG, "Error starting deferred log task");
+    return kTfLiteError;
+  }
+  g_microphone.ring = rb_init("tf_ringbuffer", g_audio_capture_buffer_size);
+  if (!g_microphone.ring) {
     ESP_LOGE(TAG, "Error creating ring buffer");
     return kTfLiteError;
   }
+  g_audio_started = xSemaphoreCreateBinary();
+  g_microphone.new_audio = xSemaphoreCreateBinary();
+  if (!g_audio_started || !g_microphone.new_audio) {
+    ESP_LOGE(TAG, "Error creating audio start semaphore");
+    return kTfLiteError;
+  }
+  if (kAudioDecimationFactor > 1 && InitAudioDecimator() != kTfLiteOk) {
+    ESP_LOGE(TAG, "Error initializing the audio decimator");
+    return kTfLiteError;
+  }
+  if (audio_source_init() != kTfLiteOk) {
+    ESP_LOGE(TAG, "Error opening the audio source");
+    return kTfLiteError;
+  }
   /* create CaptureSamples Task which will get the i2s_data from mic and fill it
    * in the ring buffer */
   xTaskCreate(CaptureSamples, "CaptureSamples", 1024 * 4, NULL, 10, NULL);
-  while (!g_latest_audio_timestamp) {
-    vTaskDelay(1); // one tick delay to avoid watchdog
-  }
+  /* block until the first samples are in the ring buffer */
+  xSemaphoreTake(g_audio_started, portMAX_DELAY);
+  g_is_audio_initialized = true;
   ESP_LOGI(TAG, "Audio Recording started");
   return kTfLiteOk;
 }
 
-TfLiteStatus GetAudioSamples1(int* audio_samples_size, int16_t** audio_samples)
+AudioCapture* MicrophoneCapture() {
+  return g_is_audio_initialized ? &g_microphone : nullptr;
+}
+
+AudioReader::AudioReader(AudioCapture* capture)
+    : capture_(capture),
+      /* history_samples_to_keep = 10 * 16 for a 20ms stride */
+      history_samples_to_keep_((kFeatureDurationMs - kFeatureStrideMs) *
+                               kSamplesPerMs),
+      /* new samples to get each time from the ring, 20 * 16 */
+      new_samples_to_get_(kFeatureStrideMs * kSamplesPerMs),
+      audio_output_buffer_(),
+      history_buffer_() {}
+
+#if AUDIO_MODE != AUDIO_MODE_STREAMING
+TfLiteStatus AudioReader::GetAudioSamples1(int* audio_samples_size,
+                                           int16_t** audio_samples)
 {
-  if (!g_is_audio_initialized) {
-    TfLiteStatus init_status = InitAudioRecording();
-    if (init_status != kTfLiteOk) {
-      return init_status;
-    }
-    g_is_audio_initialized = true;
-  }
   int bytes_read =
-    rb_read(g_audio_capture_buffer, (uint8_t*)(g_audio_output_buffer), 16000, 1000);
+    rb_read(capture_->ring, (uint8_t*)(audio_output_buffer_),
+            sizeof(audio_output_buffer_), 1000);
   if (bytes_read < 0) {
-    ESP_LOGI(TAG, "Couldn't read data in time");
+    deferred_log(DLOG_RB_READ_TIMEOUT, 0, 0);
     bytes_read = 0;
   }
-  *audio_samples_size = bytes_read;
-  *audio_samples = g_audio_output_buffer;
+  *audio_samples_size = bytes_read / sizeof(int16_t);
+  *audio_samples = audio_output_buffer_;
   return kTfLiteOk;
 }
+#endif  // AUDIO_MODE != AUDIO_MODE_STREAMING
 
-TfLiteStatus GetAudioSamples(int start_ms, int duration_ms,
-                             int* audio_samples_size, int16_t** audio_samples) {
-  if (!g_is_audio_initialized) {
-    TfLiteStatus init_status = InitAudioRecording();
-    if (init_status != kTfLiteOk) {
-      return init_status;
-    }
-    g_is_audio_initialized = true;
-  }
+TfLiteStatus AudioReader::GetAudioSamples(int start_ms, int duration_ms,
+                                          int* audio_samples_size,
+                                          int16_t** audio_samples) {
   /* copy 160 samples (320 bytes) into output_buff from history */
-  memcpy((void*)(g_audio_output_buffer), (void*)(g_history_buffer),
-         history_samples_to_keep * sizeof(int16_t));
+  memcpy((void*)(audio_output_buffer_), (void*)(history_buffer_),
+         history_samples_to_keep_ * sizeof(int16_t));
 
-  /* copy 320 samples (640 bytes) from rb at ( int16_t*(g_audio_output_buffer) +
+  /* copy 320 samples (640 bytes) from rb at ( int16_t*(audio_output_buffer_) +
    * 160 ), first 160 samples (320 bytes) will be from history */
   int bytes_read =
-      rb_read(g_audio_capture_buffer,
-              ((uint8_t*)(g_audio_output_buffer + history_samples_to_keep)),
-              new_samples_to_get * sizeof(int16_t), pdMS_TO_TICKS(200));
+      rb_read(capture_->ring,
+              ((uint8_t*)(audio_output_buffer_ + history_samples_to_keep_)),
+              new_samples_to_get_ * sizeof(int16_t), pdMS_TO_TICKS(200));
   if (bytes_read < 0) {
-    ESP_LOGE(TAG, " Model Could not read data from Ring Buffer");
-  } else if (bytes_read < new_samples_to_get * sizeof(int16_t)) {
-    ESP_LOGD(TAG, "RB FILLED RIGHT NOW IS %d",
-             rb_filled(g_audio_capture_buffer));
-    ESP_LOGD(TAG, " Partial Read of Data by Model ");
-    ESP_LOGV(TAG, " Could only read %d bytes when required %d bytes ",
-             bytes_read, (int) (new_samples_to_get * sizeof(int16_t)));
+    deferred_log(DLOG_RB_READ_ERROR, bytes_read, 0);
+  } else if (bytes_read < new_samples_to_get_ * sizeof(int16_t)) {
+    deferred_log(DLOG_RB_PARTIAL_READ, bytes_read,
+                 new_samples_to_get_ * sizeof(int16_t));
   }
 
   /* copy 320 bytes from output_buff into history */
-  memcpy((void*)(g_history_buffer),
-         (void*)(g_audio_output_buffer + new_samples_to_get),
-         history_samples_to_keep * sizeof(int16_t));
+  memcpy((void*)(history_buffer_),
+         (void*)(audio_output_buffer_ + new_samples_to_get_),
+         history_samples_to_keep_ * sizeof(int16_t));
 
   *audio_samples_size = kMaxAudioSampleSize;
-  *audio_samples = g_audio_output_buffer;
+  *audio_samples = audio_output_buffer_;
   return kTfLiteOk;
 }
 
-int32_t LatestAudioTimestamp() { return g_latest_audio_timestamp; }
+TfLiteStatus AudioReader::SetAudioStride(int stride_ms) {
+  if (stride_ms < kMinFeatureStrideMs || stride_ms > kMaxFeatureStrideMs) {
+    ESP_LOGE(TAG, "Unsupported feature stride %d ms", stride_ms);
+    return kTfLiteError;
+  }
+  new_samples_to_get_ = stride_ms * kSamplesPerMs;
+  history_samples_to_keep_ = (kFeatureDurationMs - stride_ms) * kSamplesPerMs;
+  memset(history_buffer_, 0, sizeof(history_buffer_));
+  return kTfLiteOk;
+}
+
+bool AudioReader::WaitForNewAudio(int timeout_ms) {
+  return xSemaphoreTake(capture_->new_audio, pdMS_TO_TICKS(timeout_ms)) ==
+         pdTRUE;
+}
+
+bool AudioReader::GetAudioCaptureStats(rb_stats_t* stats) {
+#if CONFIG_RINGBUF_STATS
+  rb_get_stats(capture_->ring, stats);
+  rb_reset_stats(capture_->ring);
+  return true;
+#else
+  return false;
+#endif
+}
+
+void AudioReader::DropBacklog(int keep_ms) {
+  const ssize_t keep_bytes = keep_ms * kSamplesPerMs * sizeof(int16_t);
+  const ssize_t filled = rb_filled(capture_->ring);
+  if (filled > keep_bytes) {
+    rb_discard(capture_->ring, filled - keep_bytes);
+  }
+}
+
+int AudioReader::AudioBacklogMs() const {
+  const ssize_t filled = rb_filled(capture_->ring);
+  return filled > 0 ? filled / (kSamplesPerMs * sizeof(int16_t)) : 0;
+}
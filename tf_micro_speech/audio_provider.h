@@ -17,30 +17,85 @@ limitations under the License.
 #define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_AUDIO_PROVIDER_H_
 
 #include "tensorflow/lite/c/common.h"
+#include "micro_model_settings.h"
+#include "ringbuf.h"
+
+// Audio written into a capture ring by a capture task, and the clock of that
+// audio. The ring has a single reader, so a capture feeds one pipeline.
+struct AudioCapture {
+  ringbuf_t* ring;
+  // Milliseconds of audio written so far. There's no contract about what time
+  // zero represents; subsequent reads will generally not return a lower value,
+  // but even that's not guaranteed if there's an overflow wraparound.
+  volatile int32_t timestamp_ms;
+  // Given after every write, i.e. once per stride.
+  SemaphoreHandle_t new_audio;
+};
+
+// Starts capturing microphone audio into its capture ring and returns once the
+// first samples have arrived. Calling it again has no effect.
+TfLiteStatus InitAudioRecording();
+
+// The microphone capture, or nullptr until InitAudioRecording() succeeded.
+AudioCapture* MicrophoneCapture();
 
 // This is an abstraction around an audio source like a microphone, and is
 // expected to return 16-bit PCM sample data for a given point in time. The
 // sample data itself should be used as quickly as possible by the caller, since
 // to allow memory optimizations there are no guarantees that the samples won't
-// be overwritten by new data in the future. In practice, implementations should
-// ensure that there's a reasonable time allowed for clients to access the data
-// before any reuse.
-// The reference implementation can have no platform-specific dependencies, so
-// it just returns an array filled with zeros. For real applications, you should
-// ensure there's a specialized implementation that accesses hardware APIs.
-TfLiteStatus GetAudioSamples(int start_ms, int duration_ms,
-                             int* audio_samples_size, int16_t** audio_samples);
-
-TfLiteStatus GetAudioSamples1(int* audio_samples_size, int16_t** audio_samples);
-
-// Returns the time that audio data was last captured in milliseconds. There's
-// no contract about what time zero represents, the accuracy, or the granularity
-// of the result. Subsequent calls will generally not return a lower value, but
-// even that's not guaranteed if there's an overflow wraparound.
-// The reference implementation of this function just returns a constantly
-// incrementing value for each call, since it would need a non-portable platform
-// call to access time information. For real applications, you'll need to write
-// your own platform-specific implementation.
-int32_t LatestAudioTimestamp();
+// be overwritten by new data in the future. Each reader keeps the window
+// history of its own stream.
+class AudioReader {
+ public:
+  // Reads from |capture|, which must outlive the reader.
+  explicit AudioReader(AudioCapture* capture);
+
+  TfLiteStatus GetAudioSamples(int start_ms, int duration_ms,
+                               int* audio_samples_size,
+                               int16_t** audio_samples);
+
+#if AUDIO_MODE != AUDIO_MODE_STREAMING
+  // Returns one second of audio at a time, used by the clip modes only.
+  TfLiteStatus GetAudioSamples1(int* audio_samples_size,
+                                int16_t** audio_samples);
+#endif
+
+  // Sets how much new audio GetAudioSamples() returns per call; the rest of
+  // the window is repeated from the previous call. Must be called before
+  // features are generated at a new stride.
+  TfLiteStatus SetAudioStride(int stride_ms);
+
+  // Blocks until the capture task has written new audio, at most
+  // |timeout_ms|. Returns false on timeout.
+  bool WaitForNewAudio(int timeout_ms);
+
+  // Copies the load counters of the capture ring and restarts them. Returns
+  // false when they aren't collected (CONFIG_RINGBUF_STATS).
+  bool GetAudioCaptureStats(rb_stats_t* stats);
+
+  // Audio captured but not read yet, in milliseconds.
+  int AudioBacklogMs() const;
+
+  // Drops all but the newest |keep_ms| of unread audio, so that reading
+  // resumes close to live audio after nobody read the ring for a while.
+  void DropBacklog(int keep_ms);
+
+  // Returns the time that audio data was last captured in milliseconds.
+  int32_t LatestAudioTimestamp() const { return capture_->timestamp_ms; }
+
+ private:
+  static constexpr int32_t kSamplesPerMs = kAudioSampleFrequency / 1000;
+  static constexpr int32_t kMaxHistorySamples =
+      (kFeatureDurationMs - kMinFeatureStrideMs) * kSamplesPerMs;
+
+  AudioCapture* capture_;
+  // Each window is one stride (20ms by default) of new data from the capture
+  // ring and the rest of the 30ms window from the previous call, kept in the
+  // history buffer.
+  int32_t history_samples_to_keep_;
+  int32_t new_samples_to_get_;
+  int16_t audio_output_buffer_[kAudioOutputBufferSize];
+  int16_t history_buffer_[kMaxHistorySamples];
+};
 
 #endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_AUDIO_PROVIDER_H_
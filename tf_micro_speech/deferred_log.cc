@@ -0,0 +1,165 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "deferred_log.h"
+
+#include <atomic>
+#include <cstdio>
+
+// clang-format off
+#include "freertos/FreeRTOS.h"
+// clang-format on
+
+#include "esp_log.h"
+#include "freertos/queue.h"
+#include "freertos/task.h"
+
+namespace {
+const char* TAG = "TF_LITE_HOT_PATH";
+
+constexpr int kQueueLength = 32;
+constexpr int kTaskStackSize = 3 * 1024;
+// Below the capture task and level with the inference loop, so formatting
+// only happens when they are waiting.
+constexpr UBaseType_t kTaskPriority = 1;
+// Each message ID is printed at most this many times per window.
+constexpr int kRateLimitCount = 5;
+constexpr TickType_t kRateLimitWindow = pdMS_TO_TICKS(10000);
+constexpr int kLineLength = 96;
+
+struct Entry {
+  uint32_t timestamp_ms;
+  int32_t args[2];
+  uint8_t id;
+};
+
+struct Format {
+  esp_log_level_t level;
+  const char* format;
+};
+
+// Indexed by deferred_log_id. Every format takes exactly two int arguments;
+// unused ones are ignored.
+constexpr Format kFormats[] = {
+    {ESP_LOG_ERROR, "Error reading from codec %d"},
+    {ESP_LOG_ERROR, "Error in I2S read : %d"},
+    {ESP_LOG_WARN, "Partial I2S read: %d of %d bytes"},
+    {ESP_LOG_ERROR, "Could Not Write in Ring Buffer: %d"},
+    {ESP_LOG_WARN, "Partial Write: %d bytes out of %d"},
+    {ESP_LOG_INFO, "Couldn't read data in time"},
+    {ESP_LOG_ERROR, "Model Could not read data from Ring Buffer: %d"},
+    {ESP_LOG_DEBUG, "Partial Read of Data by Model: %d of %d bytes"},
+    {ESP_LOG_ERROR, "Audio data size %d too small, want %d"},
+    {ESP_LOG_ERROR, "Feature generator model invocation failed"},
+    {ESP_LOG_ERROR, "Feature generation failed"},
+    {ESP_LOG_ERROR, "Invoke failed: %d"},
+    {ESP_LOG_INFO, "Decimator: %d us average, %d us max per block"},
+};
+static_assert(sizeof(kFormats) / sizeof(kFormats[0]) == DLOG_ID_COUNT,
+              "kFormats must have one entry per deferred_log_id");
+
+struct RateLimit {
+  TickType_t window_start;
+  int printed;
+  uint32_t suppressed;
+};
+
+StaticQueue_t queue_buffer;
+uint8_t queue_storage[kQueueLength * sizeof(Entry)];
+QueueHandle_t queue = nullptr;
+
+std::atomic<uint32_t> dropped{0};
+std::atomic<uint32_t> suppressed{0};
+RateLimit rate_limits[DLOG_ID_COUNT];
+
+// Returns true if the entry may be printed. Reports how many were suppressed
+// once a new window starts.
+bool CheckRateLimit(const Entry& entry) {
+  RateLimit& limit = rate_limits[entry.id];
+  const TickType_t now = xTaskGetTickCount();
+  if (now - limit.window_start >= kRateLimitWindow) {
+    if (limit.suppressed > 0) {
+      ESP_LOGW(TAG, "%u messages like \"%s\" suppressed",
+               static_cast<unsigned>(limit.suppressed),
+               kFormats[entry.id].format);
+    }
+    limit = {now, 0, 0};
+  }
+  if (limit.printed == kRateLimitCount) {
+    limit.suppressed++;
+    suppressed.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  limit.printed++;
+  return true;
+}
+
+void FormatterTask(void* arg) {
+  Entry entry;
+  char line[kLineLength];
+  while (true) {
+    if (xQueueReceive(queue, &entry, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    if (entry.id >= DLOG_ID_COUNT || !CheckRateLimit(entry)) {
+      continue;
+    }
+
+    const Format& format = kFormats[entry.id];
+    snprintf(line, sizeof(line), format.format, entry.args[0], entry.args[1]);
+    ESP_LOG_LEVEL(format.level, TAG, "[%u ms] %s",
+                  static_cast<unsigned>(entry.timestamp_ms), line);
+  }
+}
+}  // namespace
+
+int deferred_log_start(void) {
+  if (queue != nullptr) {
+    return 0;
+  }
+  queue = xQueueCreateStatic(kQueueLength, sizeof(Entry), queue_storage,
+                             &queue_buffer);
+  if (queue == nullptr) {
+    return -1;
+  }
+  if (xTaskCreate(FormatterTask, "deferred_log", kTaskStackSize, nullptr,
+                  kTaskPriority, nullptr) != pdPASS) {
+    return -1;
+  }
+  return 0;
+}
+
+void deferred_log(enum deferred_log_id id, int32_t arg0, int32_t arg1) {
+  // Don't spend queue slots on messages the build would not print anyway.
+  if (kFormats[id].level > LOG_LOCAL_LEVEL) {
+    return;
+  }
+  const Entry entry = {
+      static_cast<uint32_t>(xTaskGetTickCount() * portTICK_PERIOD_MS),
+      {arg0, arg1},
+      static_cast<uint8_t>(id),
+  };
+  if (queue == nullptr || xQueueSendToBack(queue, &entry, 0) != pdTRUE) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+uint32_t deferred_log_dropped(void) {
+  return dropped.load(std::memory_order_relaxed);
+}
+
+uint32_t deferred_log_suppressed(void) {
+  return suppressed.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,65 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_DEFERRED_LOG_H_
+#define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_DEFERRED_LOG_H_
+
+// Logging for the capture and inference hot paths. Callers only push a message
+// ID and up to two integer arguments into a queue, which never blocks; a
+// low-priority task formats the messages, limits how often each one is printed
+// and writes them out. Messages that don't fit in the queue are dropped and
+// counted.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+enum deferred_log_id {
+  DLOG_CODEC_READ_ERROR,       // err
+  DLOG_I2S_READ_ERROR,         // bytes read
+  DLOG_I2S_PARTIAL_READ,       // bytes read, bytes wanted
+  DLOG_RB_WRITE_ERROR,         // rb_write() result
+  DLOG_RB_PARTIAL_WRITE,       // bytes written, bytes read
+  DLOG_RB_READ_TIMEOUT,        // -
+  DLOG_RB_READ_ERROR,          // rb_read() result
+  DLOG_RB_PARTIAL_READ,        // bytes read, bytes wanted
+  DLOG_AUDIO_TOO_SMALL,        // samples, samples wanted
+  DLOG_PREPROCESSOR_FAILED,    // -
+  DLOG_FEATURES_FAILED,        // -
+  DLOG_INVOKE_FAILED,          // TfLiteStatus
+  DLOG_DECIMATOR_STATS,        // average us, max us per block
+  DLOG_ID_COUNT,
+};
+
+// Starts the formatter task. Messages pushed before this are dropped. Returns
+// 0 on success.
+int deferred_log_start(void);
+
+// Queues a message. Safe to call from any task, never blocks.
+void deferred_log(enum deferred_log_id id, int32_t arg0, int32_t arg1);
+
+// Messages lost because the queue was full or not started yet.
+uint32_t deferred_log_dropped(void);
+
+// Messages not printed because their ID exceeded its rate limit.
+uint32_t deferred_log_suppressed(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_DEFERRED_LOG_H_
@@ -18,10 +18,12 @@ limitations under the License.
 
 #include <esp_log.h>
 
+#include <algorithm>
 #include <cstring>
 #include "feature_provider.h"
 
 #include "audio_provider.h"
+#include "deferred_log.h"
 #include "micro_features_generator.h"
 #include "micro_model_settings.h"
 #include "tensorflow/lite/micro/micro_log.h"
@@ -33,13 +35,23 @@ extern const uint8_t no_1000ms_start[]        asm("_binary_no_1000ms_wav_start")
 extern const uint8_t noise_1000ms_start[]     asm("_binary_noise_1000ms_wav_start");
 extern const uint8_t silence_1000ms_start[]   asm("_binary_silence_1000ms_wav_start");
 
-Features g_features;
-const char *TAG = "feature_provider";
+static const char *TAG = "feature_provider";
 
-FeatureProvider::FeatureProvider(int feature_size, int8_t* feature_data)
+FeatureProvider::FeatureProvider(int feature_size, int8_t* feature_data,
+                                 AudioReader* audio, SharedArena* arena)
     : feature_size_(feature_size),
       feature_data_(feature_data),
-      is_first_run_(true) {
+      audio_(audio),
+      generator_(arena),
+      features_(),
+#if AUDIO_MODE == AUDIO_MODE_TEST_CLIPS
+      clip_index_(0),
+#endif
+      feature_count_(kFeatureCount),
+      stride_ms_(kFeatureStrideMs),
+      is_first_run_(true),
+      needs_refill_(true),
+      refilled_(false) {
   // Initialize the feature data to default values.
   for (int n = 0; n < feature_size_; ++n) {
     feature_data_[n] = 0;
@@ -48,38 +60,62 @@ FeatureProvider::FeatureProvider(int feature_size, int8_t* feature_data)
 
 FeatureProvider::~FeatureProvider() {}
 
-TfLiteStatus FeatureProvider::PopulateFeatureData(
-    int32_t last_time_in_ms, int32_t time_in_ms, int* how_many_new_slices) {
-  if (feature_size_ != kFeatureElementCount) {
-    MicroPrintf("Requested feature_data_ size %d doesn't match %d",
-                feature_size_, kFeatureElementCount);
-    return kTfLiteError;
+TfLiteStatus FeatureProvider::Initialize() {
+  if (!is_first_run_) {
+    return kTfLiteOk;
   }
+  TF_LITE_ENSURE_STATUS(generator_.Initialize());
+  ESP_LOGI(TAG, "Audio preprocessor initialized");
+  is_first_run_ = false;
+  needs_refill_ = true;
+  return kTfLiteOk;
+}
 
-  // Quantize the time into steps as long as each window stride, so we can
-  // figure out which audio data we need to fetch.
-  const int last_step = (last_time_in_ms / kFeatureStrideMs);
-  const int current_step = (time_in_ms / kFeatureStrideMs);
+void FeatureProvider::Release() {
+  generator_.Release();
+  is_first_run_ = true;
+}
 
-  int slices_needed = current_step - last_step;
-  // If this is the first call, make sure we don't use any cached information.
-  if (is_first_run_) {
-    TfLiteStatus init_status = InitializeMicroFeatures();
-    if (init_status != kTfLiteOk) {
-      return init_status;
-    }
-    ESP_LOGI(TAG, "InitializeMicroFeatures successful");
-    is_first_run_ = false;
-    slices_needed = kFeatureCount;
+TfLiteStatus FeatureProvider::SetGeometry(int feature_count, int stride_ms) {
+  if (feature_count < 1 || feature_count * kFeatureSize > feature_size_) {
+    MicroPrintf("Requested %d feature slices, room for %d", feature_count,
+                feature_size_ / kFeatureSize);
+    return kTfLiteError;
   }
-#if 1
-  if (slices_needed > kFeatureCount) {
-    slices_needed = kFeatureCount;
+#if AUDIO_MODE != AUDIO_MODE_STREAMING
+  if (feature_count != kFeatureCount || stride_ms != kFeatureStrideMs) {
+    MicroPrintf("Clip modes only support %d slices at %d ms", kFeatureCount,
+                kFeatureStrideMs);
+    return kTfLiteError;
   }
-  *how_many_new_slices = slices_needed;
+#endif
 
-  const int slices_to_keep = kFeatureCount - slices_needed;
-  const int slices_to_drop = kFeatureCount - slices_to_keep;
+  if (stride_ms != stride_ms_) {
+    TF_LITE_ENSURE_STATUS(audio_->SetAudioStride(stride_ms));
+    stride_ms_ = stride_ms;
+    feature_count_ = feature_count;
+    memset(feature_data_, 0, feature_count_ * kFeatureSize);
+    needs_refill_ = true;
+    return kTfLiteOk;
+  }
+
+  // Keep the newest slices aligned with the end of the spectrogram; slices
+  // that did not exist before start out empty.
+  const int keep = std::min(feature_count_, feature_count);
+  memmove(feature_data_ + (feature_count - keep) * kFeatureSize,
+          feature_data_ + (feature_count_ - keep) * kFeatureSize,
+          keep * kFeatureSize);
+  memset(feature_data_, 0, (feature_count - keep) * kFeatureSize);
+  feature_count_ = feature_count;
+  return kTfLiteOk;
+}
+
+template <int kCount>
+TfLiteStatus FeatureProvider::PopulateSlices(int current_step,
+                                             int slices_needed) {
+  const int count = kCount ? kCount : feature_count_;
+  const int slices_to_keep = count - slices_needed;
+  const int slices_to_drop = count - slices_to_keep;
   // If we can avoid recalculating some slices, just move the existing data
   // up in the spectrogram, to perform something like this:
   // last time = 80ms          current time = 120ms
@@ -107,19 +143,19 @@ TfLiteStatus FeatureProvider::PopulateFeatureData(
   // Any slices that need to be filled in with feature data have their
   // appropriate audio data pulled, and features calculated for that slice.
   if (slices_needed > 0) {
-    for (int new_slice = slices_to_keep; new_slice < kFeatureCount;
+    for (int new_slice = slices_to_keep; new_slice < count;
          ++new_slice) {
-      const int new_step = (current_step - kFeatureCount + 1) + new_slice;
-      const int32_t slice_start_ms = (new_step * kFeatureStrideMs);
+      const int new_step = (current_step - count + 1) + new_slice;
+      const int32_t slice_start_ms = (new_step * stride_ms_);
       int16_t* audio_samples = nullptr;
       int audio_samples_size = 0;
       // TODO(petewarden): Fix bug that leads to non-zero slice_start_ms
-      GetAudioSamples((slice_start_ms > 0 ? slice_start_ms : 0),
-                      kFeatureDurationMs, &audio_samples_size,
-                      &audio_samples);
+      audio_->GetAudioSamples((slice_start_ms > 0 ? slice_start_ms : 0),
+                              kFeatureDurationMs, &audio_samples_size,
+                              &audio_samples);
       if (audio_samples_size < kMaxAudioSampleSize) {
-        MicroPrintf("Audio data size %d too small, want %d",
-                    audio_samples_size, kMaxAudioSampleSize);
+        deferred_log(DLOG_AUDIO_TOO_SMALL, audio_samples_size,
+                     kMaxAudioSampleSize);
         return kTfLiteError;
       }
       int8_t* new_slice_data = feature_data_ + (new_slice * kFeatureSize);
@@ -127,27 +163,72 @@ TfLiteStatus FeatureProvider::PopulateFeatureData(
       // TfLiteStatus generate_status = GenerateMicroFeatures(
       //     audio_samples, audio_samples_size, kFeatureSize,
       //     new_slice_data, &num_samples_read);
-      TfLiteStatus generate_status = GenerateFeatures(
-            audio_samples, audio_samples_size, &g_features);
+      TfLiteStatus generate_status = generator_.Generate(
+            audio_samples, audio_samples_size, &features_);
       if (generate_status != kTfLiteOk) {
         return generate_status;
       }
 
       // copy features
       for (int j = 0; j < kFeatureSize; ++j) {
-        new_slice_data[j] = g_features[0][j];
+        new_slice_data[j] = features_[0][j];
       }
     }
   }
-#elif 1
+  return kTfLiteOk;
+}
+
+TfLiteStatus FeatureProvider::GenerateSlice(const int16_t* window, bool reset,
+                                            int8_t* slice) {
+  TF_LITE_ENSURE_STATUS(Initialize());
+  if (reset) {
+    TF_LITE_ENSURE_STATUS(generator_.Reset());
+  }
+  needs_refill_ = true;
+
+  TF_LITE_ENSURE_STATUS(generator_.Generate(
+      window, kFeatureDurationMs * kAudioSampleFrequency / 1000, &features_));
+  std::copy_n(features_[0], kFeatureSize, slice);
+  return kTfLiteOk;
+}
+
+TfLiteStatus FeatureProvider::PopulateFeatureData(
+    int32_t last_time_in_ms, int32_t time_in_ms, int* how_many_new_slices) {
+  // Quantize the time into steps as long as each window stride, so we can
+  // figure out which audio data we need to fetch.
+  const int last_step = (last_time_in_ms / stride_ms_);
+  const int current_step = (time_in_ms / stride_ms_);
+
+  int slices_needed = current_step - last_step;
+  // If this is the first call, make sure we don't use any cached information.
+  TF_LITE_ENSURE_STATUS(Initialize());
+  refilled_ = needs_refill_;
+  if (needs_refill_) {
+    needs_refill_ = false;
+    slices_needed = feature_count_;
+  }
+#if AUDIO_MODE == AUDIO_MODE_STREAMING
+  if (slices_needed >= feature_count_) {
+    // The whole spectrogram is rebuilt, so build it from the newest audio
+    // rather than from what piled up in the ring while nobody read it.
+    slices_needed = feature_count_;
+    audio_->DropBacklog(feature_count_ * stride_ms_);
+  }
+  *how_many_new_slices = slices_needed;
+
+  if (feature_count_ == kDefaultSpectrogramCount) {
+    return PopulateSlices<kDefaultSpectrogramCount>(current_step,
+                                                    slices_needed);
+  }
+  return PopulateSlices<0>(current_step, slices_needed);
+#elif AUDIO_MODE == AUDIO_MODE_TEST_CLIPS
     *how_many_new_slices = kFeatureCount;
     int16_t* audio_samples = nullptr;
     int audio_samples_size = 0;
     // GetAudioSamples(0, kFeatureDurationMs, &audio_samples_size, &audio_samples);
-    static int cnt = 0;
     audio_samples = (int16_t *) (silence_1000ms_start + 44);
 
-    switch(cnt++ % 4) {
+    switch(clip_index_++ % 4) {
       case 0:
         audio_samples = (int16_t *) (yes_1000ms_start + 44);
         break;
@@ -163,39 +244,37 @@ TfLiteStatus FeatureProvider::PopulateFeatureData(
       default:
         break;
     }
-    audio_samples_size = 16000;
+    audio_samples_size = kAudioClipSampleCount;
 
-    GetAudioSamples1(&audio_samples_size, &audio_samples);
-
-    TfLiteStatus generate_status = GenerateFeatures(
-          audio_samples, audio_samples_size, &g_features);
+    TfLiteStatus generate_status = generator_.Generate(
+          audio_samples, audio_samples_size, &features_);
     if (generate_status != kTfLiteOk) {
       return generate_status;
     }
     // copy features
     for (int i = 0; i < kFeatureCount; ++i) {
       for (int j = 0; j < kFeatureSize; ++j) {
-        feature_data_[i * kFeatureSize + j] = g_features[i][j];
+        feature_data_[i * kFeatureSize + j] = features_[i][j];
       }
     }
     vTaskDelay(pdMS_TO_TICKS(500));
 #else
     *how_many_new_slices = kFeatureCount;
     int16_t* audio_samples = nullptr;
-    int audio_samples_size = 16000;
-    GetAudioSamples(0, kFeatureDurationMs, &audio_samples_size, &audio_samples);
+    int audio_samples_size = 0;
+    audio_->GetAudioSamples1(&audio_samples_size, &audio_samples);
 
-    memset(g_features, 0, sizeof(g_features));
+    memset(features_, 0, sizeof(features_));
 
-    TfLiteStatus generate_status = GenerateFeatures(
-          audio_samples, audio_samples_size, &g_features);
+    TfLiteStatus generate_status = generator_.Generate(
+          audio_samples, audio_samples_size, &features_);
     if (generate_status != kTfLiteOk) {
       return generate_status;
     }
     // copy features
     for (int i = 0; i < kFeatureCount; ++i) {
       for (int j = 0; j < kFeatureSize; ++j) {
-        feature_data_[i * kFeatureSize + j] = g_features[i][j];
+        feature_data_[i * kFeatureSize + j] = features_[i][j];
       }
     }
     vTaskDelay(pdMS_TO_TICKS(500));
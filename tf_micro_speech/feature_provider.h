@@ -17,6 +17,10 @@ limitations under the License.
 #define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_FEATURE_PROVIDER_H_
 
 #include "tensorflow/lite/c/common.h"
+#include "micro_features_generator.h"
+
+class AudioReader;
+class SharedArena;
 
 // Binds itself to an area of memory intended to hold the input features for an
 // audio-recognition neural network model, and fills that data area with the
@@ -30,21 +34,67 @@ class FeatureProvider {
   // Create the provider, and bind it to an area of memory. This memory should
   // remain accessible for the lifetime of the provider object, since subsequent
   // calls will fill it with feature data. The provider does no memory
-  // management of this data.
-  FeatureProvider(int feature_size, int8_t* feature_data);
+  // management of this data. Audio comes from |audio| and the preprocessor
+  // takes a section of |arena|; both must outlive the provider.
+  FeatureProvider(int feature_size, int8_t* feature_data, AudioReader* audio,
+                  SharedArena* arena);
   ~FeatureProvider();
 
+  // Sets up the audio preprocessor, which takes a persistent section of the
+  // arena. Done on first use otherwise.
+  TfLiteStatus Initialize();
+
+  // Destroys the audio preprocessor. It is set up again on the next call that
+  // needs it, so the arena must have room for it again by then.
+  void Release();
+
   // Fills the feature data with information from audio inputs, and returns how
   // many feature slices were updated.
   TfLiteStatus PopulateFeatureData(int32_t last_time_in_ms, int32_t time_in_ms,
                                    int* how_many_new_slices);
 
+  // Sets how many slices the spectrogram holds and the stride between them.
+  // When only the count changes, the newest slices are kept at the end of the
+  // feature data; a new stride restarts the spectrogram. Defaults to
+  // kFeatureCount slices at kFeatureStrideMs.
+  TfLiteStatus SetGeometry(int feature_count, int stride_ms);
+
+  // Computes one spectrogram slice from kFeatureDurationMs of audio that does
+  // not come from the microphone, e.g. a regression clip. |reset| clears the
+  // front-end state carried over from earlier audio. The streaming spectrogram
+  // is rebuilt from the capture ring on the next PopulateFeatureData() call.
+  TfLiteStatus GenerateSlice(const int16_t* window, bool reset, int8_t* slice);
+
+  int feature_count() const { return feature_count_; }
+  int stride_ms() const { return stride_ms_; }
+  // True when the last PopulateFeatureData() call rebuilt the spectrogram
+  // after a restart (first run, new stride, audio from another source). Its
+  // slices are then not new windows that the models missed.
+  bool refilled() const { return refilled_; }
+
  private:
+  // Streaming update of the spectrogram. kCount is the slice count when it is
+  // known at compile time (kDefaultSpectrogramCount), 0 to use feature_count_.
+  template <int kCount>
+  TfLiteStatus PopulateSlices(int current_step, int slices_needed);
+
   int feature_size_;
   int8_t* feature_data_;
+  AudioReader* audio_;
+  MicroFeaturesGenerator generator_;
+  // Output of the generator, copied into the spectrogram.
+  Features features_;
+#if AUDIO_MODE == AUDIO_MODE_TEST_CLIPS
+  int clip_index_;
+#endif
+  int feature_count_;
+  int stride_ms_;
   // Make sure we don't try to use cached information if this is the first call
   // into the provider.
   bool is_first_run_;
+  // Set when none of the slices in the feature data can be reused.
+  bool needs_refill_;
+  bool refilled_;
 };
 
 #endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_FEATURE_PROVIDER_H_
@@ -0,0 +1,90 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "inference_cadence.h"
+
+#include <algorithm>
+
+namespace {
+// Inference steps per evaluation period.
+constexpr uint32_t kEvaluationSteps = 50;
+// The cadence is raised above this load and only lowered if the lower cadence
+// is predicted to stay under the second, so it doesn't oscillate.
+constexpr int64_t kRaiseLoadPct = 85;
+constexpr int64_t kLowerLoadPct = 70;
+// Audio left in the capture ring after a step, in strides, that means the loop
+// is falling behind whatever the measured load.
+constexpr int kMaxBacklogStrides = 3;
+}  // namespace
+
+InferenceCadence::InferenceCadence(int max_strides)
+    : max_strides_(std::max(max_strides, 1)) {}
+
+int InferenceCadence::AddStrides(int new_slices) {
+  strides_since_invoke_ += new_slices;
+  if (strides_since_invoke_ < strides_) {
+    return 0;
+  }
+  const int strides = strides_since_invoke_;
+  strides_since_invoke_ = 0;
+  return strides;
+}
+
+void InferenceCadence::RecordFeatures(int slices, int64_t elapsed_us) {
+  slices_ += slices;
+  feature_us_ += elapsed_us;
+}
+
+void InferenceCadence::RecordClassifiers(int64_t elapsed_us) {
+  classifier_steps_++;
+  classifier_us_ += elapsed_us;
+}
+
+void InferenceCadence::RecordBacklog(int backlog_ms) {
+  max_backlog_ms_ = std::max(max_backlog_ms_, backlog_ms);
+}
+
+int64_t InferenceCadence::LoadPct(int strides, int stride_ms) const {
+  const int64_t per_stride_us = feature_us_ / slices_ +
+                                classifier_us_ / classifier_steps_ / strides;
+  return per_stride_us * 100 / (stride_ms * 1000);
+}
+
+bool InferenceCadence::Update(int stride_ms) {
+  if (++steps_ < kEvaluationSteps || slices_ == 0 || classifier_steps_ == 0) {
+    return false;
+  }
+
+  load_pct_ = static_cast<int>(LoadPct(strides_, stride_ms));
+  backlog_ms_ = max_backlog_ms_;
+  const bool behind = backlog_ms_ >= kMaxBacklogStrides * stride_ms;
+  const int previous = strides_;
+  if ((load_pct_ > kRaiseLoadPct || behind) && strides_ < max_strides_) {
+    strides_++;
+    increases_++;
+  } else if (strides_ > 1 && !behind &&
+             LoadPct(strides_ - 1, stride_ms) < kLowerLoadPct) {
+    strides_--;
+    decreases_++;
+  }
+
+  steps_ = 0;
+  slices_ = 0;
+  feature_us_ = 0;
+  classifier_steps_ = 0;
+  classifier_us_ = 0;
+  max_backlog_ms_ = 0;
+  return strides_ != previous;
+}
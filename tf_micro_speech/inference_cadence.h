@@ -0,0 +1,74 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_INFERENCE_CADENCE_H_
+#define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_INFERENCE_CADENCE_H_
+
+// Decides how many strides pass between classifier invokes. Spectrogram slices
+// are still generated every stride; only the classifiers skip steps. The
+// cadence follows the measured cost of the audio front-end per slice and of
+// the classifiers per invoke, compared with the audio time they cover, and the
+// backlog in the capture ring, which grows whenever the loop falls behind.
+
+#include <cstdint>
+
+class InferenceCadence {
+ public:
+  explicit InferenceCadence(int max_strides);
+
+  // Adds the strides of a step. Returns how many strides the classifiers
+  // should now cover, or 0 if they skip this step.
+  int AddStrides(int new_slices);
+
+  void RecordFeatures(int slices, int64_t elapsed_us);
+  void RecordClassifiers(int64_t elapsed_us);
+  void RecordBacklog(int backlog_ms);
+
+  // Re-evaluates the cadence once per evaluation period. Returns true when it
+  // changed.
+  bool Update(int stride_ms);
+
+  // Strides between classifier invokes.
+  int strides() const { return strides_; }
+  uint32_t increases() const { return increases_; }
+  uint32_t decreases() const { return decreases_; }
+  // Share of the audio time spent on features and classifiers, and the
+  // largest capture backlog, over the last evaluation period.
+  int load_pct() const { return load_pct_; }
+  int backlog_ms() const { return backlog_ms_; }
+
+ private:
+  // Percent of the audio time that |strides| would take with the costs
+  // measured in this period.
+  int64_t LoadPct(int strides, int stride_ms) const;
+
+  const int max_strides_;
+  int strides_ = 1;
+  int strides_since_invoke_ = 0;
+  uint32_t increases_ = 0;
+  uint32_t decreases_ = 0;
+  int load_pct_ = 0;
+  int backlog_ms_ = 0;
+
+  // Current evaluation period.
+  uint32_t steps_ = 0;
+  uint32_t slices_ = 0;
+  int64_t feature_us_ = 0;
+  uint32_t classifier_steps_ = 0;
+  int64_t classifier_us_ = 0;
+  int max_backlog_ms_ = 0;
+};
+
+#endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_INFERENCE_CADENCE_H_
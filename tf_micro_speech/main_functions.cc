@@ -14,156 +14,120 @@ See the License for the specific language governing permissions and
 limitations under the License.
 ==============================================================================*/
 
-#include <algorithm>
-#include <cstdint>
-#include <iterator>
-
 #include "main_functions.h"
 
+#include <cstdint>
+#include <new>
+
 #include "audio_provider.h"
-#include "feature_provider.h"
-#include "micro_model_settings.h"
-#include "model_handler.h"
-#include "tensorflow/lite/micro/system_setup.h"
-#include "tensorflow/lite/schema/schema_generated.h"
-#include "tensorflow/lite/core/c/common.h"
+#include "shared_arena.h"
+#include "speech_pipeline.h"
 #include "tensorflow/lite/micro/micro_interpreter.h"
 #include "tensorflow/lite/micro/micro_log.h"
-#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
 
-// Globals, used for compatibility with Arduino-style sketches.
 namespace {
-const tflite::Model* model = nullptr;
-tflite::MicroInterpreter* interpreter = nullptr;
-TfLiteTensor* model_input = nullptr;
-FeatureProvider* feature_provider = nullptr;
-int32_t previous_time = 0;
-
-// Create an area of memory to use for input, output, and intermediate arrays.
-// The size of this will depend on the model you're using, and may need to be
-// determined by experimentation.
-constexpr int kTensorArenaSize = 30 * 1024;
-uint8_t tensor_arena[kTensorArenaSize];
-int8_t feature_buffer[kFeatureElementCount];
-int8_t* model_input_buffer = nullptr;
+// The pipeline behind the C interface, scoring the microphone. It is built in
+// place on first use so that tf_micro_speech_deinit() can tear it down and a
+// later tf_micro_speech_add_model() can build a fresh one.
+alignas(SpeechPipeline) uint8_t g_pipeline_storage[sizeof(SpeechPipeline)];
+SpeechPipeline* pipeline = nullptr;
+// The budget of g_pipeline_storage grows by one interpreter per model, so
+// tools/memory_budget.py reads their size from here. Being volatile, the
+// pipeline's log really reads it and the linker keeps it in the ELF.
+const volatile uint32_t g_interpreter_size = sizeof(tflite::MicroInterpreter);
 }  // namespace
 
-void tf_micro_speech_init(struct tf_model_ctx *ctx) {
-  // Map the model into a usable data structure. This doesn't involve any
-  // copying or parsing, it's a very lightweight operation.
-  model = tflite::GetModel(ctx->data);
-  if (model->version() != TFLITE_SCHEMA_VERSION) {
-    MicroPrintf("Model provided is schema version %d not equal to supported "
-                "version %d.", model->version(), TFLITE_SCHEMA_VERSION);
-    return;
-  }
+int tf_micro_speech_start_audio(void) {
+  return (InitAudioRecording() == kTfLiteOk) ? 0 : -1;
+}
 
-  // Pull in only the operation implementations we need.
-  // This relies on a complete list of all the ops needed by this graph.
-  // An easier approach is to just use the AllOpsResolver, but this will
-  // incur some penalty in code space for op implementations that are not
-  // needed by this graph.
-  //
-  // tflite::AllOpsResolver resolver;
-  // NOLINTNEXTLINE(runtime-global-variables)
-  static tflite::MicroMutableOpResolver<5> micro_op_resolver;
-  if (micro_op_resolver.AddDepthwiseConv2D() != kTfLiteOk) {
-    return;
-  }
-  if (micro_op_resolver.AddConv2D() != kTfLiteOk) {
-    return;
-  }
-  if (micro_op_resolver.AddFullyConnected() != kTfLiteOk) {
-    return;
-  }
-  if (micro_op_resolver.AddSoftmax() != kTfLiteOk) {
-    return;
-  }
-  if (micro_op_resolver.AddReshape() != kTfLiteOk) {
-    return;
+int tf_micro_speech_add_model(struct tf_model_ctx *ctx) {
+  if (pipeline == nullptr) {
+    if (InitAudioRecording() != kTfLiteOk) {
+      return -1;
+    }
+    pipeline = new (g_pipeline_storage)
+        SpeechPipeline(MicrophoneCapture(), GetStaticSharedArena());
+    MicroPrintf("Pipeline: %u bytes, %u byte interpreters",
+                static_cast<unsigned>(sizeof(SpeechPipeline)),
+                static_cast<unsigned>(g_interpreter_size));
   }
+  return pipeline->AddModel(ctx);
+}
 
-  // Build an interpreter to run the model with.
-  static tflite::MicroInterpreter static_interpreter(
-      model, micro_op_resolver, tensor_arena, kTensorArenaSize);
-  interpreter = &static_interpreter;
+int tf_micro_speech_set_gate(struct tf_model_ctx *ctx, int hold_ms) {
+  return pipeline ? pipeline->SetGate(ctx, hold_ms) : -1;
+}
 
-  // Allocate memory from the tensor_arena for the model's tensors.
-  TfLiteStatus allocate_status = interpreter->AllocateTensors();
-  if (allocate_status != kTfLiteOk) {
-    MicroPrintf("AllocateTensors() failed");
-    return;
+enum tf_shadow_start tf_micro_speech_start_shadow(
+    struct tf_model_ctx *ctx, const struct tf_shadow_config *config) {
+  return pipeline ? pipeline->StartShadow(ctx, config) : TF_SHADOW_START_ERROR;
+}
+
+enum tf_shadow_verdict tf_micro_speech_shadow_verdict(
+    struct tf_shadow_report *report) {
+  return pipeline ? pipeline->ShadowVerdict(report) : TF_SHADOW_NONE;
+}
+
+void tf_micro_speech_stop_shadow(void) {
+  if (pipeline) {
+    pipeline->StopShadow();
   }
+}
 
-  // Get information about the memory area to use for the model's input.
-  model_input = interpreter->input(0);
-  if ((model_input->dims->size != 2) || (model_input->dims->data[0] != 1) ||
-      (model_input->dims->data[1] !=
-       (kFeatureCount * kFeatureSize)) ||
-      (model_input->type != kTfLiteInt8)) {
-    MicroPrintf("Bad input tensor parameters in model");
-    return;
+enum tf_corpus_status tf_micro_speech_run_corpus(
+    struct tf_model_ctx *ctx, const char *dir,
+    struct tf_corpus_report *report) {
+  if (pipeline == nullptr) {
+    *report = {};
+    return TF_CORPUS_ERROR;
   }
-  model_input_buffer = tflite::GetTensorData<int8_t>(model_input);
+  return pipeline->RunCorpus(ctx, dir, report);
+}
 
-  // Prepare to access the audio spectrograms from a microphone or other source
-  // that will provide the inputs to the neural network.
-  // NOLINTNEXTLINE(runtime-global-variables)
-  static FeatureProvider static_feature_provider(kFeatureElementCount,
-                                                 feature_buffer);
-  feature_provider = &static_feature_provider;
+void tf_micro_speech_run_inference(void) {
+  if (pipeline) {
+    pipeline->RunInference();
+  }
+}
 
-  previous_time = 0;
+bool tf_micro_speech_pop_result(struct tf_result *result) {
+  return pipeline ? pipeline->PopResult(result) : false;
 }
 
-void tf_micro_speech_run_inference(struct tf_model_ctx *ctx) {
-  // Fetch the spectrogram for the current time.
-  const int32_t current_time = LatestAudioTimestamp();
-  int how_many_new_slices = 0;
-  TfLiteStatus feature_status = feature_provider->PopulateFeatureData(
-      previous_time, current_time, &how_many_new_slices);
-  if (feature_status != kTfLiteOk) {
-    MicroPrintf( "Feature generation failed");
-    return;
-  }
-  previous_time = current_time;
-  // If no new audio samples have been received since last time, don't bother
-  // running the network model.
-  if (how_many_new_slices == 0) {
-    return;
-  }
+const char *tf_micro_speech_label(int model, int label) {
+  return pipeline ? pipeline->Label(model, label) : "";
+}
 
-  // Copy feature buffer to input tensor
-  for (int i = 0; i < kFeatureElementCount; i++) {
-    model_input_buffer[i] = feature_buffer[i];
-  }
+uint32_t tf_micro_speech_dropped_results(void) {
+  return pipeline ? pipeline->dropped_results() : 0;
+}
 
-  // Run the model on the spectrogram input and make sure it succeeds.
-  TfLiteStatus invoke_status = interpreter->Invoke();
-  if (invoke_status != kTfLiteOk) {
-    MicroPrintf( "Invoke failed");
+int64_t tf_micro_speech_first_inference_us(void) {
+  return pipeline ? pipeline->first_inference_us() : -1;
+}
+
+void tf_micro_speech_get_cadence(struct tf_cadence_report *report) {
+  if (pipeline == nullptr) {
+    *report = {};
+    report->strides = 1;
     return;
   }
+  pipeline->GetCadence(report);
+}
 
-  // Obtain a pointer to the output tensor
-  TfLiteTensor* output = interpreter->output(0);
-  // using simple argmax instead of recognizer
-  float output_scale = output->params.scale;
-  int output_zero_point = output->params.zero_point;
-  int max_idx = 0;
-  float max_result = 0.0;
-  // Dequantize output values and find the max
-  for (int i = 0; i < ctx->label_count; i++) {
-    float current_result =
-        (tflite::GetTensorData<int8_t>(output)[i] - output_zero_point) *
-        output_scale;
-    if (current_result > max_result) {
-      max_result = current_result; // update max result
-      max_idx = i; // update category
-    }
+void tf_micro_speech_get_cascade(struct tf_cascade_report *report) {
+  if (pipeline == nullptr) {
+    *report = {};
+    return;
   }
-  if (max_result > 0.8f) {
-    MicroPrintf("Detected %7s, score: %.2f", ctx->labels[max_idx],
-        static_cast<double>(max_result));
+  pipeline->GetCascade(report);
+}
+
+void tf_micro_speech_deinit(void) {
+  if (pipeline == nullptr) {
+    return;
   }
+  pipeline->~SpeechPipeline();
+  pipeline = nullptr;
 }
@@ -22,14 +22,203 @@ limitations under the License.
 extern "C" {
 #endif
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
-// Initializes all data needed for the example.
-void tf_micro_speech_init(struct tf_model_ctx *ctx);
+struct tf_model_ctx;
 
-// Runs one iteration of data gathering and inference. This should be called
-// repeatedly from the application code.
-void tf_micro_speech_run_inference(struct tf_model_ctx *ctx);
+enum tf_shadow_verdict {
+  TF_SHADOW_NONE,     // No candidate is being evaluated
+  TF_SHADOW_PENDING,  // Not enough detections compared yet, time left
+  TF_SHADOW_PROMOTE,  // Candidate met the latency and agreement bounds
+  TF_SHADOW_REJECT,   // Candidate is slower or disagrees too often
+};
+
+enum tf_shadow_start {
+  TF_SHADOW_START_OK,
+  // The candidate is valid but uses a different feature stride, so it can't
+  // share the running spectrogram.
+  TF_SHADOW_START_STRIDE_MISMATCH,
+  // No arena section is free for the candidate right now.
+  TF_SHADOW_START_NO_MEMORY,
+  // The candidate can't be built or doesn't fit a full arena section, or a
+  // shadow is already running.
+  TF_SHADOW_START_ERROR,
+};
+
+struct tf_shadow_config {
+  // Run the candidate on every Nth inference step.
+  int duty_cycle;
+  // Detections to compare before a verdict is given.
+  uint32_t min_compared;
+  // Highest allowed candidate latency, in percent of the active model's.
+  int max_latency_pct;
+  // Lowest allowed share of compared detections where both models agree.
+  int min_agreement_pct;
+  // Seconds after which a verdict is given on the detections compared so far,
+  // or 0 to wait for |min_compared|.
+  uint32_t max_duration_s;
+};
+
+// Number of best scores reported per detection.
+#define TF_RESULT_TOP_K 3
+
+struct tf_score {
+  int label;
+  // Output as computed by the model, and dequantized.
+  int8_t q_score;
+  float score;
+};
+
+// A keyword detection by one of the loaded models.
+struct tf_result {
+  // Model index, in the order the models were added. Label names are looked
+  // up with tf_micro_speech_label().
+  int model;
+  // Audio timestamp, in milliseconds, of the newest slice in the spectrogram.
+  int32_t timestamp_ms;
+  // Best scores, highest first. Only the first |count| entries are set.
+  int count;
+  struct tf_score top[TF_RESULT_TOP_K];
+};
+
+struct tf_shadow_report {
+  uint32_t runs;
+  uint32_t compared;
+  uint32_t agreed;
+  int32_t candidate_avg_us;
+  int32_t active_avg_us;
+  size_t arena_used;
+};
+
+enum tf_corpus_status {
+  TF_CORPUS_OK,
+  // No arena section or interpreter is free for the model right now, or the
+  // clip buffers can't be allocated.
+  TF_CORPUS_NO_MEMORY,
+  // The directory can't be opened or none of its clips could be read.
+  TF_CORPUS_UNREADABLE,
+  // The model can't be built or invoked, or no model has been added yet.
+  TF_CORPUS_ERROR,
+};
+
+// Result of playing a regression corpus through one model.
+struct tf_corpus_report {
+  uint32_t clips;
+  // Clips whose best-scoring label is the one in their file name.
+  uint32_t correct;
+  // Clips where the best score was above the model's threshold.
+  uint32_t detections;
+  uint32_t invokes;
+  int32_t avg_us;
+  int32_t max_us;
+  size_t arena_used;
+};
+
+// How often the classifiers run, see InferenceCadence.
+struct tf_cadence_report {
+  // Strides between classifier invokes.
+  int32_t strides;
+  // Changes of the cadence since boot.
+  uint32_t increases;
+  uint32_t decreases;
+  // Share of the audio time spent on features and classifiers, and the largest
+  // capture backlog, over the last evaluation period.
+  int32_t load_pct;
+  int32_t backlog_ms;
+};
+
+// Two-stage cascade figures since the gate was set, see
+// tf_micro_speech_set_gate.
+struct tf_cascade_report {
+  bool running;
+  // Times the gate fired after being closed.
+  uint32_t openings;
+  // Keyword model windows scored, and passed over while the gate was closed.
+  uint32_t scored_windows;
+  uint32_t gated_windows;
+  // Share of keyword model windows, and so of their invokes, avoided.
+  int32_t avoided_pct;
+};
+
+// Starts audio capture without waiting for a model, so that the capture ring is
+// already filling while models load. Returns 0 on success.
+int tf_micro_speech_start_audio(void);
+
+// Adds a model to the set scored on every inference step and initializes the
+// shared feature pipeline on first use. All models read the same spectrogram,
+// so the audio front-end runs once per step however many models are loaded.
+// The number of slices comes from each model's input tensor and the stride
+// from its header (tf_model_ctx.stride_ms); the first model sets the stride
+// and later models must match it. Returns 0 on success.
+int tf_micro_speech_add_model(struct tf_model_ctx *ctx);
+
+// Makes |ctx| the first stage of a cascade: a small model scored on every
+// window, e.g. two keywords or speech against background. The models added
+// with tf_micro_speech_add_model then only score windows that end within
+// |hold_ms| of a gate window whose top label is above the gate's threshold and
+// isn't "silence" or "unknown". Each model keeps its own labels and threshold;
+// the gate's detections are not reported. Must be called after the first model
+// is added and before a shadow is started. Needs CONFIG_MODEL_CASCADE. Returns
+// 0 on success.
+int tf_micro_speech_set_gate(struct tf_model_ctx *ctx, int hold_ms);
+
+// Starts evaluating a candidate model next to the first loaded model on the
+// same features. The candidate's detections are not reported.
+enum tf_shadow_start tf_micro_speech_start_shadow(
+    struct tf_model_ctx *ctx, const struct tf_shadow_config *config);
+
+// Returns the current verdict for the candidate and fills |report| (optional)
+// with the agreement, latency and arena figures collected so far.
+enum tf_shadow_verdict tf_micro_speech_shadow_verdict(
+    struct tf_shadow_report *report);
+
+// Stops the evaluation and frees the candidate's interpreter. The candidate
+// context is owned by the caller.
+void tf_micro_speech_stop_shadow(void);
+
+// Plays every "<label>_<name>.wav" clip in |dir| (16 kHz 16-bit mono, up to two
+// seconds each) through the audio front-end and |ctx|'s model, the same way
+// live audio is processed, and fills |report|. |ctx| may be a loaded model, the
+// shadow candidate, or a model that is loaded just for the run. Live audio is
+// not scored meanwhile. Must be called from the inference task after a model
+// has been added.
+enum tf_corpus_status tf_micro_speech_run_corpus(
+    struct tf_model_ctx *ctx, const char *dir, struct tf_corpus_report *report);
+
+// Runs one iteration of data gathering and inference for every loaded model.
+// This should be called repeatedly from the application code.
+void tf_micro_speech_run_inference(void);
+
+// Takes the oldest detection from the results queue. The queue has a single
+// producer (the inference loop) and must have a single consumer task. Returns
+// false when the queue is empty.
+bool tf_micro_speech_pop_result(struct tf_result *result);
+
+// Name of label |label| of loaded model |model|, e.g. result.top[0].label of a
+// detection, or "" if there is no such model or label. The name belongs to the
+// model context; copy it to keep it after the model is freed.
+const char *tf_micro_speech_label(int model, int label);
+
+// Number of detections dropped because the results queue was full.
+uint32_t tf_micro_speech_dropped_results(void);
+
+// Time since boot, in microseconds, at which the first inference completed,
+// or -1 if no inference has completed yet.
+int64_t tf_micro_speech_first_inference_us(void);
+
+// Fills |report| with the current classifier cadence.
+void tf_micro_speech_get_cadence(struct tf_cadence_report *report);
+
+// Fills |report| with the cascade figures; running is false without a gate.
+void tf_micro_speech_get_cascade(struct tf_cascade_report *report);
+
+// Destroys the pipeline with all interpreters and queued detections. The
+// model contexts are owned by the caller and can be freed afterwards. Audio
+// capture keeps running, and the next tf_micro_speech_add_model() starts a new
+// pipeline. Must be called from the inference task.
+void tf_micro_speech_deinit(void);
 
 #ifdef __cplusplus
 }
@@ -17,32 +17,23 @@ limitations under the License.
 
 #include <cmath>
 #include <cstring>
+#include <new>
 #include <esp_log.h>
 #include "audio_preprocessor_int8_model_data.h"
+#include "deferred_log.h"
 #include "tensorflow/lite/schema/schema_generated.h"
 #include "tensorflow/lite/micro/micro_log.h"
-#include "tensorflow/lite/micro/micro_interpreter.h"
 #include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
-#include "tensorflow/lite/micro/micro_log.h"
 #include "micro_model_settings.h"
+#include "shared_arena.h"
 
 namespace {
 
-// FrontendState g_micro_features_state;
-bool g_is_first_time = true;
-
-const tflite::Model* model = nullptr;
-tflite::MicroInterpreter* interpreter = nullptr;
-
-constexpr size_t kArenaSize = 16 * 1024;
-alignas(16) uint8_t g_arena[kArenaSize];
-
 constexpr int kAudioSampleDurationCount =
     kFeatureDurationMs * kAudioSampleFrequency / 1000;
 constexpr int kAudioSampleStrideCount =
     kFeatureStrideMs * kAudioSampleFrequency / 1000;
 using AudioPreprocessorOpResolver = tflite::MicroMutableOpResolver<18>;
-}  // namespace
 
 TfLiteStatus RegisterOps(AudioPreprocessorOpResolver& op_resolver) {
   TF_LITE_ENSURE_STATUS(op_resolver.AddReshape());
@@ -66,45 +57,90 @@ TfLiteStatus RegisterOps(AudioPreprocessorOpResolver& op_resolver) {
   return kTfLiteOk;
 }
 
-TfLiteStatus InitializeMicroFeatures() {
-  g_is_first_time = true;
+// The resolver is only read once registered, so all generators share it. The
+// initialization of the static is thread safe.
+const AudioPreprocessorOpResolver* GetOpResolver() {
+  static const AudioPreprocessorOpResolver* resolver =
+      []() -> const AudioPreprocessorOpResolver* {
+    // NOLINTNEXTLINE(runtime-global-variables)
+    static AudioPreprocessorOpResolver op_resolver;
+    return RegisterOps(op_resolver) == kTfLiteOk ? &op_resolver : nullptr;
+  }();
+  return resolver;
+}
+}  // namespace
+
+MicroFeaturesGenerator::MicroFeaturesGenerator(SharedArena* arena)
+    : arena_(arena), allocator_(nullptr), interpreter_(nullptr) {}
+
+MicroFeaturesGenerator::~MicroFeaturesGenerator() { Release(); }
+
+TfLiteStatus MicroFeaturesGenerator::Initialize() {
+  if (interpreter_ != nullptr) {
+    return kTfLiteOk;
+  }
 
   // Map the model into a usable data structure. This doesn't involve any
   // copying or parsing, it's a very lightweight operation.
-  model = tflite::GetModel(g_audio_preprocessor_int8_tflite);
+  const tflite::Model* model =
+      tflite::GetModel(g_audio_preprocessor_int8_tflite);
   if (model->version() != TFLITE_SCHEMA_VERSION) {
     MicroPrintf("Model provided for Feature generator is schema version %d "
                 "not equal to supported version %d.", model->version(), TFLITE_SCHEMA_VERSION);
     return kTfLiteError;
   }
 
-  static AudioPreprocessorOpResolver op_resolver;
-  RegisterOps(op_resolver);
+  const AudioPreprocessorOpResolver* op_resolver = GetOpResolver();
+  if (op_resolver == nullptr) {
+    return kTfLiteError;
+  }
 
-  static tflite::MicroInterpreter static_interpreter(model, op_resolver, g_arena, kArenaSize);
-  interpreter = &static_interpreter;
+  allocator_ = arena_->CreateAllocator(SharedArena::kSectionSize);
+  if (allocator_ == nullptr) {
+    return kTfLiteError;
+  }
+  interpreter_ = new (interpreter_storage_)
+      tflite::MicroInterpreter(model, *op_resolver, allocator_);
 
-  if (interpreter->AllocateTensors() != kTfLiteOk) {
+  if (interpreter_->AllocateTensors() != kTfLiteOk) {
     MicroPrintf("AllocateTensors failed for Feature provider model. Line %d", __LINE__);
+    tflite::MicroAllocator* allocator = allocator_;
+    Release();
+    arena_->ReleaseAllocator(allocator);
     return kTfLiteError;
   }
 
-  // MicroPrintf("AudioPreprocessor model arena size = %u",
-  //             interpreter.arena_used_bytes());
+  MicroPrintf("AudioPreprocessor model arena size = %u",
+              static_cast<unsigned>(interpreter_->arena_used_bytes()));
 
   return kTfLiteOk;
 }
 
-TfLiteStatus GenerateSingleFeature(const int16_t* audio_data,
-                                   const int audio_data_size,
-                                   int8_t* feature_output,
-                                   tflite::MicroInterpreter* interpreter) {
-  TfLiteTensor* input = interpreter->input(0);
-  TfLiteTensor* output = interpreter->output(0);
+void MicroFeaturesGenerator::Release() {
+  if (interpreter_ == nullptr) {
+    return;
+  }
+  interpreter_->~MicroInterpreter();
+  interpreter_ = nullptr;
+  allocator_ = nullptr;
+}
+
+TfLiteStatus MicroFeaturesGenerator::Reset() {
+  if (interpreter_ == nullptr) {
+    return kTfLiteError;
+  }
+  return interpreter_->Reset();
+}
+
+TfLiteStatus MicroFeaturesGenerator::GenerateSingleFeature(
+    const int16_t* audio_data, const int audio_data_size,
+    int8_t* feature_output) {
+  TfLiteTensor* input = interpreter_->input(0);
+  TfLiteTensor* output = interpreter_->output(0);
   std::copy_n(audio_data, audio_data_size,
               tflite::GetTensorData<int16_t>(input));
-  if (interpreter->Invoke() != kTfLiteOk) {
-    MicroPrintf("Feature generator model invocation failed");
+  if (interpreter_->Invoke() != kTfLiteOk) {
+    deferred_log(DLOG_PREPROCESSOR_FAILED, 0, 0);
   }
 
   std::copy_n(tflite::GetTensorData<int8_t>(output), kFeatureSize,
@@ -113,16 +149,16 @@ TfLiteStatus GenerateSingleFeature(const int16_t* audio_data,
   return kTfLiteOk;
 }
 
-TfLiteStatus GenerateFeatures(const int16_t* audio_data,
-                              const size_t audio_data_size,
-                              Features* features_output) {
+TfLiteStatus MicroFeaturesGenerator::Generate(const int16_t* audio_data,
+                                              const size_t audio_data_size,
+                                              Features* features_output) {
   size_t remaining_samples = audio_data_size;
   size_t feature_index = 0;
   while (remaining_samples >= kAudioSampleDurationCount &&
-         feature_index < kFeatureCount) {
+         feature_index < kGeneratedFeatureCount) {
     TF_LITE_ENSURE_STATUS(
         GenerateSingleFeature(audio_data, kAudioSampleDurationCount,
-                              (*features_output)[feature_index], interpreter));
+                              (*features_output)[feature_index]));
     feature_index++;
     audio_data += kAudioSampleStrideCount;
     remaining_samples -= kAudioSampleStrideCount;
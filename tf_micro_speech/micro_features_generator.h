@@ -16,22 +16,53 @@ limitations under the License.
 #ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_FEATURES_MICRO_FEATURES_GENERATOR_H_
 #define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_FEATURES_MICRO_FEATURES_GENERATOR_H_
 
+#include <cstddef>
+#include <cstdint>
+
 #include "tensorflow/lite/c/common.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
 #include "micro_model_settings.h"
 
-using Features = int8_t[kFeatureCount][kFeatureSize];
+class SharedArena;
+
+using Features = int8_t[kGeneratedFeatureCount][kFeatureSize];
+
+// Runs the audio preprocessor model that converts audio sample data into a
+// more compact form that's appropriate for feeding into a neural network. The
+// front-end carries noise and gain estimates from one window to the next, so
+// every audio stream needs a generator of its own.
+class MicroFeaturesGenerator {
+ public:
+  // The preprocessor's interpreter takes a persistent section of |arena|.
+  explicit MicroFeaturesGenerator(SharedArena* arena);
+  ~MicroFeaturesGenerator();
+
+  // Sets up any resources needed for the feature generation pipeline.
+  TfLiteStatus Initialize();
+
+  // Destroys the interpreter. Its arena section is returned by the arena's
+  // Reset(), or by ReleaseAllocator() when it was the last one created.
+  void Release();
+
+  // Returns the front-end to its freshly initialized state, dropping the noise
+  // estimate and gain state built up from earlier audio.
+  TfLiteStatus Reset();
+
+  TfLiteStatus Generate(const int16_t* audio_data, size_t audio_data_size,
+                        Features* features_output);
 
-// Sets up any resources needed for the feature generation pipeline.
-TfLiteStatus InitializeMicroFeatures();
+  bool initialized() const { return interpreter_ != nullptr; }
 
-// Converts audio sample data into a more compact form that's appropriate for
-// feeding into a neural network.
-// TfLiteStatus GenerateMicroFeatures(const int16_t* input, int input_size,
-//                                    int output_size, int8_t* output,
-//                                    size_t* num_samples_read);
+ private:
+  TfLiteStatus GenerateSingleFeature(const int16_t* audio_data,
+                                     int audio_data_size,
+                                     int8_t* feature_output);
 
-TfLiteStatus GenerateFeatures(const int16_t* audio_data,
-                              const size_t audio_data_size,
-                              Features* features_output);
+  SharedArena* arena_;
+  tflite::MicroAllocator* allocator_;
+  tflite::MicroInterpreter* interpreter_;
+  alignas(tflite::MicroInterpreter) uint8_t
+      interpreter_storage_[sizeof(tflite::MicroInterpreter)];
+};
 
 #endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_FEATURES_MICRO_FEATURES_GENERATOR_H_
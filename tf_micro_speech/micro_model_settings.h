@@ -17,6 +17,8 @@ limitations under the License.
 #ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_MODEL_SETTINGS_H_
 #define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_MODEL_SETTINGS_H_
 
+#include "sdkconfig.h"
+
 // The following values are derived from values used during model training.
 // If you change the way you preprocess the input, update all these constants.
 constexpr int kMaxAudioSampleSize = 512;
@@ -27,4 +29,73 @@ constexpr int kFeatureElementCount = (kFeatureSize * kFeatureCount);
 constexpr int kFeatureStrideMs = 20;
 constexpr int kFeatureDurationMs = 30;
 
+// Models may use more or fewer slices, or a different stride, than the
+// defaults above: both are read from the model when it is loaded. The window
+// length and the channel count are fixed by the audio preprocessor model.
+// kFeatureCount x kFeatureSize at kFeatureStrideMs remains the fast path.
+constexpr int kMaxFeatureCount = 98;
+constexpr int kMaxFeatureElementCount = (kFeatureSize * kMaxFeatureCount);
+constexpr int kMinFeatureStrideMs = 10;
+constexpr int kMaxFeatureStrideMs = kFeatureDurationMs;
+// Most windows classified after a stall, and the largest batch dimension a
+// model may have.
+constexpr int kMaxCatchUpWindows = CONFIG_INFERENCE_CATCHUP_WINDOWS;
+// The spectrogram keeps the slices of kMaxCatchUpWindows windows, so with
+// default-geometry models it holds this many slices.
+constexpr int kDefaultSpectrogramCount = kFeatureCount + kMaxCatchUpWindows - 1;
+static_assert(kDefaultSpectrogramCount <= kMaxFeatureCount,
+              "Catch-up windows don't fit the spectrogram");
+
+// Number of keyword models that can score the same spectrogram at once.
+constexpr int kMaxConcurrentModels = 2;
+// A cascade gate (see tf_micro_speech_set_gate) runs next to them when enabled.
+#if CONFIG_MODEL_CASCADE
+constexpr int kMaxGateModels = 1;
+#else
+constexpr int kMaxGateModels = 0;
+#endif
+
+// Where the audio used to build the spectrogram comes from. Streaming reads one
+// stride of new microphone audio per feature slice; the clip modes rebuild the
+// whole spectrogram from one second of audio at a time and are only used for
+// debugging the feature generator.
+#define AUDIO_MODE_STREAMING 0
+#define AUDIO_MODE_TEST_CLIPS 1
+#define AUDIO_MODE_MIC_CLIP 2
+#ifndef AUDIO_MODE
+#define AUDIO_MODE AUDIO_MODE_STREAMING
+#endif
+
+// Static buffers are sized from the values above for the selected mode, so the
+// memory budget (tools/memory_budget.json) only pays for what is used.
+constexpr int kAudioClipSampleCount = kAudioSampleFrequency;
+#if AUDIO_MODE == AUDIO_MODE_STREAMING
+constexpr int kAudioOutputBufferSize = kMaxAudioSampleSize;
+constexpr int kGeneratedFeatureCount = 1;
+#else
+constexpr int kAudioOutputBufferSize = kAudioClipSampleCount;
+constexpr int kGeneratedFeatureCount = kFeatureCount;
+#endif
+
+// The capture ring holds this much audio between the microphone task and the
+// feature provider. It lives in PSRAM when CONFIG_SPIRAM is enabled.
+constexpr int kAudioCaptureBufferMs = 1250;
+constexpr int kAudioCaptureBufferSize =
+    kAudioCaptureBufferMs * (kAudioSampleFrequency / 1000) * sizeof(int16_t);
+// Audio read from the codec in one go. One stride per read lets the capture
+// task wake the inference task exactly when a new slice can be computed.
+constexpr int kAudioCaptureReadMs = kFeatureStrideMs;
+constexpr int kAudioCaptureReadSize =
+    kAudioCaptureReadMs * (kAudioSampleFrequency / 1000) * sizeof(int16_t);
+
+// The microphone may run at a multiple of kAudioSampleFrequency, in which case
+// the capture task decimates each read before writing it to the ring.
+constexpr int kAudioCaptureSampleRate = CONFIG_AUDIO_CAPTURE_SAMPLE_RATE;
+static_assert(kAudioCaptureSampleRate % kAudioSampleFrequency == 0,
+              "The capture rate must be a multiple of the model rate");
+constexpr int kAudioDecimationFactor =
+    kAudioCaptureSampleRate / kAudioSampleFrequency;
+constexpr int kAudioCaptureRawReadSize =
+    kAudioCaptureReadSize * kAudioDecimationFactor;
+
 #endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_MICRO_MODEL_SETTINGS_H_
@@ -25,6 +25,7 @@ limitations under the License.
 
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/queue.h"
 #include "freertos/semphr.h"
@@ -66,6 +67,11 @@ ringbuf_t* rb_init(const char* name, uint32_t size) {
   r->abort_write = 0;
   r->writer_finished = 0;
   r->reader_unblock = 0;
+  r->last_signal_us = 0;
+  memset(&r->stats, 0, sizeof(r->stats));
+#if CONFIG_RINGBUF_STATS
+  r->stats.since_us = esp_timer_get_time();
+#endif
 
   return r;
 }
@@ -95,6 +101,56 @@ ssize_t rb_available(ringbuf_t* rb) {
   return (rb->size - rb->fill_cnt);
 }
 
+#if CONFIG_RINGBUF_STATS
+// Called without the lock held after a wait; takes it so the counters can't
+// race with rb_get_stats()/rb_reset_stats().
+static void rb_record_reader_wait(ringbuf_t* rb, int64_t start_us, bool woken) {
+  int64_t now_us = esp_timer_get_time();
+  rb_stats_t* stats = &rb->stats;
+  xSemaphoreTake(rb->lock, portMAX_DELAY);
+  stats->reader_blocked_us += now_us - start_us;
+  stats->reader_waits++;
+  if (!woken) {
+    stats->reader_timeouts++;
+    xSemaphoreGive(rb->lock);
+    return;
+  }
+
+  // A signal given before the wait started was already pending, so the
+  // latency runs from the start of the wait.
+  int64_t signal_us = rb->last_signal_us;
+  int64_t latency_us = now_us - (signal_us > start_us ? signal_us : start_us);
+  int bucket = 0;
+  while (bucket < RB_WAKEUP_BUCKETS - 1 && latency_us >= (1LL << bucket)) {
+    bucket++;
+  }
+  stats->wakeup_hist[bucket]++;
+  if (latency_us > stats->wakeup_max_us) {
+    stats->wakeup_max_us = latency_us;
+  }
+  xSemaphoreGive(rb->lock);
+}
+
+// Signals given outside rb_write() come from other tasks, so the timestamp is
+// written under the lock as well.
+static void rb_record_signal(ringbuf_t* rb) {
+  xSemaphoreTake(rb->lock, portMAX_DELAY);
+  rb->last_signal_us = esp_timer_get_time();
+  xSemaphoreGive(rb->lock);
+}
+
+static void rb_record_writer_wait(ringbuf_t* rb, int64_t start_us, bool woken) {
+  int64_t now_us = esp_timer_get_time();
+  xSemaphoreTake(rb->lock, portMAX_DELAY);
+  rb->stats.writer_blocked_us += now_us - start_us;
+  rb->stats.writer_waits++;
+  if (!woken) {
+    rb->stats.writer_timeouts++;
+  }
+  xSemaphoreGive(rb->lock);
+}
+#endif
+
 int rb_read(ringbuf_t* rb, uint8_t* buf, int buf_len, uint32_t ticks_to_wait) {
   int read_size;
   int total_read_size = 0;
@@ -136,6 +192,9 @@ int rb_read(ringbuf_t* rb, uint8_t* buf, int buf_len, uint32_t ticks_to_wait) {
     buf_len -= read_size;
     rb->fill_cnt -= read_size;
     total_read_size += read_size;
+#if CONFIG_RINGBUF_STATS
+    rb->stats.bytes_read += read_size;
+#endif
     if (buf) {
       buf += read_size;
     }
@@ -148,7 +207,14 @@ int rb_read(ringbuf_t* rb, uint8_t* buf, int buf_len, uint32_t ticks_to_wait) {
 
     xSemaphoreGive(rb->lock);
     if (!rb->writer_finished && !rb->abort_read && !rb->reader_unblock) {
-      if (xSemaphoreTake(rb->can_read, ticks_to_wait) != pdTRUE) {
+#if CONFIG_RINGBUF_STATS
+      int64_t wait_start_us = esp_timer_get_time();
+#endif
+      bool woken = xSemaphoreTake(rb->can_read, ticks_to_wait) == pdTRUE;
+#if CONFIG_RINGBUF_STATS
+      rb_record_reader_wait(rb, wait_start_us, woken);
+#endif
+      if (!woken) {
         goto out;
       }
     }
@@ -160,6 +226,11 @@ int rb_read(ringbuf_t* rb, uint8_t* buf, int buf_len, uint32_t ticks_to_wait) {
       goto out;
     }
     if (rb->reader_unblock == 1) {
+#if CONFIG_RINGBUF_STATS
+      xSemaphoreTake(rb->lock, portMAX_DELAY);
+      rb->stats.reader_unblocks++;
+      xSemaphoreGive(rb->lock);
+#endif
       if (total_read_size == 0) {
         total_read_size = RB_READER_UNBLOCK;
       }
@@ -217,7 +288,10 @@ int rb_write(ringbuf_t* rb, const uint8_t* buf, int buf_len,
     rb->fill_cnt += write_size;
     total_write_size += write_size;
     buf += write_size;
-
+#if CONFIG_RINGBUF_STATS
+    rb->stats.bytes_written += write_size;
+    rb->last_signal_us = esp_timer_get_time();
+#endif
     xSemaphoreGive(rb->can_read);
 
     if (buf_len == 0) {
@@ -228,7 +302,14 @@ int rb_write(ringbuf_t* rb, const uint8_t* buf, int buf_len,
     if (rb->writer_finished) {
       return write_size > 0 ? write_size : RB_WRITER_FINISHED;
     }
-    if (xSemaphoreTake(rb->can_write, ticks_to_wait) != pdTRUE) {
+#if CONFIG_RINGBUF_STATS
+    int64_t wait_start_us = esp_timer_get_time();
+#endif
+    bool woken = xSemaphoreTake(rb->can_write, ticks_to_wait) == pdTRUE;
+#if CONFIG_RINGBUF_STATS
+    rb_record_writer_wait(rb, wait_start_us, woken);
+#endif
+    if (!woken) {
       goto out;
     }
     if (rb->abort_write == 1) {
@@ -266,6 +347,9 @@ void rb_abort_read(ringbuf_t* rb) {
     return;
   }
   rb->abort_read = 1;
+#if CONFIG_RINGBUF_STATS
+  rb_record_signal(rb);
+#endif
   xSemaphoreGive(rb->can_read);
   xSemaphoreGive(rb->lock);
 }
@@ -285,6 +369,9 @@ void rb_abort(ringbuf_t* rb) {
   }
   rb->abort_read = 1;
   rb->abort_write = 1;
+#if CONFIG_RINGBUF_STATS
+  rb_record_signal(rb);
+#endif
   xSemaphoreGive(rb->can_read);
   xSemaphoreGive(rb->can_write);
   xSemaphoreGive(rb->lock);
@@ -306,6 +393,9 @@ void rb_signal_writer_finished(ringbuf_t* rb) {
     return;
   }
   rb->writer_finished = 1;
+#if CONFIG_RINGBUF_STATS
+  rb_record_signal(rb);
+#endif
   xSemaphoreGive(rb->can_read);
 }
 
@@ -321,9 +411,27 @@ void rb_wakeup_reader(ringbuf_t* rb) {
     return;
   }
   rb->reader_unblock = 1;
+#if CONFIG_RINGBUF_STATS
+  rb_record_signal(rb);
+#endif
   xSemaphoreGive(rb->can_read);
 }
 
+int rb_discard(ringbuf_t* rb, int len) {
+  if (rb == NULL || len <= 0) {
+    return 0;
+  }
+  xSemaphoreTake(rb->lock, portMAX_DELAY);
+  if (len > rb->fill_cnt) {
+    len = rb->fill_cnt;
+  }
+  rb->readptr = rb->base + (rb->readptr - rb->base + len) % rb->size;
+  rb->fill_cnt -= len;
+  xSemaphoreGive(rb->lock);
+  xSemaphoreGive(rb->can_write);
+  return len;
+}
+
 void rb_stat(ringbuf_t* rb) {
   xSemaphoreTake(rb->lock, portMAX_DELAY);
   ESP_LOGI(RB_TAG,
@@ -331,3 +439,40 @@ void rb_stat(ringbuf_t* rb) {
            rb->fill_cnt, rb->base, rb->readptr, rb->writeptr, rb->size);
   xSemaphoreGive(rb->lock);
 }
+
+void rb_get_stats(ringbuf_t* rb, rb_stats_t* stats) {
+  xSemaphoreTake(rb->lock, portMAX_DELAY);
+  *stats = rb->stats;
+  xSemaphoreGive(rb->lock);
+}
+
+void rb_reset_stats(ringbuf_t* rb) {
+  xSemaphoreTake(rb->lock, portMAX_DELAY);
+  memset(&rb->stats, 0, sizeof(rb->stats));
+#if CONFIG_RINGBUF_STATS
+  rb->stats.since_us = esp_timer_get_time();
+#endif
+  xSemaphoreGive(rb->lock);
+}
+
+int64_t rb_stats_wakeup_percentile_us(const rb_stats_t* stats, int pct) {
+  uint32_t total = 0;
+  for (int i = 0; i < RB_WAKEUP_BUCKETS; i++) {
+    total += stats->wakeup_hist[i];
+  }
+  if (total == 0) {
+    return -1;
+  }
+
+  uint32_t target = ((uint64_t)total * pct + 99) / 100;
+  uint32_t seen = 0;
+  for (int i = 0; i < RB_WAKEUP_BUCKETS - 1; i++) {
+    seen += stats->wakeup_hist[i];
+    if (seen >= target) {
+      // The bucket bound can overshoot the slowest wakeup actually seen.
+      int64_t bound = 1LL << i;
+      return bound < stats->wakeup_max_us ? bound : stats->wakeup_max_us;
+    }
+  }
+  return stats->wakeup_max_us;
+}
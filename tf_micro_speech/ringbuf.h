@@ -41,6 +41,32 @@ extern "C" {
 #endif
 #endif
 
+// Reader wakeup latencies are counted in power-of-two buckets: bucket n holds
+// latencies below 2^n us, the last one everything longer.
+#define RB_WAKEUP_BUCKETS 16
+
+// Load counters, updated by rb_read()/rb_write() and cleared by
+// rb_reset_stats(). Only collected with CONFIG_RINGBUF_STATS; otherwise they
+// stay zero and the ring makes no timer calls.
+typedef struct rb_stats {
+  int64_t since_us;
+  uint64_t bytes_written;
+  uint64_t bytes_read;
+  // Time callers spent waiting for data or room
+  int64_t reader_blocked_us;
+  int64_t writer_blocked_us;
+  uint32_t reader_waits;
+  uint32_t writer_waits;
+  uint32_t reader_timeouts;
+  uint32_t writer_timeouts;
+  // Reads ended early by rb_wakeup_reader()
+  uint32_t reader_unblocks;
+  // From the writer (or a wakeup/abort) signalling to the blocked reader
+  // running again
+  uint32_t wakeup_hist[RB_WAKEUP_BUCKETS];
+  int64_t wakeup_max_us;
+} rb_stats_t;
+
 typedef struct ringbuf {
   char* name;
   uint8_t* base; /**< Original pointer */
@@ -56,6 +82,8 @@ typedef struct ringbuf {
   int abort_write;
   int writer_finished;  // to prevent infinite blocking for buffer read
   int reader_unblock;
+  volatile int64_t last_signal_us;
+  rb_stats_t stats;
 } ringbuf_t;
 
 ringbuf_t* rb_init(const char* rb_name, uint32_t size);
@@ -77,7 +105,16 @@ int rb_write(ringbuf_t* rb, const uint8_t* buf, int len,
 void rb_cleanup(ringbuf_t* rb);
 void rb_signal_writer_finished(ringbuf_t* rb);
 void rb_wakeup_reader(ringbuf_t* rb);
+// Drops up to |len| of the oldest bytes without copying them and returns how
+// many were dropped. Lets a writer keep only the newest data while nobody
+// reads, and a reader skip a backlog.
+int rb_discard(ringbuf_t* rb, int len);
 int rb_is_writer_finished(ringbuf_t* rb);
+void rb_get_stats(ringbuf_t* rb, rb_stats_t* stats);
+void rb_reset_stats(ringbuf_t* rb);
+// Upper bound of the pct-th percentile wakeup latency in us, or -1 without
+// samples.
+int64_t rb_stats_wakeup_percentile_us(const rb_stats_t* stats, int pct);
 
 #ifdef __cplusplus
 }
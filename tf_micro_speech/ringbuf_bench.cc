@@ -0,0 +1,178 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "ringbuf_bench.h"
+
+#include <atomic>
+#include <cstdint>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "micro_model_settings.h"
+#include "ringbuf.h"
+#include "tensorflow/lite/micro/micro_log.h"
+
+namespace {
+constexpr int kScenarioMs = 3000;
+constexpr uint32_t kIoTimeoutMs = 200;
+// Same priorities as the capture task and the inference loop.
+constexpr UBaseType_t kWriterPriority = 10;
+constexpr UBaseType_t kReaderPriority = 1;
+constexpr UBaseType_t kWakeupPriority = 5;
+constexpr int kMaxChunkBytes = 48000 * 2 * 40 / 1000;
+
+struct Scenario {
+  int sample_rate;
+  // Audio written per rb_write() and read per rb_read()
+  int write_ms;
+  int read_ms;
+  // Period of rb_wakeup_reader() calls, 0 for none
+  int wakeup_ms;
+};
+
+constexpr Scenario kScenarios[] = {
+    {16000, 10, 20, 0},  {16000, 40, 20, 0},  {16000, 10, 20, 50},
+    {48000, 10, 20, 0},  {48000, 40, 10, 0},  {48000, 10, 30, 50},
+};
+
+struct Run {
+  const Scenario* scenario;
+  ringbuf_t* rb;
+  std::atomic<bool> stop;
+  SemaphoreHandle_t done;
+  int64_t abort_us;
+  int64_t reader_exit_us;
+};
+
+int BytesFor(int sample_rate, int ms) {
+  return sample_rate / 1000 * ms * static_cast<int>(sizeof(int16_t));
+}
+
+// Writes in real time: one chunk per write_ms, rounded to whole ticks.
+void Writer(void* arg) {
+  Run* run = static_cast<Run*>(arg);
+  static uint8_t chunk[kMaxChunkBytes];
+  const TickType_t period = pdMS_TO_TICKS(run->scenario->write_ms) > 0
+                                ? pdMS_TO_TICKS(run->scenario->write_ms)
+                                : 1;
+  const int bytes = BytesFor(run->scenario->sample_rate,
+                             period * portTICK_PERIOD_MS);
+  TickType_t last_wake = xTaskGetTickCount();
+  while (!run->stop.load()) {
+    rb_write(run->rb, chunk, bytes, pdMS_TO_TICKS(kIoTimeoutMs));
+    xTaskDelayUntil(&last_wake, period);
+  }
+  xSemaphoreGive(run->done);
+  vTaskDelete(nullptr);
+}
+
+// Blocks for one stride at a time, like the inference loop.
+void Reader(void* arg) {
+  Run* run = static_cast<Run*>(arg);
+  static uint8_t stride[kMaxChunkBytes];
+  const int bytes = BytesFor(run->scenario->sample_rate,
+                             run->scenario->read_ms);
+  while (rb_read(run->rb, stride, bytes, pdMS_TO_TICKS(kIoTimeoutMs)) !=
+         RB_ABORT) {
+  }
+  run->reader_exit_us = esp_timer_get_time();
+  xSemaphoreGive(run->done);
+  vTaskDelete(nullptr);
+}
+
+void Waker(void* arg) {
+  Run* run = static_cast<Run*>(arg);
+  while (!run->stop.load()) {
+    vTaskDelay(pdMS_TO_TICKS(run->scenario->wakeup_ms));
+    rb_wakeup_reader(run->rb);
+  }
+  xSemaphoreGive(run->done);
+  vTaskDelete(nullptr);
+}
+
+void RunScenario(const Scenario& scenario, ringbuf_t* rb) {
+  Run run;
+  run.scenario = &scenario;
+  run.rb = rb;
+  run.stop = false;
+  run.done = xSemaphoreCreateCounting(3, 0);
+  run.abort_us = 0;
+  run.reader_exit_us = 0;
+
+  rb_reset(rb);
+  rb_reset_stats(rb);
+  int tasks = 2;
+  xTaskCreate(Reader, "rb_bench_rd", 3 * 1024, &run, kReaderPriority, nullptr);
+  xTaskCreate(Writer, "rb_bench_wr", 3 * 1024, &run, kWriterPriority, nullptr);
+  if (scenario.wakeup_ms > 0) {
+    xTaskCreate(Waker, "rb_bench_wk", 2 * 1024, &run, kWakeupPriority,
+                nullptr);
+    tasks++;
+  }
+
+  vTaskDelay(pdMS_TO_TICKS(kScenarioMs));
+  run.stop = true;
+  // Let the writer and waker finish before the reader is aborted, so the
+  // stats cover only the steady state.
+  for (int i = 0; i < tasks - 1; i++) {
+    xSemaphoreTake(run.done, portMAX_DELAY);
+  }
+  rb_stats_t stats;
+  rb_get_stats(rb, &stats);
+  const int64_t elapsed_us = esp_timer_get_time() - stats.since_us;
+
+  run.abort_us = esp_timer_get_time();
+  rb_abort(rb);
+  xSemaphoreTake(run.done, portMAX_DELAY);
+  vSemaphoreDelete(run.done);
+
+  MicroPrintf(
+      "%d Hz, write %d ms, read %d ms, wakeup every %d ms: %u B/s in, %u B/s "
+      "out",
+      scenario.sample_rate, scenario.write_ms, scenario.read_ms,
+      scenario.wakeup_ms,
+      static_cast<unsigned>(stats.bytes_written * 1000000 / elapsed_us),
+      static_cast<unsigned>(stats.bytes_read * 1000000 / elapsed_us));
+  MicroPrintf(
+      "  blocked: reader %d%% (%u waits, %u timeouts, %u unblocks), writer %d "
+      "ms (%u waits)",
+      static_cast<int>(stats.reader_blocked_us * 100 / elapsed_us),
+      static_cast<unsigned>(stats.reader_waits),
+      static_cast<unsigned>(stats.reader_timeouts),
+      static_cast<unsigned>(stats.reader_unblocks),
+      static_cast<int>(stats.writer_blocked_us / 1000),
+      static_cast<unsigned>(stats.writer_waits));
+  MicroPrintf(
+      "  reader wakeup: p50 <= %d us, p90 <= %d us, p99 <= %d us, max %d us; "
+      "abort to exit %d us",
+      static_cast<int>(rb_stats_wakeup_percentile_us(&stats, 50)),
+      static_cast<int>(rb_stats_wakeup_percentile_us(&stats, 90)),
+      static_cast<int>(rb_stats_wakeup_percentile_us(&stats, 99)),
+      static_cast<int>(stats.wakeup_max_us),
+      static_cast<int>(run.reader_exit_us - run.abort_us));
+}
+}  // namespace
+
+void rb_benchmark_run(void) {
+  ringbuf_t* rb = rb_init("rb_bench", kAudioCaptureBufferSize);
+  MicroPrintf("Ring buffer benchmark: %d byte ring, %d ms per scenario",
+              kAudioCaptureBufferSize, kScenarioMs);
+  for (const Scenario& scenario : kScenarios) {
+    RunScenario(scenario, rb);
+  }
+  rb_cleanup(rb);
+}
@@ -0,0 +1,37 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_RINGBUF_BENCH_H_
+#define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_RINGBUF_BENCH_H_
+
+// Load test for ringbuf.c. A producer task writes at 16 and 48 kHz sample
+// rates with several chunk sizes while a reader consumes strides of another
+// size, optionally interrupted by rb_wakeup_reader(). Each scenario logs the
+// throughput, the time both sides spent blocked, the reader wakeup latency
+// percentiles and how long rb_abort() takes to release the reader.
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Runs every scenario on a scratch ring of the capture ring's size; takes a
+// few seconds per scenario. Must not run while audio is being captured.
+void rb_benchmark_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_RINGBUF_BENCH_H_
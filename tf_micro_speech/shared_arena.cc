@@ -0,0 +1,112 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "shared_arena.h"
+
+#include "esp_attr.h"
+#include "tensorflow/lite/micro/micro_log.h"
+
+namespace {
+constexpr size_t kArenaAlignment = 16;
+
+// The persistent pool holds one section per interpreter: the audio
+// preprocessor, up to kMaxConcurrentModels keyword classifiers and the cascade
+// gate if enabled. The scratch region only has to fit the largest
+// non-persistent plan. All interpreters log their arena usage at init; use it
+// to tune these values when models change.
+//
+// Activations and scratch buffers are touched by every kernel on every invoke
+// and always stay in internal RAM. Persistent sections (tensor metadata, op
+// state) are read far less often and may be moved to PSRAM to free DRAM.
+#if CONFIG_SHARED_ARENA_PERSISTENT_IN_PSRAM
+EXT_RAM_BSS_ATTR
+#endif
+alignas(16) uint8_t g_persistent_arena[SharedArena::kPersistentSize];
+alignas(16) uint8_t g_scratch_arena[SharedArena::kScratchSize];
+// tools/memory_budget.py reads the sizes its budget is expressed in from here.
+// Being volatile, GetStaticSharedArena() really reads them and the linker keeps
+// them in the ELF.
+const volatile uint32_t g_shared_arena_section_size = SharedArena::kSectionSize;
+const volatile uint32_t g_shared_arena_scratch_size = SharedArena::kScratchSize;
+}  // namespace
+
+SharedArena::SharedArena(uint8_t* persistent, size_t persistent_size,
+                         uint8_t* scratch, size_t scratch_size)
+    : persistent_(persistent),
+      persistent_size_(persistent_size),
+      scratch_(scratch),
+      scratch_size_(scratch_size),
+      persistent_used_(0),
+      allocators_(),
+      section_starts_(),
+      section_count_(0) {}
+
+tflite::MicroAllocator* SharedArena::CreateAllocator(size_t persistent_size) {
+  persistent_size = (persistent_size + kArenaAlignment - 1) &
+                    ~(kArenaAlignment - 1);
+  if (section_count_ == kMaxSections ||
+      persistent_size > persistent_size_ - persistent_used_) {
+    MicroPrintf("Shared arena: no room for %u persistent bytes (%u of %u used)",
+                static_cast<unsigned>(persistent_size),
+                static_cast<unsigned>(persistent_used_),
+                static_cast<unsigned>(persistent_size_));
+    return nullptr;
+  }
+
+  tflite::MicroAllocator* allocator = tflite::MicroAllocator::Create(
+      persistent_ + persistent_used_, persistent_size, scratch_,
+      scratch_size_);
+  if (allocator == nullptr) {
+    return nullptr;
+  }
+
+  allocators_[section_count_] = allocator;
+  section_starts_[section_count_] = persistent_used_;
+  section_count_++;
+  persistent_used_ += persistent_size;
+  return allocator;
+}
+
+bool SharedArena::ReleaseAllocator(tflite::MicroAllocator* allocator) {
+  if (allocator == nullptr || section_count_ == 0 ||
+      allocator != allocators_[section_count_ - 1]) {
+    MicroPrintf("Shared arena: only the last section can be released");
+    return false;
+  }
+
+  // The allocator object itself lives inside its own persistent section, so
+  // rewinding the section is all that is needed.
+  section_count_--;
+  persistent_used_ = section_starts_[section_count_];
+  allocators_[section_count_] = nullptr;
+  return true;
+}
+
+void SharedArena::Reset() {
+  for (int i = 0; i < section_count_; i++) {
+    allocators_[i] = nullptr;
+  }
+  section_count_ = 0;
+  persistent_used_ = 0;
+}
+
+SharedArena* GetStaticSharedArena() {
+  // NOLINTNEXTLINE(runtime-global-variables)
+  static SharedArena arena(
+      g_persistent_arena,
+      g_shared_arena_section_size * SharedArena::kMaxSections, g_scratch_arena,
+      g_shared_arena_scratch_size);
+  return &arena;
+}
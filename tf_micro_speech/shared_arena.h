@@ -0,0 +1,76 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_SHARED_ARENA_H_
+#define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_SHARED_ARENA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "micro_model_settings.h"
+#include "tensorflow/lite/micro/micro_allocator.h"
+
+// One tensor arena shared by every interpreter of a pipeline. Each
+// interpreter gets its own persistent section (tensor metadata, op state,
+// variable tensors) and all of them share a single non-persistent region for
+// activations and scratch buffers. This is only safe because the interpreters
+// of one pipeline run strictly one after the other on the same task: callers
+// must copy inputs in right before Invoke() and read outputs right after it.
+// Pipelines that run concurrently need arenas of their own.
+class SharedArena {
+ public:
+  // Sizes that fit the audio preprocessor, kMaxConcurrentModels classifiers
+  // and the cascade gate if enabled.
+  static constexpr size_t kSectionSize = 8 * 1024;
+  static constexpr int kMaxSections = 1 + kMaxConcurrentModels + kMaxGateModels;
+  static constexpr size_t kPersistentSize = kSectionSize * kMaxSections;
+  static constexpr size_t kScratchSize = 22 * 1024;
+
+  // Carves sections out of |persistent| and shares |scratch| between them.
+  // Both buffers must be 16-byte aligned and outlive the arena.
+  SharedArena(uint8_t* persistent, size_t persistent_size, uint8_t* scratch,
+              size_t scratch_size);
+
+  // Creates an allocator with a persistent section of |persistent_size| bytes.
+  // Returns nullptr when the arena has no room left for it.
+  tflite::MicroAllocator* CreateAllocator(size_t persistent_size);
+
+  // Returns the most recently created persistent section to the arena so that
+  // a short-lived interpreter (e.g. a model under evaluation) can be replaced.
+  // Sections are released in reverse order of creation; anything else is
+  // refused. The interpreter using |allocator| must already be destroyed.
+  bool ReleaseAllocator(tflite::MicroAllocator* allocator);
+
+  // Returns every section to the arena. All interpreters using it must
+  // already be destroyed.
+  void Reset();
+
+ private:
+  uint8_t* persistent_;
+  size_t persistent_size_;
+  uint8_t* scratch_;
+  size_t scratch_size_;
+  size_t persistent_used_;
+  // Created sections, oldest first, so they can be released in reverse.
+  tflite::MicroAllocator* allocators_[kMaxSections];
+  size_t section_starts_[kMaxSections];
+  int section_count_;
+};
+
+// The arena of the pipeline behind the C interface, in static memory that the
+// memory budget (tools/memory_budget.json) accounts for.
+SharedArena* GetStaticSharedArena();
+
+#endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_SHARED_ARENA_H_
@@ -0,0 +1,1234 @@
+/* Copyright 2020-2023 The TensorFlow Authors. All Rights Reserved.
+   Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "speech_pipeline.h"
+
+#include <dirent.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <new>
+
+#include "deferred_log.h"
+#include "model_handler.h"
+#include "shared_arena.h"
+#include "wav_source.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "tensorflow/lite/micro/system_setup.h"
+#include "tensorflow/lite/schema/schema_utils.h"
+#include "tensorflow/lite/core/c/common.h"
+#include "tensorflow/lite/micro/micro_log.h"
+#include "tensorflow/lite/micro/micro_mutable_op_resolver.h"
+
+namespace {
+// Longest the inference loop sleeps waiting for audio, so the caller still gets
+// control back when capture stalls.
+constexpr int kAudioWaitTimeoutMs = 5 * kFeatureStrideMs;
+// Per-model latency stats are logged and reset after this many steps.
+constexpr uint32_t kStatsLogInterval = 500;
+// Logged with the latency stats so runs with different placements compare.
+#if CONFIG_SHARED_ARENA_PERSISTENT_IN_PSRAM
+constexpr char kPersistentArenaPlacement[] = "PSRAM";
+#else
+constexpr char kPersistentArenaPlacement[] = "internal";
+#endif
+#if CONFIG_SHARED_ARENA_SELF_TEST
+// The separate arena a classifier had before the arena was shared: room for a
+// full persistent section and the activations of the largest plan.
+alignas(16) uint8_t g_self_test_arena[SharedArena::kSectionSize +
+                                      SharedArena::kScratchSize];
+alignas(tflite::MicroInterpreter) uint8_t
+    g_self_test_interpreter[sizeof(tflite::MicroInterpreter)];
+#endif
+// Longest part of a regression corpus clip that is scored.
+constexpr int kMaxCorpusClipMs = 2000;
+constexpr int kMaxCorpusLabelLen = 16;
+
+// Pull in only the operation implementations we need.
+// This relies on a complete list of all the ops needed by this graph.
+// An easier approach is to just use the AllOpsResolver, but this will
+// incur some penalty in code space for op implementations that are not
+// needed by this graph.
+//
+// tflite::AllOpsResolver resolver;
+using ClassifierOpResolver = tflite::MicroMutableOpResolver<5>;
+
+// Builtin operator codes registered below, one bit per code.
+constexpr uint32_t kSupportedOpMask =
+    (1u << tflite::BuiltinOperator_DEPTHWISE_CONV_2D) |
+    (1u << tflite::BuiltinOperator_CONV_2D) |
+    (1u << tflite::BuiltinOperator_FULLY_CONNECTED) |
+    (1u << tflite::BuiltinOperator_SOFTMAX) |
+    (1u << tflite::BuiltinOperator_RESHAPE);
+
+TfLiteStatus RegisterOps(ClassifierOpResolver& op_resolver) {
+  TF_LITE_ENSURE_STATUS(op_resolver.AddDepthwiseConv2D());
+  TF_LITE_ENSURE_STATUS(op_resolver.AddConv2D());
+  TF_LITE_ENSURE_STATUS(op_resolver.AddFullyConnected());
+  TF_LITE_ENSURE_STATUS(op_resolver.AddSoftmax());
+  TF_LITE_ENSURE_STATUS(op_resolver.AddReshape());
+  return kTfLiteOk;
+}
+
+// The resolver is only read once registered, so all pipelines share it. The
+// initialization of the static is thread safe.
+const ClassifierOpResolver* GetOpResolver() {
+  static const ClassifierOpResolver* resolver =
+      []() -> const ClassifierOpResolver* {
+    // NOLINTNEXTLINE(runtime-global-variables)
+    static ClassifierOpResolver micro_op_resolver;
+    return RegisterOps(micro_op_resolver) == kTfLiteOk ? &micro_op_resolver
+                                                       : nullptr;
+  }();
+  return resolver;
+}
+
+// Returns the set of builtin operators used by |model| as a bit mask. Codes
+// that don't fit in the mask can't be supported and set every bit.
+uint32_t GetOpMask(const tflite::Model* model) {
+  uint32_t mask = 0;
+  const auto* op_codes = model->operator_codes();
+  for (uint32_t i = 0; op_codes != nullptr && i < op_codes->size(); i++) {
+    const int code = tflite::GetBuiltinCode(op_codes->Get(i));
+    mask |= (code >= 0 && code < 32) ? (1u << code) : ~0u;
+  }
+  return mask;
+}
+
+// Checks that |model| can run on this pipeline before building an interpreter.
+TfLiteStatus VerifyModel(const tflite::Model* model, uint32_t* op_mask) {
+  if (model->version() != TFLITE_SCHEMA_VERSION) {
+    MicroPrintf("Model provided is schema version %d not equal to supported "
+                "version %d.", model->version(), TFLITE_SCHEMA_VERSION);
+    return kTfLiteError;
+  }
+
+  *op_mask = GetOpMask(model);
+  if ((*op_mask & ~kSupportedOpMask) != 0) {
+    MicroPrintf("Model uses unsupported operators (mask 0x%08x)",
+                static_cast<unsigned>(*op_mask));
+    return kTfLiteError;
+  }
+  return kTfLiteOk;
+}
+
+// Reads the number of spectrogram slices from the model's input, which is
+// either [batch, slices * channels], [batch, slices, channels] or
+// [batch, slices, channels, 1]. The channel count is fixed by the
+// preprocessor.
+TfLiteStatus GetInputFeatureCount(const TfLiteTensor* model_input,
+                                  int* feature_count, int* batch) {
+  const TfLiteIntArray* dims = model_input->dims;
+  int elements = 1;
+  for (int i = 1; i < dims->size; i++) {
+    elements *= dims->data[i];
+  }
+  const bool channels_ok =
+      (dims->size == 2) ||
+      (dims->size == 3 && dims->data[2] == kFeatureSize) ||
+      (dims->size == 4 && dims->data[2] == kFeatureSize && dims->data[3] == 1);
+  *feature_count = elements / kFeatureSize;
+  *batch = dims->size ? dims->data[0] : 0;
+  if ((dims->size < 2) || (dims->size > 4) || (*batch < 1) ||
+      (*batch > kMaxCatchUpWindows) ||
+      !channels_ok || (elements % kFeatureSize != 0) ||
+      (*feature_count < 1) || (*feature_count > kMaxFeatureCount) ||
+      (model_input->type != kTfLiteInt8)) {
+    MicroPrintf("Bad input tensor parameters in model");
+    return kTfLiteError;
+  }
+  return kTfLiteOk;
+}
+
+int GetStrideMs(const struct tf_model_ctx* ctx) {
+  return ctx->stride_ms ? ctx->stride_ms : kFeatureStrideMs;
+}
+
+// Returns the largest quantized score that is not above |threshold|, so that
+// a quantized score q is a detection when q > the returned value.
+int8_t QuantizeThreshold(float threshold, const TfLiteTensor* output) {
+  if (output->params.scale <= 0.0f) {
+    return INT8_MAX;
+  }
+  const float q =
+      std::floor(threshold / output->params.scale) + output->params.zero_point;
+  return static_cast<int8_t>(std::min(std::max(q, static_cast<float>(INT8_MIN)),
+                                      static_cast<float>(INT8_MAX)));
+}
+
+void RecordInvokeTime(struct tf_model_stats* stats, int64_t elapsed_us) {
+  if (stats->invokes == 0 || elapsed_us < stats->min_us) {
+    stats->min_us = elapsed_us;
+  }
+  if (elapsed_us > stats->max_us) {
+    stats->max_us = elapsed_us;
+  }
+  stats->total_us += elapsed_us;
+  stats->invokes++;
+}
+
+// Logs and resets the stats of one model. The gate is logged as model -1.
+void LogModelStats(const ModelSlot& slot, int index) {
+  struct tf_model_stats* stats = &slot.ctx->stats;
+  if (stats->invokes > 0) {
+    MicroPrintf(
+        "Model %d invoke: avg %d us, min %d us, max %d us (%u runs, weights "
+        "%s, persistent arena %s)",
+        index, static_cast<int>(stats->total_us / stats->invokes),
+        static_cast<int>(stats->min_us), static_cast<int>(stats->max_us),
+        static_cast<unsigned>(stats->invokes),
+        slot.ctx->data_in_psram ? "PSRAM" : "internal",
+        kPersistentArenaPlacement);
+  }
+  if (stats->windows > stats->invokes || stats->late_windows > 0 ||
+      stats->dropped_windows > 0 || stats->skipped_windows > 0 ||
+      stats->gated_windows > 0) {
+    MicroPrintf(
+        "Model %d windows: %u scored, %d us per window (batch %d), %u late, "
+        "%u dropped, %u skipped, %u gated",
+        index, static_cast<unsigned>(stats->windows),
+        static_cast<int>(stats->windows ? stats->total_us / stats->windows
+                                        : 0),
+        slot.batch, static_cast<unsigned>(stats->late_windows),
+        static_cast<unsigned>(stats->dropped_windows),
+        static_cast<unsigned>(stats->skipped_windows),
+        static_cast<unsigned>(stats->gated_windows));
+  }
+  *stats = {};
+}
+
+// Finds the best scores of one model in the quantized domain; only those are
+// dequantized. |row| selects the window of a batched model.
+void GetTopResult(const ModelSlot& slot, struct tf_result* result,
+                  int row = 0) {
+  // Obtain a pointer to the output tensor
+  const TfLiteTensor* output = slot.interpreter->output(0);
+  const int8_t* scores = tflite::GetTensorData<int8_t>(output) +
+                         row * (output->bytes / slot.batch);
+  const int k = std::min(slot.ctx->label_count, TF_RESULT_TOP_K);
+
+  // Insertion into a short sorted list beats sorting all outputs for k <= 3.
+  result->count = 0;
+  for (int i = 0; i < slot.ctx->label_count; i++) {
+    int pos = result->count;
+    while (pos > 0 && scores[i] > result->top[pos - 1].q_score) {
+      if (pos < k) {
+        result->top[pos] = result->top[pos - 1];
+      }
+      pos--;
+    }
+    if (pos < k) {
+      result->top[pos] = {i, scores[i], 0.0f};
+      if (result->count < k) {
+        result->count++;
+      }
+    }
+  }
+
+  for (int i = 0; i < result->count; i++) {
+    result->top[i].score =
+        (result->top[i].q_score - output->params.zero_point) *
+        output->params.scale;
+  }
+}
+
+// Name of the best label in |result|, which was scored by |slot|.
+const char* TopLabel(const ModelSlot& slot, const struct tf_result& result) {
+  return result.count > 0 ? slot.ctx->labels[result.top[0].label] : "";
+}
+
+bool IsDetection(const ModelSlot& slot, const struct tf_result& result) {
+  return result.count > 0 && result.top[0].q_score > slot.q_threshold;
+}
+
+// Gate labels that mean "no keyword": the background classes of the
+// micro_speech models, with or without the underscores of the speech
+// commands dataset.
+bool IsBackgroundLabel(const char* label) {
+  while (*label == '_') {
+    label++;
+  }
+  return strncasecmp(label, "silence", 7) == 0 ||
+         strncasecmp(label, "unknown", 7) == 0;
+}
+
+bool HasLabel(const struct tf_model_ctx* ctx, const char* label) {
+  for (int i = 0; i < ctx->label_count; i++) {
+    if (strcmp(ctx->labels[i], label) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The expected label is the file name up to the first '_' or '.'.
+void ClipLabel(const char* name, char* label) {
+  int len = 0;
+  while (name[len] != '\0' && name[len] != '_' && name[len] != '.' &&
+         len < kMaxCorpusLabelLen - 1) {
+    label[len] = name[len];
+    len++;
+  }
+  label[len] = '\0';
+}
+}  // namespace
+
+SpeechPipeline::SpeechPipeline(AudioCapture* capture, SharedArena* arena)
+    : arena_(arena),
+      audio_(capture),
+      feature_buffer_(),
+      feature_provider_(kMaxFeatureElementCount, feature_buffer_, &audio_,
+                        arena),
+      slots_(),
+      slot_count_(0),
+      shadow_(),
+      cascade_(),
+      previous_time_(0),
+      steps_since_stats_(0),
+      cadence_(CONFIG_INFERENCE_MAX_CADENCE),
+      first_inference_us_(-1),
+      result_queue_(),
+      result_head_(0),
+      result_tail_(0),
+      dropped_results_(0) {}
+
+SpeechPipeline::~SpeechPipeline() {
+  // Every arena section is returned at once below, so the interpreters don't
+  // have to be destroyed in the reverse order of their creation.
+  StopShadow();
+  if (cascade_.running) {
+    cascade_.slot.interpreter->~MicroInterpreter();
+  }
+  for (int i = 0; i < slot_count_; i++) {
+    slots_[i].interpreter->~MicroInterpreter();
+  }
+  feature_provider_.Release();
+  arena_->Reset();
+}
+
+void SpeechPipeline::DestroySlot(ModelSlot* slot) {
+  slot->interpreter->~MicroInterpreter();
+  arena_->ReleaseAllocator(slot->allocator);
+  *slot = {};
+}
+
+// All models score the same spectrogram, so they must share its stride.
+bool SpeechPipeline::MatchesRunningStride(
+    const struct tf_model_ctx* ctx) const {
+  if (slot_count_ == 0 || GetStrideMs(ctx) == feature_provider_.stride_ms()) {
+    return true;
+  }
+  MicroPrintf("Model stride %d ms doesn't match the running %d ms",
+              GetStrideMs(ctx), feature_provider_.stride_ms());
+  return false;
+}
+
+// Builds an interpreter for the model in |ctx| in |storage|. Models verified
+// on a previous boot skip the checks; otherwise the result of the checks is
+// recorded in ctx->meta so the caller can persist it. |out_of_memory|
+// (optional) is set when no arena section is free for the model right now, as
+// opposed to a model that can't be built or doesn't fit a full section.
+TfLiteStatus SpeechPipeline::BuildSlot(struct tf_model_ctx* ctx,
+                                       uint8_t* storage, ModelSlot* slot,
+                                       bool* out_of_memory) {
+  if (out_of_memory) {
+    *out_of_memory = false;
+  }
+  const int64_t start_us = esp_timer_get_time();
+
+  // Map the model into a usable data structure. This doesn't involve any
+  // copying or parsing, it's a very lightweight operation.
+  const tflite::Model* model = tflite::GetModel(ctx->data);
+  uint32_t op_mask = ctx->meta.op_mask;
+  if (!ctx->verified && VerifyModel(model, &op_mask) != kTfLiteOk) {
+    return kTfLiteError;
+  }
+
+  const ClassifierOpResolver* micro_op_resolver = GetOpResolver();
+  if (micro_op_resolver == nullptr) {
+    return kTfLiteError;
+  }
+
+  // A model built on an earlier boot used ctx->meta.arena_used bytes of
+  // persistent and scratch memory together. That bounds its persistent use, so
+  // its section is cut to it and the rest of the pool stays free for other
+  // interpreters. Should it no longer fit (a different TFLM version), a full
+  // section is tried next.
+  size_t section_size = SharedArena::kSectionSize;
+  if (ctx->verified && ctx->meta.arena_used > 0 &&
+      ctx->meta.arena_used < section_size) {
+    section_size = ctx->meta.arena_used;
+  }
+
+  while (true) {
+    // Build an interpreter to run the model with.
+    tflite::MicroAllocator* allocator = arena_->CreateAllocator(section_size);
+    if (allocator == nullptr) {
+      if (out_of_memory) {
+        *out_of_memory = true;
+      }
+      return kTfLiteError;
+    }
+    slot->ctx = ctx;
+    slot->model = model;
+    slot->allocator = allocator;
+    slot->interpreter = new (storage)
+        tflite::MicroInterpreter(model, *micro_op_resolver, allocator);
+
+    // Allocate memory from the shared arena for the model's tensors.
+    if (slot->interpreter->AllocateTensors() == kTfLiteOk) {
+      break;
+    }
+    DestroySlot(slot);
+    if (section_size == SharedArena::kSectionSize) {
+      // A full section and the scratch region are all any model gets, so a
+      // model that doesn't fit them never will.
+      MicroPrintf("AllocateTensors() failed");
+      return kTfLiteError;
+    }
+    MicroPrintf("Cached arena size too small, using a full section");
+    section_size = SharedArena::kSectionSize;
+  }
+  MicroPrintf("Classifier arena used: %u bytes, %u byte section",
+              static_cast<unsigned>(slot->interpreter->arena_used_bytes()),
+              static_cast<unsigned>(section_size));
+
+  // Get information about the memory area to use for the model's input.
+  TfLiteTensor* model_input = slot->interpreter->input(0);
+  const TfLiteTensor* model_output = slot->interpreter->output(0);
+  if (GetInputFeatureCount(model_input, &slot->feature_count, &slot->batch) !=
+      kTfLiteOk) {
+    DestroySlot(slot);
+    return kTfLiteError;
+  }
+  if (model_output->dims->size < 1 ||
+      model_output->dims->data[0] != slot->batch ||
+      model_output->type != kTfLiteInt8) {
+    MicroPrintf("Bad output tensor parameters in model");
+    DestroySlot(slot);
+    return kTfLiteError;
+  }
+  slot->pending = 0;
+  slot->input_buffer = tflite::GetTensorData<int8_t>(model_input);
+  slot->q_threshold = QuantizeThreshold(ctx->threshold, model_output);
+  ctx->stats = {};
+
+  if (!ctx->verified) {
+    ctx->meta.verified = 1;
+    ctx->meta.arena_used = slot->interpreter->arena_used_bytes();
+    ctx->meta.op_mask = op_mask;
+    ctx->meta.input_scale = model_input->params.scale;
+    ctx->meta.input_zero_point = model_input->params.zero_point;
+    ctx->meta.output_scale = model_output->params.scale;
+    ctx->meta.output_zero_point = model_output->params.zero_point;
+  }
+  MicroPrintf("Classifier ready in %d us (%s), %d slices at %d ms, batch %d",
+              static_cast<int>(esp_timer_get_time() - start_us),
+              ctx->verified ? "checks skipped" : "verified",
+              slot->feature_count, GetStrideMs(ctx), slot->batch);
+  return kTfLiteOk;
+}
+
+// Copies |rows| consecutive windows of the spectrogram into the model's input
+// rows, oldest first. The first one ends |oldest_age| slices before the newest
+// slice. kCount is the model's slice count when known at compile time, so the
+// default geometry gets a constant-size copy; 0 uses slot.feature_count.
+template <int kCount>
+void SpeechPipeline::CopyInput(const ModelSlot& slot, int oldest_age,
+                               int rows) {
+  const int count = kCount ? kCount : slot.feature_count;
+  const int8_t* window =
+      feature_buffer_ +
+      (feature_provider_.feature_count() - count - oldest_age) * kFeatureSize;
+  int8_t* input = slot.input_buffer;
+  for (int row = 0; row < rows; row++) {
+    std::copy_n(window, count * kFeatureSize, input);
+    window += kFeatureSize;
+    input += count * kFeatureSize;
+  }
+}
+
+// Sizes the spectrogram for the loaded model that needs the most slices, plus
+// the older slices needed to score windows missed during a stall.
+TfLiteStatus SpeechPipeline::UpdateFeatureGeometry(int stride_ms) {
+  int feature_count = 0;
+  for (int i = 0; i < slot_count_; i++) {
+    feature_count = std::max(feature_count, slots_[i].feature_count);
+  }
+  if (shadow_.running) {
+    feature_count = std::max(feature_count, shadow_.slot.feature_count);
+  }
+  if (cascade_.running) {
+    feature_count = std::max(feature_count, cascade_.slot.feature_count);
+  }
+  if (feature_count == 0) {
+    return kTfLiteOk;
+  }
+  feature_count =
+      std::min(feature_count + kMaxCatchUpWindows - 1, kMaxFeatureCount);
+  return feature_provider_.SetGeometry(feature_count, stride_ms);
+}
+
+// Copies |rows| windows of the spectrogram into the model, starting with the
+// one ending |oldest_age| slices before the newest, and runs it. Rows past
+// |rows| keep stale data and their scores are ignored. Returns the invoke time
+// in microseconds, or -1 on failure.
+int64_t SpeechPipeline::InvokeSlot(const ModelSlot& slot, int oldest_age,
+                                   int rows) {
+  // Copy feature buffer to input tensor. This must happen right before
+  // Invoke(): the other interpreters share the scratch arena and overwrite
+  // the input tensor while they run.
+  if (slot.feature_count == kFeatureCount) {
+    CopyInput<kFeatureCount>(slot, oldest_age, rows);
+  } else {
+    CopyInput<0>(slot, oldest_age, rows);
+  }
+
+  // Run the model on the spectrogram input and make sure it succeeds.
+  const int64_t start_us = esp_timer_get_time();
+  TfLiteStatus invoke_status = slot.interpreter->Invoke();
+  if (invoke_status != kTfLiteOk) {
+    deferred_log(DLOG_INVOKE_FAILED, invoke_status, 0);
+    return -1;
+  }
+  const int64_t elapsed_us = esp_timer_get_time() - start_us;
+  RecordInvokeTime(&slot.ctx->stats, elapsed_us);
+  return elapsed_us;
+}
+
+int SpeechPipeline::CascadeAvoidedPct() const {
+  const uint64_t gated = cascade_.gated_windows;
+  const uint64_t total = cascade_.scored_windows + gated;
+  return total ? static_cast<int>(gated * 100 / total) : 0;
+}
+
+void SpeechPipeline::LogStats() {
+  if (cascade_.running) {
+    LogModelStats(cascade_.slot, -1);
+    MicroPrintf("Cascade: gate opened %u times, %u of %u keyword windows "
+                "scored (%d%% avoided)",
+                static_cast<unsigned>(cascade_.openings),
+                static_cast<unsigned>(cascade_.scored_windows),
+                static_cast<unsigned>(cascade_.scored_windows +
+                                      cascade_.gated_windows),
+                CascadeAvoidedPct());
+  }
+  for (int i = 0; i < slot_count_; i++) {
+    LogModelStats(slots_[i], i);
+  }
+  rb_stats_t ring;
+  if (audio_.GetAudioCaptureStats(&ring)) {
+    const int64_t elapsed_us = esp_timer_get_time() - ring.since_us;
+    MicroPrintf(
+        "Capture ring: %u B/s in, reader blocked %d%%, wakeup p50 <= %d us, "
+        "p99 <= %d us, max %d us",
+        static_cast<unsigned>(ring.bytes_written * 1000000 /
+                              (elapsed_us > 0 ? elapsed_us : 1)),
+        static_cast<int>(ring.reader_blocked_us * 100 /
+                         (elapsed_us > 0 ? elapsed_us : 1)),
+        static_cast<int>(rb_stats_wakeup_percentile_us(&ring, 50)),
+        static_cast<int>(rb_stats_wakeup_percentile_us(&ring, 99)),
+        static_cast<int>(ring.wakeup_max_us));
+  }
+}
+
+// Keeps the keyword models running for hold_ms after a gate window that
+// detected anything but background.
+void SpeechPipeline::UpdateGate(const struct tf_result& result) {
+  if (!IsDetection(cascade_.slot, result) ||
+      IsBackgroundLabel(TopLabel(cascade_.slot, result))) {
+    return;
+  }
+  if (result.timestamp_ms > cascade_.open_until_ms) {
+    cascade_.openings++;
+  }
+  cascade_.open_until_ms =
+      std::max(cascade_.open_until_ms, result.timestamp_ms + cascade_.hold_ms);
+}
+
+void SpeechPipeline::PushResult(const struct tf_result& result) {
+  const uint32_t head = result_head_.load(std::memory_order_relaxed);
+  if (head - result_tail_.load(std::memory_order_acquire) ==
+      kResultQueueLength) {
+    dropped_results_.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  result_queue_[head % kResultQueueLength] = result;
+  result_head_.store(head + 1, std::memory_order_release);
+}
+
+// Runs the candidate on the current spectrogram and compares its decision with
+// the active model's. Only steps where either model detects a keyword count
+// towards agreement; a keyword the active model does not know is not held
+// against the candidate.
+void SpeechPipeline::RunShadow(const ModelSlot& active,
+                               const struct tf_result& active_top,
+                               int64_t active_us) {
+  if (shadow_.steps++ % shadow_.config.duty_cycle != 0) {
+    return;
+  }
+
+  const int64_t candidate_us = InvokeSlot(shadow_.slot);
+  if (candidate_us < 0) {
+    return;
+  }
+  shadow_.runs++;
+  shadow_.candidate_total_us += candidate_us;
+  shadow_.active_total_us += active_us;
+
+  struct tf_result candidate_top;
+  GetTopResult(shadow_.slot, &candidate_top);
+  const bool active_fired = IsDetection(active, active_top);
+  const bool candidate_fired = IsDetection(shadow_.slot, candidate_top);
+  if (!active_fired && !candidate_fired) {
+    return;
+  }
+
+  const char* candidate_label = TopLabel(shadow_.slot, candidate_top);
+  if (!active_fired && !HasLabel(active.ctx, candidate_label)) {
+    return;
+  }
+
+  shadow_.compared++;
+  if (active_fired && candidate_fired &&
+      strcmp(TopLabel(active, active_top), candidate_label) == 0) {
+    shadow_.agreed++;
+  }
+}
+
+// Scores the windows of |slot| that ended since it last ran, oldest first.
+// After a stall this catches up on up to kMaxCatchUpWindows missed windows; a
+// model with a batch dimension scores that many windows per invoke, so it
+// waits until they have all ended. While the cadence is above one stride only
+// the newest batch of windows is kept. With a cascade, keyword models pass
+// over the windows that end while the gate is closed. Returns false if the
+// model didn't run, otherwise the newest scored window's result and the invoke
+// time per window.
+bool SpeechPipeline::ClassifyWindows(ModelSlot& slot, int index,
+                                     int new_slices, int32_t current_time,
+                                     struct tf_result* top,
+                                     int64_t* window_us) {
+  struct tf_model_stats* stats = &slot.ctx->stats;
+  if (cascade_.running && !slot.gate &&
+      current_time > cascade_.open_until_ms) {
+    stats->gated_windows += slot.pending + new_slices;
+    cascade_.gated_windows += slot.pending + new_slices;
+    slot.pending = 0;
+    return false;
+  }
+
+  // Windows whose slices are all still in the spectrogram.
+  const int capacity =
+      std::min(feature_provider_.feature_count() - slot.feature_count + 1,
+               kMaxCatchUpWindows);
+  slot.pending += new_slices;
+  if (slot.pending > capacity) {
+    stats->dropped_windows += slot.pending - capacity;
+    slot.pending = capacity;
+  }
+  if (cadence_.strides() > 1 && slot.pending > slot.batch) {
+    stats->skipped_windows += slot.pending - slot.batch;
+    slot.pending = slot.batch;
+  }
+
+  const int rows = std::min(slot.batch, capacity);
+  bool ran = false;
+  while (slot.pending >= rows) {
+    const int64_t elapsed_us = InvokeSlot(slot, slot.pending - 1, rows);
+    if (elapsed_us < 0) {
+      stats->dropped_windows += slot.pending;
+      slot.pending = 0;
+      break;
+    }
+
+    for (int row = 0; row < rows; row++) {
+      const int age = slot.pending - 1 - row;
+      GetTopResult(slot, top, row);
+      top->model = index;
+      top->timestamp_ms = current_time - age * feature_provider_.stride_ms();
+      if (slot.gate) {
+        UpdateGate(*top);
+      } else if (IsDetection(slot, *top)) {
+        PushResult(*top);
+      }
+      if (age > 0) {
+        stats->late_windows++;
+      }
+    }
+    stats->windows += rows;
+    if (cascade_.running && !slot.gate) {
+      cascade_.scored_windows += rows;
+    }
+    slot.pending -= rows;
+    *window_us = elapsed_us / rows;
+    ran = true;
+  }
+  return ran;
+}
+
+// Forgets the windows every model has yet to score, e.g. when the spectrogram
+// was rebuilt and they no longer line up with it.
+void SpeechPipeline::ResetPendingWindows() {
+  for (int i = 0; i < slot_count_; i++) {
+    slots_[i].pending = 0;
+  }
+  shadow_.slot.pending = 0;
+  cascade_.slot.pending = 0;
+}
+
+ModelSlot* SpeechPipeline::FindSlot(const struct tf_model_ctx* ctx) {
+  for (int i = 0; i < slot_count_; i++) {
+    if (slots_[i].ctx == ctx) {
+      return &slots_[i];
+    }
+  }
+  if (shadow_.running && shadow_.slot.ctx == ctx) {
+    return &shadow_.slot;
+  }
+  if (cascade_.running && cascade_.slot.ctx == ctx) {
+    return &cascade_.slot;
+  }
+  return nullptr;
+}
+
+// Scores one corpus clip the way the inference loop scores live audio: a new
+// slice every stride and an invoke once the spectrogram is full. The clip's
+// decision is its best-scoring invoke. |samples| must be long enough for at
+// least one full spectrogram.
+TfLiteStatus SpeechPipeline::RunClip(const ModelSlot& slot,
+                                     const int16_t* samples, int sample_count,
+                                     int8_t* features, struct tf_result* best,
+                                     int64_t* total_us,
+                                     struct tf_corpus_report* report) {
+  constexpr int kWindowSamples =
+      kFeatureDurationMs * kAudioSampleFrequency / 1000;
+  const int stride_samples =
+      GetStrideMs(slot.ctx) * kAudioSampleFrequency / 1000;
+  const int newest = (slot.feature_count - 1) * kFeatureSize;
+
+  memset(features, 0, slot.feature_count * kFeatureSize);
+  best->count = 0;
+  int slices = 0;
+  for (int offset = 0; offset + kWindowSamples <= sample_count;
+       offset += stride_samples) {
+    memmove(features, features + kFeatureSize, newest);
+    TF_LITE_ENSURE_STATUS(feature_provider_.GenerateSlice(
+        samples + offset, offset == 0, features + newest));
+    if (++slices < slot.feature_count) {
+      continue;
+    }
+
+    std::copy_n(features, slot.feature_count * kFeatureSize,
+                slot.input_buffer);
+    const int64_t start_us = esp_timer_get_time();
+    TF_LITE_ENSURE_STATUS(slot.interpreter->Invoke());
+    const int64_t elapsed_us = esp_timer_get_time() - start_us;
+    *total_us += elapsed_us;
+    report->invokes++;
+    if (elapsed_us > report->max_us) {
+      report->max_us = static_cast<int32_t>(elapsed_us);
+    }
+
+    struct tf_result top;
+    GetTopResult(slot, &top);
+    if (best->count == 0 || top.top[0].q_score > best->top[0].q_score) {
+      *best = top;
+    }
+  }
+  return kTfLiteOk;
+}
+
+#if CONFIG_SHARED_ARENA_SELF_TEST
+// Invokes the classifier in |slot| and the same model in an arena of its own
+// on one spectrogram, which the audio front-end computes from noise. The
+// shared interpreter runs twice, with a preprocessor run in between that
+// overwrites the scratch region both share. All three outputs must be equal.
+TfLiteStatus SpeechPipeline::CheckSharedArena(const ModelSlot& slot) {
+  constexpr int kWindowSamples =
+      kFeatureDurationMs * kAudioSampleFrequency / 1000;
+  TfLiteTensor* input = slot.interpreter->input(0);
+  const TfLiteTensor* output = slot.interpreter->output(0);
+  int8_t* features = static_cast<int8_t*>(malloc(input->bytes));
+  int8_t* outputs = static_cast<int8_t*>(malloc(2 * output->bytes));
+  int16_t window[kWindowSamples];
+  if (features == nullptr || outputs == nullptr) {
+    free(features);
+    free(outputs);
+    return kTfLiteError;
+  }
+
+  uint32_t seed = 1;
+  auto noise = [&window, &seed]() {
+    for (int16_t& sample : window) {
+      seed = seed * 1664525u + 1013904223u;
+      sample = static_cast<int16_t>(static_cast<int16_t>(seed >> 16) / 8);
+    }
+  };
+  TfLiteStatus status = kTfLiteOk;
+  for (size_t slice = 0;
+       status == kTfLiteOk && (slice + 1) * kFeatureSize <= input->bytes;
+       slice++) {
+    noise();
+    status = feature_provider_.GenerateSlice(window, slice == 0,
+                                             features + slice * kFeatureSize);
+  }
+
+  // Shared arena, before and after the preprocessor used the scratch region
+  int8_t slice[kFeatureSize];
+  for (int run = 0; status == kTfLiteOk && run < 2; run++) {
+    std::copy_n(features, input->bytes, slot.input_buffer);
+    status = slot.interpreter->Invoke();
+    std::copy_n(tflite::GetTensorData<int8_t>(output), output->bytes,
+                outputs + run * output->bytes);
+    noise();
+    if (status == kTfLiteOk) {
+      status = feature_provider_.GenerateSlice(window, false, slice);
+    }
+  }
+
+  // Separate arena
+  size_t separate_used = 0;
+  int differing = 0;
+  if (status == kTfLiteOk) {
+    tflite::MicroInterpreter* separate = new (g_self_test_interpreter)
+        tflite::MicroInterpreter(slot.model, *GetOpResolver(),
+                                 g_self_test_arena, sizeof(g_self_test_arena));
+    status = separate->AllocateTensors();
+    if (status == kTfLiteOk) {
+      std::copy_n(features, input->bytes,
+                  tflite::GetTensorData<int8_t>(separate->input(0)));
+      status = separate->Invoke();
+      separate_used = separate->arena_used_bytes();
+    }
+    if (status == kTfLiteOk) {
+      const int8_t* expected =
+          tflite::GetTensorData<int8_t>(separate->output(0));
+      for (size_t i = 0; i < output->bytes; i++) {
+        differing += (outputs[i] != expected[i]) +
+                     (outputs[output->bytes + i] != expected[i]);
+      }
+    }
+    separate->~MicroInterpreter();
+  }
+  free(features);
+  free(outputs);
+
+  if (status != kTfLiteOk) {
+    MicroPrintf("Shared arena self-test: unable to run the model");
+    return kTfLiteError;
+  }
+  if (differing > 0) {
+    MicroPrintf("Shared arena self-test FAILED: %d of %u output bytes differ "
+                "from a separate arena", differing,
+                static_cast<unsigned>(2 * output->bytes));
+    return kTfLiteError;
+  }
+  MicroPrintf("Shared arena self-test passed: %u output bytes equal, arena "
+              "used %u bytes shared, %u separate",
+              static_cast<unsigned>(output->bytes),
+              static_cast<unsigned>(slot.interpreter->arena_used_bytes()),
+              static_cast<unsigned>(separate_used));
+  return kTfLiteOk;
+}
+#endif
+
+int SpeechPipeline::AddModel(struct tf_model_ctx* ctx) {
+  if (slot_count_ == kMaxConcurrentModels) {
+    MicroPrintf("Can't run more than %d models at once", kMaxConcurrentModels);
+    return -1;
+  }
+  if (shadow_.running) {
+    // Arena sections are released in reverse order; the shadow must stay last.
+    MicroPrintf("Can't add a model while a shadow model is running");
+    return -1;
+  }
+  if (!MatchesRunningStride(ctx)) {
+    return -1;
+  }
+
+  // The audio preprocessor takes the first arena section, before any model
+  // that might be released again.
+  if (feature_provider_.Initialize() != kTfLiteOk) {
+    return -1;
+  }
+  if (BuildSlot(ctx, interpreter_storage_[slot_count_], &slots_[slot_count_]) !=
+      kTfLiteOk) {
+    return -1;
+  }
+  slot_count_++;
+
+  // The first model sets the stride, later ones may grow the spectrogram.
+  if (UpdateFeatureGeometry(GetStrideMs(ctx)) != kTfLiteOk) {
+    slot_count_--;
+    DestroySlot(&slots_[slot_count_]);
+    UpdateFeatureGeometry(feature_provider_.stride_ms());
+    return -1;
+  }
+#if CONFIG_SHARED_ARENA_SELF_TEST
+  // Only logged; the model runs either way.
+  CheckSharedArena(slots_[slot_count_ - 1]);
+#endif
+  return 0;
+}
+
+int SpeechPipeline::SetGate(struct tf_model_ctx* ctx, int hold_ms) {
+#if CONFIG_MODEL_CASCADE
+  if (cascade_.running || slot_count_ == 0 || hold_ms < 0) {
+    return -1;
+  }
+  if (shadow_.running) {
+    MicroPrintf("Can't add a gate model while a shadow model is running");
+    return -1;
+  }
+  if (!MatchesRunningStride(ctx)) {
+    return -1;
+  }
+
+  cascade_ = {};
+  if (BuildSlot(ctx, gate_interpreter_storage_, &cascade_.slot) != kTfLiteOk) {
+    return -1;
+  }
+  cascade_.slot.gate = true;
+  cascade_.hold_ms = hold_ms;
+  cascade_.open_until_ms = -1;
+  cascade_.running = true;
+  if (UpdateFeatureGeometry(feature_provider_.stride_ms()) != kTfLiteOk) {
+    DestroySlot(&cascade_.slot);
+    cascade_.running = false;
+    UpdateFeatureGeometry(feature_provider_.stride_ms());
+    return -1;
+  }
+  MicroPrintf("Cascade gate set: %d labels, keyword models run for %d ms "
+              "after it fires", ctx->label_count, hold_ms);
+  return 0;
+#else
+  return -1;
+#endif
+}
+
+enum tf_shadow_start SpeechPipeline::StartShadow(
+    struct tf_model_ctx* ctx, const struct tf_shadow_config* config) {
+  if (shadow_.running || slot_count_ == 0 || config->duty_cycle < 1) {
+    return TF_SHADOW_START_ERROR;
+  }
+
+  shadow_ = {};
+  bool out_of_memory = false;
+  if (BuildSlot(ctx, shadow_interpreter_storage_, &shadow_.slot,
+                &out_of_memory) != kTfLiteOk) {
+    return out_of_memory ? TF_SHADOW_START_NO_MEMORY : TF_SHADOW_START_ERROR;
+  }
+  if (!MatchesRunningStride(ctx)) {
+    DestroySlot(&shadow_.slot);
+    return TF_SHADOW_START_STRIDE_MISMATCH;
+  }
+  shadow_.config = *config;
+  shadow_.arena_used = shadow_.slot.interpreter->arena_used_bytes();
+  shadow_.start_us = esp_timer_get_time();
+  shadow_.running = true;
+  if (UpdateFeatureGeometry(feature_provider_.stride_ms()) != kTfLiteOk) {
+    // Only the spectrogram can fail to grow here
+    StopShadow();
+    return TF_SHADOW_START_NO_MEMORY;
+  }
+  return TF_SHADOW_START_OK;
+}
+
+enum tf_shadow_verdict SpeechPipeline::ShadowVerdict(
+    struct tf_shadow_report* report) {
+  if (!shadow_.running) {
+    return TF_SHADOW_NONE;
+  }
+
+  if (report) {
+    report->runs = shadow_.runs;
+    report->compared = shadow_.compared;
+    report->agreed = shadow_.agreed;
+    report->candidate_avg_us = shadow_.runs
+        ? static_cast<int32_t>(shadow_.candidate_total_us / shadow_.runs) : 0;
+    report->active_avg_us = shadow_.runs
+        ? static_cast<int32_t>(shadow_.active_total_us / shadow_.runs) : 0;
+    report->arena_used = shadow_.arena_used;
+  }
+
+  // Where few keywords are spoken, decide on whatever was compared by the
+  // deadline; latency is known from every run.
+  const bool timed_out =
+      shadow_.config.max_duration_s > 0 &&
+      esp_timer_get_time() - shadow_.start_us >=
+          static_cast<int64_t>(shadow_.config.max_duration_s) * 1000000;
+  if (shadow_.compared < shadow_.config.min_compared && !timed_out) {
+    return TF_SHADOW_PENDING;
+  }
+  if (shadow_.runs == 0 ||
+      shadow_.candidate_total_us * 100 >
+          shadow_.active_total_us * shadow_.config.max_latency_pct) {
+    return TF_SHADOW_REJECT;
+  }
+  const uint32_t min_agreement_pct =
+      static_cast<uint32_t>(shadow_.config.min_agreement_pct);
+  if (shadow_.agreed * 100 < shadow_.compared * min_agreement_pct) {
+    return TF_SHADOW_REJECT;
+  }
+  return TF_SHADOW_PROMOTE;
+}
+
+void SpeechPipeline::StopShadow() {
+  if (!shadow_.running) {
+    return;
+  }
+  DestroySlot(&shadow_.slot);
+  shadow_.running = false;
+  UpdateFeatureGeometry(feature_provider_.stride_ms());
+}
+
+void SpeechPipeline::RunInference() {
+  if (slot_count_ == 0) {
+    return;
+  }
+
+  // Sleep until the capture task signals a new stride of audio instead of
+  // spinning on the timestamp.
+  int32_t current_time = audio_.LatestAudioTimestamp();
+  const int stride_ms = feature_provider_.stride_ms();
+  if (current_time / stride_ms == previous_time_ / stride_ms) {
+    audio_.WaitForNewAudio(kAudioWaitTimeoutMs);
+    current_time = audio_.LatestAudioTimestamp();
+  }
+
+  // Fetch the spectrogram for the current time. This is shared by all models.
+  int how_many_new_slices = 0;
+  const int64_t features_start_us = esp_timer_get_time();
+  TfLiteStatus feature_status = feature_provider_.PopulateFeatureData(
+      previous_time_, current_time, &how_many_new_slices);
+  if (feature_status != kTfLiteOk) {
+    deferred_log(DLOG_FEATURES_FAILED, 0, 0);
+    return;
+  }
+  previous_time_ = current_time;
+  // If no new audio samples have been received since last time, don't bother
+  // running the network model.
+  if (how_many_new_slices == 0) {
+    return;
+  }
+  const int64_t classifiers_start_us = esp_timer_get_time();
+  cadence_.RecordFeatures(how_many_new_slices,
+                         classifiers_start_us - features_start_us);
+  cadence_.RecordBacklog(audio_.AudioBacklogMs());
+
+  // A rebuilt spectrogram holds no windows the models missed, only one new
+  // window at its end.
+  int new_strides = how_many_new_slices;
+  if (feature_provider_.refilled()) {
+    ResetPendingWindows();
+    new_strides = 1;
+  }
+  // The classifiers only run every cadence.strides() strides when they can't
+  // keep up with every one.
+  const int new_windows = cadence_.AddStrides(new_strides);
+  // The gate runs first so that a keyword model sees it open on the window it
+  // fired on.
+  if (new_windows > 0 && cascade_.running) {
+    struct tf_result top;
+    int64_t window_us = 0;
+    if (ClassifyWindows(cascade_.slot, -1, new_windows, current_time, &top,
+                        &window_us) &&
+        first_inference_us_ < 0) {
+      first_inference_us_ = esp_timer_get_time();
+    }
+  }
+  for (int i = 0; new_windows > 0 && i < slot_count_; i++) {
+    ModelSlot& slot = slots_[i];
+    struct tf_result top;
+    int64_t window_us = 0;
+    if (!ClassifyWindows(slot, i, new_windows, current_time, &top,
+                         &window_us)) {
+      continue;
+    }
+
+    if (first_inference_us_ < 0) {
+      first_inference_us_ = esp_timer_get_time();
+    }
+
+    // The candidate is compared against the first (primary) model, so with a
+    // cascade only on the windows the gate let through.
+    if (i == 0 && shadow_.running) {
+      RunShadow(slot, top, window_us);
+    }
+  }
+  if (new_windows > 0) {
+    cadence_.RecordClassifiers(esp_timer_get_time() - classifiers_start_us);
+  }
+  if (cadence_.Update(stride_ms)) {
+    MicroPrintf("Classifier cadence %d strides (load %d%%, backlog %d ms)",
+                cadence_.strides(), cadence_.load_pct(), cadence_.backlog_ms());
+  }
+
+  if (++steps_since_stats_ == kStatsLogInterval) {
+    LogStats();
+    steps_since_stats_ = 0;
+  }
+}
+
+enum tf_corpus_status SpeechPipeline::RunCorpus(
+    struct tf_model_ctx* ctx, const char* dir,
+    struct tf_corpus_report* report) {
+  *report = {};
+  if (slot_count_ == 0) {
+    return TF_CORPUS_ERROR;
+  }
+
+  DIR* corpus = opendir(dir);
+  if (corpus == nullptr) {
+    MicroPrintf("Corpus: unable to open %s", dir);
+    return TF_CORPUS_UNREADABLE;
+  }
+
+  // A model that isn't running borrows the shadow's interpreter for the run.
+  ModelSlot temporary = {};
+  ModelSlot* slot = FindSlot(ctx);
+  if (slot == nullptr) {
+    bool out_of_memory = shadow_.running;
+    if (shadow_.running ||
+        BuildSlot(ctx, shadow_interpreter_storage_, &temporary,
+                  &out_of_memory) != kTfLiteOk) {
+      closedir(corpus);
+      return out_of_memory ? TF_CORPUS_NO_MEMORY : TF_CORPUS_ERROR;
+    }
+    slot = &temporary;
+  }
+
+  constexpr int kMaxSamples = kMaxCorpusClipMs * kAudioSampleFrequency / 1000;
+  const int min_samples =
+      kFeatureDurationMs * kAudioSampleFrequency / 1000 +
+      (slot->feature_count - 1) * GetStrideMs(ctx) * kAudioSampleFrequency /
+          1000;
+  const int buffer_samples = std::max(kMaxSamples, min_samples);
+  int16_t* samples = static_cast<int16_t*>(heap_caps_malloc(
+      buffer_samples * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT));
+  int8_t* features =
+      static_cast<int8_t*>(malloc(slot->feature_count * kFeatureSize));
+
+  int64_t total_us = 0;
+  enum tf_corpus_status status =
+      (samples && features) ? TF_CORPUS_OK : TF_CORPUS_NO_MEMORY;
+  struct dirent* entry;
+  while (status == TF_CORPUS_OK && (entry = readdir(corpus)) != nullptr) {
+    const char* ext = strrchr(entry->d_name, '.');
+    if (ext == nullptr || strcasecmp(ext, ".wav") != 0) {
+      continue;
+    }
+
+    char path[128];
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    int count =
+        WavLoadClip(path, kAudioSampleFrequency, samples, buffer_samples);
+    if (count < 0) {
+      continue;
+    }
+    // Short clips are padded with silence to fill one spectrogram.
+    if (count < min_samples) {
+      std::fill(samples + count, samples + min_samples, 0);
+      count = min_samples;
+    }
+
+    struct tf_result best;
+    if (RunClip(*slot, samples, count, features, &best, &total_us, report) !=
+        kTfLiteOk) {
+      status = TF_CORPUS_ERROR;
+      break;
+    }
+
+    char label[kMaxCorpusLabelLen];
+    ClipLabel(entry->d_name, label);
+    report->clips++;
+    if (best.count > 0 && strcmp(TopLabel(*slot, best), label) == 0) {
+      report->correct++;
+    } else {
+      MicroPrintf("Corpus: %s scored as %s", entry->d_name,
+                  best.count > 0 ? TopLabel(*slot, best) : "nothing");
+    }
+    if (IsDetection(*slot, best)) {
+      report->detections++;
+    }
+  }
+
+  report->avg_us = report->invokes
+      ? static_cast<int32_t>(total_us / report->invokes) : 0;
+  report->arena_used = slot->interpreter->arena_used_bytes();
+
+  closedir(corpus);
+  heap_caps_free(samples);
+  free(features);
+  if (slot == &temporary) {
+    DestroySlot(&temporary);
+  }
+
+  if (status == TF_CORPUS_OK && report->clips == 0) {
+    status = TF_CORPUS_UNREADABLE;
+  }
+  if (status != TF_CORPUS_OK) {
+    MicroPrintf("Corpus: no clips scored from %s", dir);
+    return status;
+  }
+  MicroPrintf("Corpus: %u/%u clips correct, %u detections, avg %d us, max %d "
+              "us per invoke, arena %u bytes",
+              static_cast<unsigned>(report->correct),
+              static_cast<unsigned>(report->clips),
+              static_cast<unsigned>(report->detections),
+              static_cast<int>(report->avg_us),
+              static_cast<int>(report->max_us),
+              static_cast<unsigned>(report->arena_used));
+  return TF_CORPUS_OK;
+}
+
+bool SpeechPipeline::PopResult(struct tf_result* result) {
+  const uint32_t tail = result_tail_.load(std::memory_order_relaxed);
+  if (tail == result_head_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  *result = result_queue_[tail % kResultQueueLength];
+  result_tail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+const char* SpeechPipeline::Label(int model, int label) const {
+  if (model < 0 || model >= slot_count_ || label < 0 ||
+      label >= slots_[model].ctx->label_count) {
+    return "";
+  }
+  return slots_[model].ctx->labels[label];
+}
+
+void SpeechPipeline::GetCadence(struct tf_cadence_report* report) const {
+  report->strides = cadence_.strides();
+  report->increases = cadence_.increases();
+  report->decreases = cadence_.decreases();
+  report->load_pct = cadence_.load_pct();
+  report->backlog_ms = cadence_.backlog_ms();
+}
+
+void SpeechPipeline::GetCascade(struct tf_cascade_report* report) const {
+  report->running = cascade_.running;
+  report->openings = cascade_.openings;
+  report->scored_windows = cascade_.scored_windows;
+  report->gated_windows = cascade_.gated_windows;
+  report->avoided_pct = CascadeAvoidedPct();
+}
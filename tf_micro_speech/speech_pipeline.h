@@ -0,0 +1,194 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_SPEECH_PIPELINE_H_
+#define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_SPEECH_PIPELINE_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "audio_provider.h"
+#include "feature_provider.h"
+#include "inference_cadence.h"
+#include "main_functions.h"
+#include "micro_model_settings.h"
+#include "tensorflow/lite/micro/micro_interpreter.h"
+#include "tensorflow/lite/schema/schema_generated.h"
+
+class SharedArena;
+
+// One keyword model scored on the shared spectrogram.
+struct ModelSlot {
+  struct tf_model_ctx* ctx;
+  const tflite::Model* model;
+  tflite::MicroAllocator* allocator;
+  tflite::MicroInterpreter* interpreter;
+  int8_t* input_buffer;
+  // Spectrogram slices the model reads: the newest ones in the
+  // pipeline's feature buffer.
+  int feature_count;
+  // Windows scored per Invoke(): the first dimension of the input.
+  int batch;
+  // Windows ending at the newest slices that haven't been scored yet.
+  int pending;
+  // ctx->threshold in the output's quantized domain: a score is a detection
+  // when it is strictly greater.
+  int8_t q_threshold;
+  // Stage one of the cascade: its detections open the gate for the keyword
+  // models instead of being reported.
+  bool gate;
+};
+
+// One audio stream scored by a set of keyword models: the audio reader, the
+// audio front-end, the spectrogram, the classifiers' interpreters and the
+// results queue. Instances are independent of each other, so there can be one
+// per stream or per core, and destroying one releases everything it built.
+// The C interface in main_functions.h drives a single instance. All methods
+// except PopResult() must be called from the same task.
+class SpeechPipeline {
+ public:
+  // Scores the audio in |capture|, whose ring must have no other reader. All
+  // interpreters are built in |arena|, which must be empty and must not be
+  // shared with a pipeline running on another task. Both must outlive the
+  // pipeline.
+  SpeechPipeline(AudioCapture* capture, SharedArena* arena);
+  // Destroys all interpreters and resets the arena.
+  ~SpeechPipeline();
+
+  SpeechPipeline(const SpeechPipeline&) = delete;
+  SpeechPipeline& operator=(const SpeechPipeline&) = delete;
+
+  // Each of these is documented with the matching tf_micro_speech_* function
+  // in main_functions.h.
+  int AddModel(struct tf_model_ctx* ctx);
+  int SetGate(struct tf_model_ctx* ctx, int hold_ms);
+  enum tf_shadow_start StartShadow(struct tf_model_ctx* ctx,
+                                   const struct tf_shadow_config* config);
+  enum tf_shadow_verdict ShadowVerdict(struct tf_shadow_report* report);
+  void StopShadow();
+  enum tf_corpus_status RunCorpus(struct tf_model_ctx* ctx, const char* dir,
+                                  struct tf_corpus_report* report);
+  void RunInference();
+  bool PopResult(struct tf_result* result);
+  const char* Label(int model, int label) const;
+  uint32_t dropped_results() const {
+    return dropped_results_.load(std::memory_order_relaxed);
+  }
+  int64_t first_inference_us() const { return first_inference_us_; }
+  void GetCadence(struct tf_cadence_report* report) const;
+  void GetCascade(struct tf_cascade_report* report) const;
+
+ private:
+  // Detections waiting for a consumer. Must be a power of two so the indices
+  // can wrap.
+  static constexpr uint32_t kResultQueueLength = 16;
+
+  // A candidate model evaluated next to the active one before promotion. It
+  // takes a persistent arena section like any other model, so it only fits
+  // while fewer than kMaxConcurrentModels models are active.
+  struct ShadowState {
+    bool running;
+    ModelSlot slot;
+    struct tf_shadow_config config;
+    int64_t start_us;
+    uint32_t steps;
+    uint32_t runs;
+    int64_t candidate_total_us;
+    // Latency of the active model over the same steps, for comparison.
+    int64_t active_total_us;
+    uint32_t compared;
+    uint32_t agreed;
+    size_t arena_used;
+  };
+
+  // Two-stage cascade. A small gate model scores every window and the keyword
+  // models only score windows while it has fired within the last hold_ms. The
+  // windows they pass over are still in the spectrogram, so a keyword model
+  // scores the same audio the gate fired on.
+  struct CascadeState {
+    bool running;
+    ModelSlot slot;
+    int hold_ms;
+    // Audio timestamp up to which the keyword models run.
+    int32_t open_until_ms;
+    uint32_t openings;
+    // Keyword model windows scored and passed over since the gate was set.
+    uint32_t scored_windows;
+    uint32_t gated_windows;
+  };
+
+  TfLiteStatus BuildSlot(struct tf_model_ctx* ctx, uint8_t* storage,
+                         ModelSlot* slot, bool* out_of_memory = nullptr);
+  void DestroySlot(ModelSlot* slot);
+  bool MatchesRunningStride(const struct tf_model_ctx* ctx) const;
+  TfLiteStatus UpdateFeatureGeometry(int stride_ms);
+  template <int kCount>
+  void CopyInput(const ModelSlot& slot, int oldest_age, int rows);
+  int64_t InvokeSlot(const ModelSlot& slot, int oldest_age = 0, int rows = 1);
+  int CascadeAvoidedPct() const;
+  void LogStats();
+  void UpdateGate(const struct tf_result& result);
+  void PushResult(const struct tf_result& result);
+  void RunShadow(const ModelSlot& active, const struct tf_result& active_top,
+                 int64_t active_us);
+  bool ClassifyWindows(ModelSlot& slot, int index, int new_slices,
+                       int32_t current_time, struct tf_result* top,
+                       int64_t* window_us);
+  ModelSlot* FindSlot(const struct tf_model_ctx* ctx);
+  void ResetPendingWindows();
+#if CONFIG_SHARED_ARENA_SELF_TEST
+  TfLiteStatus CheckSharedArena(const ModelSlot& slot);
+#endif
+  TfLiteStatus RunClip(const ModelSlot& slot, const int16_t* samples,
+                       int sample_count, int8_t* features,
+                       struct tf_result* best, int64_t* total_us,
+                       struct tf_corpus_report* report);
+
+  SharedArena* arena_;
+  AudioReader audio_;
+  int8_t feature_buffer_[kMaxFeatureElementCount];
+  FeatureProvider feature_provider_;
+
+  ModelSlot slots_[kMaxConcurrentModels];
+  int slot_count_;
+  alignas(tflite::MicroInterpreter) uint8_t
+      interpreter_storage_[kMaxConcurrentModels]
+                          [sizeof(tflite::MicroInterpreter)];
+
+  ShadowState shadow_;
+  alignas(tflite::MicroInterpreter) uint8_t
+      shadow_interpreter_storage_[sizeof(tflite::MicroInterpreter)];
+
+  CascadeState cascade_;
+#if CONFIG_MODEL_CASCADE
+  alignas(tflite::MicroInterpreter) uint8_t
+      gate_interpreter_storage_[sizeof(tflite::MicroInterpreter)];
+#endif
+
+  int32_t previous_time_;
+  uint32_t steps_since_stats_;
+  InferenceCadence cadence_;
+  int64_t first_inference_us_;
+
+  // Single-producer single-consumer ring of detections. The inference loop
+  // only advances result_head_ and the consumer only advances result_tail_.
+  struct tf_result result_queue_[kResultQueueLength];
+  std::atomic<uint32_t> result_head_;
+  std::atomic<uint32_t> result_tail_;
+  std::atomic<uint32_t> dropped_results_;
+};
+
+#endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_SPEECH_PIPELINE_H_
@@ -0,0 +1,168 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#include "wav_source.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "tensorflow/lite/micro/micro_log.h"
+
+namespace {
+constexpr uint16_t kWavFormatPcm = 1;
+
+FILE* g_file = nullptr;
+long g_data_start = 0;
+uint32_t g_data_len = 0;
+uint32_t g_data_pos = 0;
+int g_bytes_per_second = 0;
+// When the audio handed out so far would have finished playing
+int64_t g_next_read_us = 0;
+
+uint32_t Le32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+uint16_t Le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+}  // namespace
+
+namespace {
+// Opens |path| and leaves it positioned at the start of the audio data after
+// checking that it is 16-bit mono PCM at |sample_rate|. Returns nullptr on
+// failure.
+FILE* OpenPcm(const char* path, int sample_rate, uint32_t* data_len) {
+  FILE* f = fopen(path, "rb");
+  if (f == nullptr) {
+    MicroPrintf("WAV: unable to open %s", path);
+    return nullptr;
+  }
+
+  uint8_t riff[12];
+  if (fread(riff, 1, sizeof(riff), f) != sizeof(riff) ||
+      memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+    MicroPrintf("WAV: %s is not a WAV file", path);
+    fclose(f);
+    return nullptr;
+  }
+
+  // Walk the chunks up to "data"; "fmt " must come first.
+  bool format_ok = false;
+  uint8_t chunk[8];
+  while (fread(chunk, 1, sizeof(chunk), f) == sizeof(chunk)) {
+    const uint32_t chunk_len = Le32(chunk + 4);
+    if (memcmp(chunk, "fmt ", 4) == 0) {
+      uint8_t fmt[16];
+      if (chunk_len < sizeof(fmt) ||
+          fread(fmt, 1, sizeof(fmt), f) != sizeof(fmt)) {
+        break;
+      }
+      format_ok = Le16(fmt) == kWavFormatPcm && Le16(fmt + 2) == 1 &&
+                  static_cast<int>(Le32(fmt + 4)) == sample_rate &&
+                  Le16(fmt + 14) == 16;
+      if (!format_ok) {
+        MicroPrintf(
+            "WAV: %s must be 16-bit mono PCM at %d Hz, got format %d, %d "
+            "channels, %d Hz, %d bits",
+            path, sample_rate, Le16(fmt), Le16(fmt + 2),
+            static_cast<int>(Le32(fmt + 4)), Le16(fmt + 14));
+        break;
+      }
+      fseek(f, (chunk_len - sizeof(fmt) + 1) & ~1u, SEEK_CUR);
+    } else if (memcmp(chunk, "data", 4) == 0) {
+      if (format_ok && chunk_len >= sizeof(int16_t)) {
+        *data_len = chunk_len & ~1u;
+        return f;
+      }
+      break;
+    } else {
+      // Chunks are padded to an even length
+      fseek(f, (chunk_len + 1) & ~1u, SEEK_CUR);
+    }
+  }
+
+  if (format_ok) {
+    MicroPrintf("WAV: no audio data in %s", path);
+  }
+  fclose(f);
+  return nullptr;
+}
+}  // namespace
+
+TfLiteStatus WavSourceOpen(const char* path, int sample_rate) {
+  g_file = OpenPcm(path, sample_rate, &g_data_len);
+  if (g_file == nullptr) {
+    return kTfLiteError;
+  }
+  g_data_start = ftell(g_file);
+  g_data_pos = 0;
+  g_bytes_per_second = sample_rate * sizeof(int16_t);
+  g_next_read_us = esp_timer_get_time();
+  MicroPrintf("WAV source: playing %s (%d ms) in a loop", path,
+              static_cast<int>(static_cast<int64_t>(g_data_len) * 1000 /
+                               g_bytes_per_second));
+  return kTfLiteOk;
+}
+
+int WavLoadClip(const char* path, int sample_rate, int16_t* samples,
+                int max_samples) {
+  uint32_t data_len = 0;
+  FILE* f = OpenPcm(path, sample_rate, &data_len);
+  if (f == nullptr) {
+    return -1;
+  }
+  int count = data_len / sizeof(int16_t);
+  if (count > max_samples) {
+    count = max_samples;
+  }
+  const bool ok =
+      fread(samples, sizeof(int16_t), count, f) == static_cast<size_t>(count);
+  fclose(f);
+  return ok ? count : -1;
+}
+
+int WavSourceRead(uint8_t* buffer, size_t len) {
+  if (g_file == nullptr) {
+    return -EBADF;
+  }
+
+  size_t filled = 0;
+  while (filled < len) {
+    if (g_data_pos == g_data_len) {
+      fseek(g_file, g_data_start, SEEK_SET);
+      g_data_pos = 0;
+    }
+    size_t chunk = len - filled;
+    if (chunk > g_data_len - g_data_pos) {
+      chunk = g_data_len - g_data_pos;
+    }
+    if (fread(buffer + filled, 1, chunk, g_file) != chunk) {
+      return -EIO;
+    }
+    filled += chunk;
+    g_data_pos += chunk;
+  }
+
+  // Hand out audio no faster than a microphone would
+  g_next_read_us += static_cast<int64_t>(len) * 1000000 / g_bytes_per_second;
+  const int64_t wait_us = g_next_read_us - esp_timer_get_time();
+  if (wait_us > 0) {
+    vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+  }
+  return 0;
+}
@@ -0,0 +1,42 @@
+/* Copyright 2024 Golioth, Inc.
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+    http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+==============================================================================*/
+
+#ifndef TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_WAV_SOURCE_H_
+#define TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_WAV_SOURCE_H_
+
+// Stands in for the microphone with a WAV file, e.g. on the SD card. The file
+// must be 16-bit mono PCM at the capture rate; it is played in a loop and
+// paced in real time, so everything downstream of the capture task behaves as
+// with live audio but on repeatable input.
+
+#include <cstddef>
+#include <cstdint>
+
+#include "tensorflow/lite/c/common.h"
+
+// Opens |path| and checks that its format is 16-bit mono PCM at |sample_rate|.
+TfLiteStatus WavSourceOpen(const char* path, int sample_rate);
+
+// Fills |buffer| with the next |len| bytes of audio, wrapping to the start of
+// the file, and returns once that much audio time has passed since the
+// previous read. Returns 0 or a negative errno-style code.
+int WavSourceRead(uint8_t* buffer, size_t len);
+
+// Reads up to |max_samples| samples of a 16-bit mono PCM file at
+// |sample_rate| into |samples|. Returns the number read, or -1 on error.
+int WavLoadClip(const char* path, int sample_rate, int16_t* samples,
+                int max_samples);
+
+#endif  // TENSORFLOW_LITE_MICRO_EXAMPLES_MICRO_SPEECH_WAV_SOURCE_H_
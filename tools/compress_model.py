@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024 Golioth, Inc.
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Compress model artifacts for upload and report the size saved.
+
+Writes <model>.gmz next to every model given on the command line, in the
+streaming deflate format that the device decompresses while downloading (see
+main/model_inflate.h). Each output is decoded again and compared with its
+input before it is written. Upload the .gmz file as the artifact; the device
+stores the decompressed model.
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+MAGIC = b'GMZ1'
+HEADER = struct.Struct('<4sB3xI')
+
+
+def compress(data, window_bits):
+    deflate = zlib.compressobj(9, zlib.DEFLATED, -window_bits, 9)
+    return HEADER.pack(MAGIC, window_bits, len(data)) + deflate.compress(data) + deflate.flush()
+
+
+def decompress(blob):
+    magic, window_bits, size = HEADER.unpack_from(blob)
+    if magic != MAGIC:
+        raise ValueError('not a compressed artifact')
+    inflate = zlib.decompressobj(-window_bits)
+    data = inflate.decompress(blob[HEADER.size:])
+    if not inflate.eof or inflate.unused_data or len(data) != size:
+        raise ValueError('truncated or oversized artifact')
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--window-bits', type=int, default=10, choices=range(9, 16),
+                        help='log2 of the decoder window (RAM used on the device)')
+    parser.add_argument('--dry-run', action='store_true', help='only report sizes')
+    parser.add_argument('models', nargs='+', help='model files, e.g. models/*')
+    args = parser.parse_args()
+
+    print(f'{"model":<32} {"original":>9} {"compressed":>10} {"ratio":>6}')
+    for path in args.models:
+        with open(path, 'rb') as f:
+            data = f.read()
+        blob = compress(data, args.window_bits)
+        if decompress(blob) != data:
+            print(f'{path}: round trip failed', file=sys.stderr)
+            return 1
+        print(f'{path:<32} {len(data):>9} {len(blob):>10} {len(blob) / len(data):>6.1%}')
+        if len(blob) >= len(data):
+            print(f'{path}: not smaller, upload the original', file=sys.stderr)
+        elif not args.dry_run:
+            with open(path + '.gmz', 'wb') as f:
+                f.write(blob)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,232 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2024 Golioth, Inc.
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Report and enforce the static memory budget of the speech pipeline.
+
+Reads the symbol table of the application ELF, places every budgeted symbol in
+its memory region (IRAM/DRAM/PSRAM) and fails if a symbol or a region total is
+larger than allowed by the budget file. A budgeted symbol that is missing from
+the ELF is an error too, since the budget would silently stop covering it.
+
+Heap buffers that are allocated once at boot have no symbol of their own. The
+code exports their size as a constant (e.g. g_audio_capture_buffer_size) and the
+budget file names that constant, so the report uses the size the firmware
+actually allocates. The sizes budgets are expressed in (an arena section, an
+interpreter, one audio read) are exported the same way and bound to names in the
+budget's "constants", so the budget file repeats none of them.
+
+Buffers sized by Kconfig options get budgets that follow the same options: any
+budget may be an expression over the values in the build's sdkconfig.json
+(booleans count as 0 or 1), the "constants" and the names in the budget's
+"defines". A symbol
+entry may also be an object with a "when" expression; it is only checked, and
+only required, when that expression is true (e.g. buffers that the linker drops
+in some configurations).
+"""
+
+import argparse
+import ast
+import json
+import operator
+import re
+import subprocess
+import sys
+
+SECTION_REGIONS = (
+    ('.iram0.', 'IRAM'),
+    ('.dram0.', 'DRAM'),
+    ('.noinit', 'DRAM'),
+    ('.ext_ram', 'PSRAM'),
+    ('.rtc', 'RTC'),
+    ('.flash.', 'FLASH'),
+)
+
+OPERATORS = {
+    ast.Add: operator.add,
+    ast.Sub: operator.sub,
+    ast.Mult: operator.mul,
+    ast.FloorDiv: operator.floordiv,
+    ast.USub: operator.neg,
+    ast.Eq: operator.eq,
+    ast.NotEq: operator.ne,
+    ast.Lt: operator.lt,
+    ast.LtE: operator.le,
+    ast.Gt: operator.gt,
+    ast.GtE: operator.ge,
+}
+
+SYMBOL_RE = re.compile(r'^([0-9a-f]+)\s+.{7}\s+(\S+)\s+([0-9a-f]+)\s+(.+)$')
+
+
+def section_region(section):
+    for prefix, region in SECTION_REGIONS:
+        if section.startswith(prefix):
+            return region
+    return None
+
+
+def evaluate(value, names):
+    """Evaluate an integer budget, either a number or an arithmetic expression."""
+    if isinstance(value, int):
+        return value
+
+    def walk(node):
+        if isinstance(node, ast.Expression):
+            return walk(node.body)
+        if isinstance(node, ast.Constant) and isinstance(node.value, int):
+            return node.value
+        if isinstance(node, ast.Name):
+            if node.id not in names:
+                raise ValueError('unknown name {} in "{}"'.format(node.id, value))
+            return names[node.id]
+        if isinstance(node, ast.BinOp) and type(node.op) in OPERATORS:
+            return OPERATORS[type(node.op)](walk(node.left), walk(node.right))
+        if isinstance(node, ast.UnaryOp) and type(node.op) in OPERATORS:
+            return OPERATORS[type(node.op)](walk(node.operand))
+        if (isinstance(node, ast.Compare) and len(node.ops) == 1
+                and type(node.ops[0]) in OPERATORS):
+            return int(OPERATORS[type(node.ops[0])](walk(node.left),
+                                                    walk(node.comparators[0])))
+        raise ValueError('unsupported expression "{}"'.format(value))
+
+    return walk(ast.parse(value, mode='eval'))
+
+
+def read_config(path):
+    """Integer and boolean options of sdkconfig.json, booleans as 0 or 1."""
+    if not path:
+        return {}
+    with open(path) as f:
+        config = json.load(f)
+    return {name: int(value) for name, value in config.items()
+            if isinstance(value, (bool, int))}
+
+
+def short_name(symbol):
+    """Strip namespaces so '(anonymous namespace)::tensor_arena' matches."""
+    return symbol.rsplit('::', 1)[-1]
+
+
+def read_symbols(objdump, elf):
+    out = subprocess.run([objdump, '-t', '-C', elf],
+                         check=True, capture_output=True, text=True).stdout
+    symbols = {}
+    for line in out.splitlines():
+        match = SYMBOL_RE.match(line)
+        if not match:
+            continue
+        address, section, size, name = match.groups()
+        symbols.setdefault(short_name(name), []).append(
+            (section, int(size, 16), int(address, 16)))
+    return symbols
+
+
+def read_value(objdump, elf, section, address, size):
+    """Read a little-endian integer constant from the ELF."""
+    out = subprocess.run([objdump, '-s', '-j', section,
+                          '--start-address={:#x}'.format(address),
+                          '--stop-address={:#x}'.format(address + size), elf],
+                         check=True, capture_output=True, text=True).stdout
+    data = b''
+    for line in out.splitlines():
+        # ' 3c0a1230 409c0000                             @...': the hex groups
+        # sit between the address and the ASCII column.
+        if line.startswith(' '):
+            for group in line[1:].split('  ')[0].split()[1:]:
+                data += bytes.fromhex(group)
+    return int.from_bytes(data[:size], 'little')
+
+
+def read_constant(objdump, elf, symbols, name):
+    """Value of the integer constant symbol name, None if it is not in the ELF."""
+    entries = symbols.get(name)
+    if not entries:
+        return None
+    section, width, address = entries[0]
+    return read_value(objdump, elf, section, address, width)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument('--objdump', default='objdump', help='objdump for the target')
+    parser.add_argument('--budget', required=True, help='JSON budget file')
+    parser.add_argument('--sdkconfig', help='sdkconfig.json of the build')
+    parser.add_argument('elf', help='application ELF')
+    args = parser.parse_args()
+
+    with open(args.budget) as f:
+        budget = json.load(f)
+
+    symbols = read_symbols(args.objdump, args.elf)
+    try:
+        names = read_config(args.sdkconfig)
+        for name, symbol in budget.get('constants', {}).items():
+            value = read_constant(args.objdump, args.elf, symbols, symbol)
+            if value is None:
+                raise ValueError('{} is not in the ELF'.format(symbol))
+            names[name] = value
+        for name, value in budget.get('defines', {}).items():
+            names[name] = evaluate(value, names)
+        regions = {region: evaluate(value, names)
+                   for region, value in budget['regions'].items()}
+        symbol_budgets = {}
+        for name, entry in budget['symbols'].items():
+            if isinstance(entry, dict):
+                if not evaluate(entry['when'], names):
+                    continue
+                entry = entry['size']
+            symbol_budgets[name] = evaluate(entry, names)
+        heap_budgets = {name: evaluate(entry['budget'], names)
+                        for name, entry in budget.get('heap', {}).items()}
+    except ValueError as e:
+        print('error: memory budget: {}'.format(e), file=sys.stderr)
+        return 1
+
+    totals = {region: 0 for region in regions}
+    errors = []
+
+    print('{:<32} {:<8} {:>8} {:>8}'.format('symbol', 'region', 'size', 'budget'))
+    for name, allowed in symbol_budgets.items():
+        entries = symbols.get(name)
+        if not entries:
+            print('{:<32} {:<8} {:>8} {:>8}'.format(name, '-', '-', allowed))
+            errors.append('{} is not in the ELF'.format(name))
+            continue
+        for section, size, _ in entries:
+            region = section_region(section) or section
+            totals[region] = totals.get(region, 0) + size
+            print('{:<32} {:<8} {:>8} {:>8}'.format(name, region, size, allowed))
+            if size > allowed:
+                errors.append('{} is {} bytes, budget is {}'.format(name, size, allowed))
+
+    for name, entry in budget.get('heap', {}).items():
+        region = entry['region']
+        allowed = heap_budgets[name]
+        size = read_constant(args.objdump, args.elf, symbols, entry['size_symbol'])
+        if size is None:
+            print('{:<32} {:<8} {:>8} {:>8}'.format(name + ' (heap)', region, '-', allowed))
+            errors.append('{} is not in the ELF'.format(entry['size_symbol']))
+            continue
+        totals[region] = totals.get(region, 0) + size
+        print('{:<32} {:<8} {:>8} {:>8}'.format(name + ' (heap)', region, size, allowed))
+        if size > allowed:
+            errors.append('{} is {} bytes, budget is {}'.format(name, size, allowed))
+
+    print()
+    print('{:<32} {:>8} {:>8}'.format('region', 'used', 'budget'))
+    for region, used in sorted(totals.items()):
+        allowed = regions.get(region)
+        print('{:<32} {:>8} {:>8}'.format(region, used, '-' if allowed is None else allowed))
+        if allowed is not None and used > allowed:
+            errors.append('{} uses {} bytes, budget is {}'.format(region, used, allowed))
+
+    for error in errors:
+        print('error: memory budget exceeded: ' + error, file=sys.stderr)
+    return 1 if errors else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())